@@ -6,8 +6,17 @@ Based on John Dey's pwalk C implementation.
 """
 
 from .walk import walk
-from .report import report
+from .report import report, stat_many, SNAPSHOT_DIRS
 from .repair import repair
+from .du import du
+from .find import find
+from .estimate import estimate
+from .extensions import extensions
+from .cold import cold
+from .history import record_history, trend
+from .query import query
+from .tree import load_tree
+from .index import open_index
 
 __version__ = "0.1.6"
-__all__ = ["walk", "report", "repair"]
+__all__ = ["walk", "report", "stat_many", "du", "find", "estimate", "extensions", "cold", "record_history", "trend", "query", "load_tree", "open_index", "repair", "SNAPSHOT_DIRS"]
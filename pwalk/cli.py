@@ -10,8 +10,26 @@ from pathlib import Path
 
 from . import __version__
 from .walk import walk
-from .report import report
+from .report import report, stat_many, SNAPSHOT_DIRS, ORDERS
 from .repair import repair
+from .du import du, format_size
+from .find import find, parse_expression
+from .query import query
+from .estimate import estimate, STATS
+from .extensions import extensions
+from .cold import cold, parse_size
+from .history import record_history, trend, KINDS
+from .index import open_index
+from .serve import DEFAULT_SOCKET
+
+
+class _Aggregate(argparse.Action):
+    """Collect --sum/--min/--max/--avg/--count in command line order."""
+
+    def __call__(self, parser, namespace, values, option_string=None):
+        aggregates = getattr(namespace, self.dest) or []
+        aggregates.append((option_string.lstrip('-'), values))
+        setattr(namespace, self.dest, aggregates)
 
 
 def main():
@@ -34,11 +52,230 @@ def main():
 
     # Report command
     report_parser = subparsers.add_parser('report', help='Generate filesystem metadata report')
-    report_parser.add_argument('path', help='Starting directory path')
-    report_parser.add_argument('--format', choices=['parquet', 'csv'], default='parquet',
-                              help='Output format (default: parquet)')
+    report_parser.add_argument('path', nargs='+', help='Starting directory path(s); several roots share one worker pool')
+    report_parser.add_argument('--compress', choices=['auto', 'zstd', 'lz4', 'none'], default='auto',
+                              help='Output compression (default: auto)')
     report_parser.add_argument('--output', '-o', help='Output file path')
+    report_parser.add_argument('--per-root-output', action='store_true',
+                              help='With several roots, write ROOTNAME.csv per root instead of one file with root_id')
     report_parser.add_argument('--max-threads', type=int, help='Maximum threads')
+    report_parser.add_argument('--one-filesystem', '-x', action='store_true',
+                              help='Do not descend into other filesystems (list skipped mountpoints)')
+    report_parser.add_argument('--skip', action='append', dest='skip_names', metavar='NAME',
+                              help='Directory name to skip (repeatable; default: .snapshot)')
+    report_parser.add_argument('--skip-all-snapshots', action='store_true',
+                              help=f'Skip {", ".join(SNAPSHOT_DIRS)}')
+    report_parser.add_argument('--max-depth', type=int,
+                              help='Only report entries up to this many levels below path')
+    report_parser.add_argument('--count-below', action='store_true',
+                              help='With --max-depth, still count entries below the cut-off')
+    report_parser.add_argument('--xattrs', choices=['acl', 'all'],
+                              help='Add has_acl (acl) or has_acl and xattr names (all) columns')
+    report_parser.add_argument('--ns-timestamps', action='store_true',
+                              help='Add nanosecond atime/mtime/ctime and birth time columns')
+    report_parser.add_argument('--inode-order', action='store_true',
+                              help='Stat entries in inode order (HDD and cold-cache scans)')
+    report_parser.add_argument('--hints', metavar='SCAN',
+                              help='Previous uncompressed scan used to schedule big subtrees first')
+    report_parser.add_argument('--order', choices=list(ORDERS), default='largest',
+                              help='Traversal order (default: largest)')
+    report_parser.add_argument('--frontier-limit', type=int, default=256,
+                              help='Queued-directory memory in MiB before hybrid order goes depth-first')
+    report_parser.add_argument('--names', action='store_true',
+                              help='Add user and group name columns (resolved once per id)')
+    report_parser.add_argument('--prefetch', type=int, default=0, metavar='K',
+                              help='Read the next K queued directories ahead of the workers (NFS)')
+    report_parser.add_argument('--checksum', action='store_true',
+                              help='Add an xxh64 column hashing every file\'s content')
+    report_parser.add_argument('--checksum-threads', type=int, default=4, metavar='N',
+                              help='Files read concurrently for --checksum (default: 4)')
+    report_parser.add_argument('--checksum-bandwidth', metavar='RATE',
+                              help='Cap --checksum reads at RATE bytes/s, e.g. 500M')
+    report_parser.add_argument('--direct-io', action='store_true',
+                              help='Read files for --checksum with O_DIRECT')
+    report_parser.add_argument('--history', metavar='FILE',
+                              help='Append per-user/group/top-dir totals to FILE for pwalk trend')
+    report_parser.add_argument('--index', action='store_true',
+                              help='Also write a path/inode index (OUTPUT.pidx) for pwalk lookup')
+
+    # Stat command
+    stat_parser = subparsers.add_parser('stat', help='Report metadata for an explicit list of paths')
+    stat_parser.add_argument('path', nargs='*', help='Paths to stat')
+    stat_parser.add_argument('--from-file', '-f', metavar='FILE',
+                            help="Read paths from FILE, one per line ('-' for stdin)")
+    stat_parser.add_argument('--null', '-0', action='store_true',
+                            help='Paths in --from-file are NUL-separated (find -print0)')
+    stat_parser.add_argument('--output', '-o', default='stat.csv',
+                            help="Output file path ('-' for stdout)")
+    stat_parser.add_argument('--compress', choices=['auto', 'zstd', 'lz4', 'none'], default='none',
+                            help='Compression mode (default: none)')
+    stat_parser.add_argument('--max-threads', type=int, help='Maximum threads')
+    stat_parser.add_argument('--xattrs', choices=['acl', 'all'],
+                            help='Add has_acl (acl) or has_acl and xattr name (all) columns')
+    stat_parser.add_argument('--ns-timestamps', action='store_true',
+                            help='Add nanosecond and birth time columns')
+    stat_parser.add_argument('--names', action='store_true',
+                            help='Add user and group name columns')
+
+    # Du command (add_help=False frees -h for human-readable sizes)
+    du_parser = subparsers.add_parser('du', help='Disk usage per directory (parallel du)',
+                                      add_help=False)
+    du_parser.add_argument('--help', action='help', help='Show this help message and exit')
+    du_parser.add_argument('path', nargs='*', default=['.'], help='Directories to summarize')
+    du_parser.add_argument('--max-depth', '-d', type=int, metavar='N',
+                          help='Print directories at most N levels below each path')
+    du_parser.add_argument('--summarize', '-s', action='store_true',
+                          help='Print only a total for each path (same as -d 0)')
+    du_parser.add_argument('--human-readable', '-h', action='store_true',
+                          help='Print sizes like 1K, 234M, 2.0G')
+    du_parser.add_argument('--apparent-size', action='store_true',
+                          help='Sum file sizes instead of allocated blocks')
+    du_parser.add_argument('--bytes', '-b', action='store_true',
+                          help='Same as --apparent-size in 1-byte units')
+    du_parser.add_argument('--count-links', '-l', action='store_true',
+                          help='Count hard-linked files once per link')
+    du_parser.add_argument('--one-file-system', '-x', action='store_true',
+                          help='Skip directories on other filesystems')
+    du_parser.add_argument('--total', '-c', action='store_true', help='Print a grand total')
+    du_parser.add_argument('--sort', choices=['size', 'path'], default='size',
+                          help='Order of the output (default: size, largest first)')
+    du_parser.add_argument('--reverse', '-r', action='store_true', help='Reverse the sort order')
+    du_parser.add_argument('--skip', action='append', dest='skip_names', metavar='NAME',
+                          help='Directory name to skip (repeatable; default: .snapshot)')
+    du_parser.add_argument('--prefetch', type=int, default=0, metavar='K',
+                          help='Read the next K queued directories ahead of the workers (NFS)')
+    du_parser.add_argument('--max-threads', type=int, help='Maximum threads')
+
+    # Extensions command
+    ext_parser = subparsers.add_parser('extensions', help='Count and size per file extension',
+                                       add_help=False)
+    ext_parser.add_argument('--help', action='help', help='Show this help message and exit')
+    ext_parser.add_argument('path', nargs='*', default=['.'], help='Directories to scan')
+    ext_parser.add_argument('--by-top-dir', '-t', action='store_true',
+                           help='Also group by top-level directory')
+    ext_parser.add_argument('--limit', '-n', type=int, help='Print only the first N rows')
+    ext_parser.add_argument('--human-readable', '-h', action='store_true',
+                           help='Print sizes like 1K, 234M, 2.0G')
+    ext_parser.add_argument('--csv', action='store_true', help='Print CSV instead of a table')
+    ext_parser.add_argument('--one-file-system', '-x', action='store_true',
+                           help='Skip directories on other filesystems')
+    ext_parser.add_argument('--skip', action='append', dest='skip_names', metavar='NAME',
+                           help='Directory name to skip (repeatable; default: .snapshot)')
+    ext_parser.add_argument('--max-threads', type=int, help='Maximum threads')
+
+    # Trend command
+    trend_parser = subparsers.add_parser('trend', help='Growth rates from a scan history file',
+                                         add_help=False)
+    trend_parser.add_argument('--help', action='help', help='Show this help message and exit')
+    trend_parser.add_argument('history', help='History file (report --history, or --record)')
+    trend_parser.add_argument('--by', choices=KINDS, default='user',
+                             help='Group by user, group or top-level directory (default: user)')
+    trend_parser.add_argument('--days', type=float,
+                             help='Only use scans from the last N days (default: all)')
+    trend_parser.add_argument('--record', nargs='+', metavar='PATH',
+                             help='First scan PATH (totals only, no scan file) and append it')
+    trend_parser.add_argument('--limit', '-n', type=int, help='Print only the first N rows')
+    trend_parser.add_argument('--numeric', action='store_true',
+                             help='Print uids and gids instead of names')
+    trend_parser.add_argument('--human-readable', '-h', action='store_true',
+                             help='Print sizes like 1K, 234M, 2.0G')
+    trend_parser.add_argument('--one-file-system', '-x', action='store_true',
+                             help='Skip directories on other filesystems (with --record)')
+    trend_parser.add_argument('--max-threads', type=int, help='Maximum threads')
+
+    # Cold command
+    cold_parser = subparsers.add_parser('cold', help='Largest subtrees not used in N days',
+                                        add_help=False)
+    cold_parser.add_argument('--help', action='help', help='Show this help message and exit')
+    cold_parser.add_argument('path', nargs='*', default=['.'], help='Directories to scan')
+    cold_parser.add_argument('--days', type=float, required=True,
+                            help='Cold if nothing was accessed or modified in this many days')
+    cold_parser.add_argument('--min-size', default='0',
+                            help='Only subtrees of at least this size, e.g. 100G (default: 0)')
+    cold_parser.add_argument('--mtime-only', action='store_true',
+                            help='Ignore access times (noatime mounts, backup reads)')
+    cold_parser.add_argument('--apparent-size', action='store_true',
+                            help='Sum file sizes instead of allocated blocks')
+    cold_parser.add_argument('--human-readable', '-h', action='store_true',
+                            help='Print sizes like 1K, 234M, 2.0G')
+    cold_parser.add_argument('--one-file-system', '-x', action='store_true',
+                            help='Skip directories on other filesystems')
+    cold_parser.add_argument('--skip', action='append', dest='skip_names', metavar='NAME',
+                            help='Directory name to skip (repeatable; default: .snapshot)')
+    cold_parser.add_argument('--max-threads', type=int, help='Maximum threads')
+
+    # Estimate command
+    estimate_parser = subparsers.add_parser('estimate',
+                                            help='Approximate file count and size by sampling')
+    estimate_parser.add_argument('path', help='Directory to estimate')
+    estimate_parser.add_argument('--full-depth', type=int, default=2, metavar='N',
+                                help='Levels read in full before sampling (default: 2)')
+    estimate_parser.add_argument('--probes', type=int, default=16,
+                                help='Random probes per directory below them (default: 16)')
+    estimate_parser.add_argument('--confidence', type=float, default=0.95,
+                                help='Confidence level of the intervals (default: 0.95)')
+    estimate_parser.add_argument('--seed', type=int, help='Random seed (repeatable estimates)')
+    estimate_parser.add_argument('--one-file-system', '-x', action='store_true',
+                                help='Skip directories on other filesystems')
+    estimate_parser.add_argument('--skip', action='append', dest='skip_names', metavar='NAME',
+                                help='Directory name to skip (repeatable; default: .snapshot)')
+    estimate_parser.add_argument('--max-threads', type=int, help='Maximum threads')
+
+    # Find command: GNU find expression syntax after the paths
+    find_parser = subparsers.add_parser(
+        'find', help='Find files in parallel (GNU find expressions)',
+        epilog='Expression: -name, -iname, -size, -mtime, -atime, -user, -group, -type, -perm, '
+               '-newer, -maxdepth, -xdev, -print0. All tests must match.')
+    find_parser.add_argument('--output', '-o', help='Write matches to a file instead of stdout')
+    find_parser.add_argument('--max-threads', type=int, help='Maximum threads')
+    find_parser.add_argument('--skip', action='append', dest='skip_names', metavar='NAME',
+                            help='Directory name to skip (repeatable; default: .snapshot)')
+    find_parser.add_argument('expression', nargs=argparse.REMAINDER,
+                            help='Paths followed by the expression, as for find')
+
+    # Query command
+    query_parser = subparsers.add_parser('query', help='Group-by aggregates over a scan file')
+    query_parser.add_argument('scan', help='Scan file written by report (.csv or .csv.zst)')
+    query_parser.add_argument('--group-by', '-g', action='append', default=[], metavar='COLUMN',
+                             help='Column to group by (repeatable)')
+    for func in ('sum', 'min', 'max', 'avg'):
+        query_parser.add_argument(f'--{func}', action=_Aggregate, dest='aggregates',
+                                 metavar='COLUMN', help=f'{func.capitalize()} of COLUMN per group')
+    query_parser.add_argument('--count', action=_Aggregate, dest='aggregates', nargs=0,
+                             help='Number of rows per group')
+    query_parser.add_argument('--limit', '-n', type=int, help='Print only the first N groups')
+    query_parser.add_argument('--csv', action='store_true', help='Print CSV instead of a table')
+    query_parser.add_argument('--max-threads', type=int, help='Maximum threads')
+
+    # Lookup command
+    lookup_parser = subparsers.add_parser('lookup', help='Look up paths and inodes in a scan',
+                                          description='Print the record of every inode, and every '
+                                          'path that is in the scan, using its index '
+                                          '(report --index). Exits 1 if no key was found.')
+    lookup_parser.add_argument('scan', help='Scan file written by report --index')
+    lookup_parser.add_argument('keys', nargs='*', metavar='KEY',
+                              help='Inode numbers (DEV:INODE on other filesystems than the '
+                              'top directory\'s) or paths (default: read them from stdin)')
+    lookup_parser.add_argument('--index', help='Index file (default: SCAN.pidx)')
+
+    # Serve command
+    serve_parser = subparsers.add_parser('serve', help='Answer usage queries from the latest scan')
+    serve_parser.add_argument('source', help='Scan file, or directory the scans are written to')
+    serve_parser.add_argument('--socket', default=DEFAULT_SOCKET,
+                             help=f'Unix socket to listen on (default: {DEFAULT_SOCKET})')
+    serve_parser.add_argument('--root', help='Path the scans were taken of, e.g. /projects')
+    serve_parser.add_argument('--interval', type=float, default=60,
+                             help='Seconds between checks for a newer scan (default: 60)')
+    serve_parser.add_argument('--max-threads', type=int, help='Maximum threads for indexing')
+
+    # Usage command (client of serve)
+    usage_parser = subparsers.add_parser('usage', help='Ask pwalk serve for usage under a path')
+    usage_parser.add_argument('path', nargs='?', default='.', help='Path (default: .)')
+    usage_parser.add_argument('--user', '-u', help='Only files of this user (name or UID)')
+    usage_parser.add_argument('--mine', action='store_true', help='Only your own files')
+    usage_parser.add_argument('--children', action='store_true', help='Usage per child instead')
+    usage_parser.add_argument('--socket', default=DEFAULT_SOCKET,
+                             help=f'Socket of pwalk serve (default: {DEFAULT_SOCKET})')
 
     # Repair command
     repair_parser = subparsers.add_parser('repair', help='Repair filesystem permissions')
@@ -68,14 +305,42 @@ def main():
                 print(f"{dirpath}: {len(dirnames)} dirs, {len(filenames)} files")
 
         elif args.command == 'report':
-            print(f"Generating {args.format.upper()} report for {args.path}...")
+            print(f"Generating CSV report for {', '.join(args.path)}...")
 
-            output_path, errors = report(
-                args.path,
-                format=args.format,
-                output=args.output,
-                max_threads=args.max_threads
+            top = args.path[0] if len(args.path) == 1 else args.path
+            output = args.output
+            if args.per_root_output and len(args.path) > 1:
+                output = [os.path.basename(os.path.normpath(p)) + '.csv' for p in args.path]
+
+            skip_names = args.skip_names
+            if args.skip_all_snapshots:
+                skip_names = list(SNAPSHOT_DIRS) + (skip_names or [])
+
+            result = report(
+                top,
+                output=output,
+                max_threads=args.max_threads,
+                compress=args.compress,
+                one_filesystem=args.one_filesystem,
+                skip_names=skip_names,
+                max_depth=args.max_depth,
+                count_below=args.count_below,
+                xattrs=args.xattrs,
+                ns_timestamps=args.ns_timestamps,
+                inode_order=args.inode_order,
+                size_hints=args.hints,
+                order=args.order,
+                frontier_limit=args.frontier_limit * 1024 * 1024,
+                names=args.names,
+                prefetch=args.prefetch,
+                checksum=args.checksum,
+                checksum_threads=args.checksum_threads,
+                checksum_bandwidth=parse_size(args.checksum_bandwidth or 0),
+                checksum_direct=args.direct_io,
+                history=args.history,
+                index=args.index
             )
+            output_path, errors = result
 
             print(f"\nReport saved to: {output_path}")
             print(f"Files processed: (see report)")
@@ -88,6 +353,253 @@ def main():
                 if len(errors) > 10:
                     print(f"  ... and {len(errors) - 10} more")
 
+            if args.max_depth is not None:
+                print("\nEntries per depth:")
+                for level, count in enumerate(result.depth_counts):
+                    print(f"  {level:3d}: {count}")
+
+            if result.mountpoints:
+                print(f"\nSkipped mountpoints ({len(result.mountpoints)}):")
+                for mountpoint in result.mountpoints:
+                    print(f"  {mountpoint}")
+
+        elif args.command == 'stat':
+            paths = list(args.path)
+            if args.from_file:
+                sep = '\0' if args.null else '\n'
+                if args.from_file == '-':
+                    data = sys.stdin.buffer.read()
+                else:
+                    with open(args.from_file, 'rb') as f:
+                        data = f.read()
+                paths += os.fsdecode(data).split(sep)
+
+            to_stdout = args.output == '-'
+            result = stat_many(
+                paths,
+                output='/dev/stdout' if to_stdout else args.output,
+                max_threads=args.max_threads,
+                compress=args.compress,
+                xattrs=args.xattrs,
+                ns_timestamps=args.ns_timestamps,
+                names=args.names
+            )
+
+            # Keep stdout clean for the CSV when writing it there
+            out = sys.stderr if to_stdout else sys.stdout
+            if not to_stdout:
+                print(f"Report saved to: {result.output}", file=out)
+            print(f"Paths stat'ed: {result.stats['count']}", file=out)
+            print(f"Errors: {len(result.errors)}", file=out)
+            for error in result.errors[:10]:
+                print(f"  {error}", file=out)
+            if len(result.errors) > 10:
+                print(f"  ... and {len(result.errors) - 10} more", file=out)
+
+        elif args.command == 'du':
+            paths = [os.path.normpath(p) for p in args.path]
+            totals, errors = du(
+                paths,
+                max_depth=0 if args.summarize else args.max_depth,
+                apparent_size=args.apparent_size or args.bytes,
+                count_links=args.count_links,
+                one_filesystem=args.one_file_system,
+                skip_names=args.skip_names,
+                max_threads=args.max_threads,
+                prefetch=args.prefetch
+            )
+
+            for error in errors:
+                print(f"pwalk du: cannot read directory {error}", file=sys.stderr)
+
+            if args.sort == 'path':
+                totals.sort(key=lambda t: t[0])
+            if args.reverse:
+                totals.reverse()
+
+            block_size = 1 if args.bytes else 1024
+            for path, size in totals:
+                print(f"{format_size(size, args.human_readable, block_size)}\t{path}")
+            if args.total:
+                grand = sum(size for path, size in totals if path in paths)
+                print(f"{format_size(grand, args.human_readable, block_size)}\ttotal")
+            if errors:
+                return 1
+
+        elif args.command == 'extensions':
+            paths = [os.path.normpath(p) for p in args.path]
+            rows, errors = extensions(paths[0] if len(paths) == 1 else paths,
+                                      by_top_dir=args.by_top_dir,
+                                      one_filesystem=args.one_file_system,
+                                      skip_names=args.skip_names, max_threads=args.max_threads)
+            for error in errors:
+                print(f"pwalk extensions: cannot read directory {error}", file=sys.stderr)
+            columns = ['type', 'extension', 'count', 'bytes', 'disk_bytes']
+            if args.by_top_dir:
+                columns.insert(0, 'directory')
+            rows = rows[:args.limit] if args.limit is not None else rows
+            if args.csv:
+                import csv
+                writer = csv.writer(sys.stdout)
+                writer.writerow(columns)
+                writer.writerows(rows)
+            else:
+                table = [columns] + [[str(v) if i < len(columns) - 2 or not args.human_readable
+                                      else format_size(v, True) for i, v in enumerate(row)]
+                                     for row in rows]
+                widths = [max(len(r[i]) for r in table) for i in range(len(columns))]
+                for r in table:
+                    print('  '.join(v.ljust(w) if i < len(columns) - 3 else v.rjust(w)
+                                    for i, (v, w) in enumerate(zip(r, widths))))
+
+        elif args.command == 'trend':
+            if args.record:
+                paths = [os.path.normpath(p) for p in args.record]
+                _, errors = record_history(paths, args.history,
+                                           one_filesystem=args.one_file_system,
+                                           max_threads=args.max_threads)
+                for error in errors:
+                    print(f"pwalk trend: cannot read directory {error}", file=sys.stderr)
+            rows = trend(args.history, by=args.by, days=args.days)
+            rows = rows[:args.limit] if args.limit is not None else rows
+
+            def name(key):
+                if args.by == 'top' or args.numeric:
+                    return str(key)
+                import grp
+                import pwd
+                try:
+                    if args.by == 'user':
+                        return pwd.getpwuid(key).pw_name
+                    return grp.getgrgid(key).gr_name
+                except KeyError:
+                    return str(key)
+
+            def size(v, sign=False):
+                text = format_size(abs(round(v)), True) if args.human_readable else str(abs(round(v)))
+                return ('-' if v < 0 else '+' if sign else '') + text
+
+            table = [[args.by, 'files', 'bytes', 'change', 'per_day', 'files_per_day']]
+            table += [[name(key), str(count), size(nbytes), size(change, True),
+                       size(rate, True), f"{files_rate:+.1f}"]
+                      for key, count, nbytes, disk, change, rate, files_rate in rows]
+            widths = [max(len(r[i]) for r in table) for i in range(len(table[0]))]
+            for r in table:
+                print('  '.join(v.ljust(w) if i == 0 else v.rjust(w)
+                                for i, (v, w) in enumerate(zip(r, widths))))
+
+        elif args.command == 'cold':
+            import time
+            paths = [os.path.normpath(p) for p in args.path]
+            rows, errors = cold(paths[0] if len(paths) == 1 else paths, days=args.days,
+                                min_size=args.min_size, mtime_only=args.mtime_only,
+                                apparent_size=args.apparent_size,
+                                one_filesystem=args.one_file_system,
+                                skip_names=args.skip_names, max_threads=args.max_threads)
+            for error in errors:
+                print(f"pwalk cold: cannot read directory {error}", file=sys.stderr)
+            for path, size, last_used in rows:
+                day = time.strftime('%Y-%m-%d', time.localtime(last_used))
+                print(f"{format_size(size, args.human_readable, 1 if args.apparent_size else 1024)}"
+                      f"\t{day}\t{path}")
+            if errors:
+                return 1
+
+        elif args.command == 'estimate':
+            est = estimate(args.path, full_depth=args.full_depth, probes=args.probes,
+                           confidence=args.confidence, seed=args.seed,
+                           one_filesystem=args.one_file_system, skip_names=args.skip_names,
+                           max_threads=args.max_threads)
+            level = f"{args.confidence:.0%}"
+            print(f"{'':12}{'estimate':>12}{level + ' low':>12}{level + ' high':>12}{'rse':>8}")
+            for stat in STATS:
+                e = est[stat]
+                if stat.endswith('bytes'):
+                    cells = [format_size(round(e[k]), True) for k in ('estimate', 'low', 'high')]
+                else:
+                    cells = [f"{e[k]:.0f}" for k in ('estimate', 'low', 'high')]
+                print(f"{stat:12}" + ''.join(f"{c:>12}" for c in cells) + f"{e['rse']:>8.1%}")
+            print(f"\n{est['strata']} sampled directories, {est['reads']} directory reads")
+            for error in est['errors']:
+                print(f"pwalk estimate: cannot read directory {error}", file=sys.stderr)
+
+        elif args.command == 'find':
+            paths, options = parse_expression(args.expression)
+            result = find(
+                paths[0] if len(paths) == 1 else paths,
+                output=args.output or '/dev/stdout',
+                skip_names=args.skip_names,
+                max_threads=args.max_threads,
+                **options
+            )
+            for error in result.errors:
+                print(f"pwalk find: {error}", file=sys.stderr)
+            if result.errors:
+                return 1
+
+        elif args.command == 'query':
+            aggregates = [(func, None if func == 'count' else column)
+                          for func, column in (args.aggregates or [('count', [])])]
+            columns, rows = query(args.scan, group_by=args.group_by, aggregates=aggregates,
+                                  max_threads=args.max_threads, limit=args.limit)
+
+            def cell(value):
+                if value is None:
+                    return ''
+                return f"{value:.1f}" if isinstance(value, float) else str(value)
+
+            if args.csv:
+                import csv
+                writer = csv.writer(sys.stdout)
+                writer.writerow(columns)
+                writer.writerows([cell(v) for v in row] for row in rows)
+            else:
+                table = [columns] + [[cell(v) for v in row] for row in rows]
+                widths = [max(len(r[i]) for r in table) for i in range(len(columns))]
+                for r in table:
+                    print('  '.join(v.rjust(w) for v, w in zip(r, widths)))
+
+        elif args.command == 'lookup':
+            idx = open_index(args.scan, args.index)
+            keys = args.keys or (line.rstrip('\n') for line in sys.stdin)
+            found = 0
+            for key in keys:
+                dev, _, ino = key.rpartition(':')
+                if ino.isdigit() and (dev.isdigit() or not dev):
+                    record = idx.record(int(ino), int(dev) if dev else None)
+                    if record is not None:
+                        print(record)
+                        found += 1
+                elif key and idx.exists(key):
+                    print(key)
+                    found += 1
+            return 0 if found else 1
+
+        elif args.command == 'serve':
+            from .serve import serve
+            print(f"Serving {args.source} on {args.socket}", file=sys.stderr)
+            serve(args.source, args.socket, root=args.root, interval=args.interval,
+                  max_threads=args.max_threads)
+
+        elif args.command == 'usage':
+            from .serve import ask
+            import pwd
+            request = {'op': 'children' if args.children else 'usage',
+                       'path': os.path.abspath(args.path)}
+            if args.mine:
+                request['uid'] = os.getuid()
+            elif args.user:
+                request['uid'] = int(args.user) if args.user.isdigit() else pwd.getpwnam(args.user).pw_uid
+            reply = ask(request, args.socket)
+            if 'error' in reply:
+                print(f"pwalk usage: {reply['error']}", file=sys.stderr)
+                return 1
+            if args.children:
+                for name, files, size in reply['children']:
+                    print(f"{format_size(size, True, 1)}\t{files}\t{name}")
+            else:
+                print(f"{format_size(reply['size'], True, 1)}\t{reply['files']} files\t{reply['path']}")
+
         elif args.command == 'repair':
             if not args.dry_run and os.geteuid() != 0:
                 print("ERROR: repair command must be run as root (use sudo)")
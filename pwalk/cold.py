@@ -0,0 +1,94 @@
+"""
+cold.py - Cold-data report for archiving and tiering
+
+The C engine rolls each directory's total size and the latest access or
+modification time in its subtree up bottom-up during the walk (du mode).
+A subtree is cold when nothing in it was used since the cutoff; only the
+maximal cold subtrees (those not inside another cold one) are reported,
+so the result is a ready-to-archive list.
+"""
+
+import os
+import re
+import time
+from typing import List, Optional, Sequence, Tuple, Union
+
+from .report import HAS_CORE, _require_core, _skip_names
+
+if HAS_CORE:
+    import _pwalk_core
+
+_UNITS = {'': 1, 'K': 1 << 10, 'M': 1 << 20, 'G': 1 << 30, 'T': 1 << 40, 'P': 1 << 50}
+
+
+def parse_size(size: Union[int, str]) -> int:
+    """Bytes from an int or a string such as '500M' or '2T' (binary units)."""
+    if isinstance(size, int):
+        return size
+    match = re.fullmatch(r'\s*(\d+(?:\.\d+)?)\s*([KMGTP]?)i?B?\s*', size, re.IGNORECASE)
+    if not match:
+        raise ValueError(f"Invalid size: {size!r}")
+    return int(float(match.group(1)) * _UNITS[match.group(2).upper()])
+
+
+def cold(
+    top: Union[str, Sequence[str]],
+    days: float,
+    min_size: Union[int, str] = 0,
+    mtime_only: bool = False,
+    apparent_size: bool = False,
+    one_filesystem: bool = False,
+    skip_names: Optional[Sequence[str]] = None,
+    max_threads: Optional[int] = None
+) -> Tuple[List[Tuple[str, int, int]], List[str]]:
+    """
+    Find the largest directory subtrees nothing in which was used recently.
+
+    Args:
+        top: Starting path, or a sequence of paths sharing one worker pool
+        days: A subtree is cold if no file in it was accessed or modified,
+            and no directory in it modified, in this many days
+        min_size: Only report cold subtrees of at least this size (bytes,
+            or a string like '10G')
+        mtime_only: Ignore access times (for noatime mounts, or when backup
+            or antivirus reads make atime meaningless)
+        apparent_size: Sum st_size instead of allocated blocks
+        one_filesystem: Do not cross into other filesystems
+        skip_names: Directory names never descended into (default:
+            ('.snapshot',), as for report())
+        max_threads: Number of threads (default: CPU count)
+
+    Returns:
+        (rows, error_list): rows are (path, bytes, last_used) for the
+        maximal cold subtrees, largest first; last_used is the latest time
+        (epoch seconds) anything in the subtree was used. Directory access
+        times are never used, since scans update them. Hard-linked files
+        count once, as in du().
+
+    Example:
+        >>> rows, errors = cold('/projects', days=365, min_size='100G')
+        >>> for path, size, last_used in rows:
+        ...     print(format_size(size, human=True), time.ctime(last_used), path)
+    """
+    if max_threads is None:
+        max_threads = int(os.environ.get('SLURM_CPUS_ON_NODE', os.cpu_count() or 4))
+    if days < 0:
+        raise ValueError(f"Invalid days: {days}. Must be >= 0")
+
+    if not isinstance(top, str):
+        top = list(top)
+
+    _require_core()
+
+    result = _pwalk_core.cold_totals(
+        top,
+        int(time.time() - days * 86400),
+        parse_size(min_size),
+        max_threads,
+        use_atime=not mtime_only,
+        apparent_size=apparent_size,
+        one_filesystem=one_filesystem,
+        skip_names=_skip_names(skip_names)
+    )
+    rows = sorted(result['rows'], key=lambda r: (-r[1], r[0]))
+    return rows, result['errors']
@@ -0,0 +1,98 @@
+"""
+du.py - Parallel disk usage totals
+
+Recursive per-directory usage computed by the C engine, which rolls each
+subtree up into its parent as soon as the subtree is finished.
+"""
+
+import math
+import os
+from typing import List, Optional, Sequence, Tuple, Union
+
+from .report import HAS_CORE, _require_core, _skip_names
+
+if HAS_CORE:
+    import _pwalk_core
+
+
+def du(
+    top: Union[str, Sequence[str]],
+    max_depth: Optional[int] = None,
+    apparent_size: bool = False,
+    count_links: bool = False,
+    one_filesystem: bool = False,
+    skip_names: Optional[Sequence[str]] = None,
+    max_threads: Optional[int] = None,
+    prefetch: int = 0
+) -> Tuple[List[Tuple[str, int]], List[str]]:
+    """
+    Disk usage of every directory below top, like GNU du.
+
+    Args:
+        top: Starting path, or a sequence of paths sharing one worker pool
+        max_depth: Only return directories up to this many levels below
+            top (0: top only); deeper directories still count in the totals
+        apparent_size: Sum st_size instead of allocated blocks
+        count_links: Count a hard-linked file once per link instead of once
+        one_filesystem: Do not cross into other filesystems
+        skip_names: Directory names never descended into (default:
+            ('.snapshot',), as for report())
+        max_threads: Number of threads (default: CPU count)
+        prefetch: Directory readahead depth, as for report()
+
+    Returns:
+        (totals, error_list): totals is a list of (path, bytes), largest
+        first; error_list holds "path: reason" for unreadable directories
+
+    Example:
+        >>> totals, errors = du('/home', max_depth=1)
+        >>> for path, size in totals[:10]:
+        ...     print(format_size(size), path)
+    """
+    if max_threads is None:
+        max_threads = int(os.environ.get('SLURM_CPUS_ON_NODE', os.cpu_count() or 4))
+
+    if max_depth is not None and max_depth < 0:
+        raise ValueError(f"Invalid max_depth: {max_depth}. Must be >= 0")
+
+    if not isinstance(top, str):
+        top = list(top)
+
+    _require_core()
+
+    try:
+        result = _pwalk_core.du_totals(
+            top,
+            max_threads,
+            -1 if max_depth is None else max_depth,
+            apparent_size=apparent_size,
+            count_links=count_links,
+            one_filesystem=one_filesystem,
+            skip_names=_skip_names(skip_names),
+            prefetch=prefetch
+        )
+    except OSError:
+        raise
+    except Exception as e:
+        raise RuntimeError(f"Failed to compute disk usage: {e}")
+
+    totals = sorted(result['totals'], key=lambda t: (-t[1], t[0]))
+    return totals, result['errors']
+
+
+def format_size(size: int, human: bool = False, block_size: int = 1024) -> str:
+    """
+    Format a byte count the way GNU du prints it: in block_size units
+    rounded up, or with -h a K/M/G/T/P/E suffix (one decimal below 10).
+    """
+    if not human:
+        return str(math.ceil(size / block_size))
+    if size < 1024:
+        return str(size)
+    for unit in 'KMGTPE':
+        size /= 1024
+        if size < 10 and math.ceil(size * 10) < 100:
+            return f"{math.ceil(size * 10) / 10:.1f}{unit}"
+        if math.ceil(size) < 1024 or unit == 'E':
+            return f"{math.ceil(size)}{unit}"
+    return str(size)
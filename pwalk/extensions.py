@@ -0,0 +1,69 @@
+"""
+extensions.py - File counts and bytes per extension, computed in the engine
+
+The C engine already splits off each file's extension for the CSV; here it
+is counted instead, in per-thread hash tables merged at the end, so "which
+projects keep uncompressed FASTQ/BAM/TIFF" needs no scan file at all.
+"""
+
+import os
+from typing import List, Optional, Sequence, Tuple, Union
+
+from .report import HAS_CORE, _require_core, _ext_rows, _skip_names
+
+if HAS_CORE:
+    import _pwalk_core
+
+# File type letters in the rows, as for find -type
+FILE_TYPES = {'f': 'file', 'd': 'directory', 'l': 'symlink', 'p': 'fifo', 's': 'socket',
+              'c': 'char device', 'b': 'block device'}
+
+
+def extensions(
+    top: Union[str, Sequence[str]],
+    by_top_dir: bool = False,
+    one_filesystem: bool = False,
+    skip_names: Optional[Sequence[str]] = None,
+    max_threads: Optional[int] = None
+) -> Tuple[List[tuple], List[str]]:
+    """
+    Count and total size per file type and extension below top.
+
+    Regular files are grouped by extension (the text after the last dot,
+    lowercased; '' for none); other entries by type alone. Hard links are
+    counted once per link, as in report().
+
+    Args:
+        top: Starting path, or a sequence of paths sharing one worker pool
+        by_top_dir: Also group by top-level directory (the directory right
+            below top; files directly in top count under top itself)
+        one_filesystem: Do not cross into other filesystems
+        skip_names: Directory names never descended into (default:
+            ('.snapshot',), as for report())
+        max_threads: Number of threads (default: CPU count)
+
+    Returns:
+        (rows, error_list): rows are (type, extension, count, bytes,
+        disk_bytes), with the top-level directory first when by_top_dir,
+        largest bytes first. type is a FILE_TYPES letter.
+
+    Example:
+        >>> rows, errors = extensions('/projects', by_top_dir=True)
+        >>> [r for r in rows if r[2] in ('fastq', 'bam', 'tif')][:10]
+    """
+    if max_threads is None:
+        max_threads = int(os.environ.get('SLURM_CPUS_ON_NODE', os.cpu_count() or 4))
+
+    if not isinstance(top, str):
+        top = list(top)
+
+    _require_core()
+
+    result = _pwalk_core.ext_totals(
+        top,
+        max_threads,
+        by_top_dir=by_top_dir,
+        one_filesystem=one_filesystem,
+        skip_names=_skip_names(skip_names)
+    )
+    return _ext_rows(result['rows'], by_top_dir), result['errors']
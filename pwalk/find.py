@@ -0,0 +1,208 @@
+"""
+find.py - Parallel find
+
+GNU find style predicates compiled once and evaluated by the C workers;
+matching paths go through the same buffered output as report().
+"""
+
+import grp
+import os
+import pwd
+import stat
+import tempfile
+from typing import List, Optional, Sequence, Tuple, Union
+
+from .report import HAS_CORE, ReportResult, _require_core, _skip_names
+
+if HAS_CORE:
+    import _pwalk_core
+
+# Predicate kinds understood by the C engine (PRED_* in pwalk_core.c)
+PREDICATES = {'name': 0, 'iname': 1, 'size': 2, 'mtime': 3, 'atime': 4,
+              'user': 5, 'group': 6, 'type': 7, 'perm': 8, 'newer': 9}
+
+FILE_TYPES = {'f': stat.S_IFREG, 'd': stat.S_IFDIR, 'l': stat.S_IFLNK, 'b': stat.S_IFBLK,
+              'c': stat.S_IFCHR, 'p': stat.S_IFIFO, 's': stat.S_IFSOCK}
+
+SIZE_UNITS = {'c': 1, 'w': 2, 'b': 512, 'k': 1024, 'M': 1024 ** 2, 'G': 1024 ** 3}
+
+
+def _numeric(arg: Union[str, int]) -> Tuple[int, int]:
+    """Split a find numeric argument ('+n', '-n', 'n') into (cmp, n)."""
+    arg = str(arg)
+    cmp = {'+': 1, '-': -1}.get(arg[:1], 0)
+    return cmp, int(arg[1:] if cmp else arg)
+
+
+def _id(value: Union[str, int], lookup, what: str) -> int:
+    if isinstance(value, int) or str(value).isdigit():
+        return int(value)
+    try:
+        return lookup(value)
+    except KeyError:
+        raise ValueError(f"Unknown {what}: {value}")
+
+
+def compile_predicates(name=None, iname=None, size=None, mtime=None, atime=None,
+                       user=None, group=None, type=None, perm=None, newer=None) -> List[tuple]:
+    """
+    Translate find-style arguments into the C engine's predicate tuples
+    (kind, cmp, value, unit, pattern).
+    """
+    preds = []
+    if name is not None:
+        preds.append((PREDICATES['name'], 0, 0, 1, name))
+    if iname is not None:
+        preds.append((PREDICATES['iname'], 0, 0, 1, iname))
+    if size is not None:
+        size = str(size)
+        unit = SIZE_UNITS.get(size[-1])
+        if unit:
+            size = size[:-1]
+        cmp, n = _numeric(size)
+        preds.append((PREDICATES['size'], cmp, n, unit or 512, None))
+    if mtime is not None:
+        cmp, n = _numeric(mtime)
+        preds.append((PREDICATES['mtime'], cmp, n, 86400, None))
+    if atime is not None:
+        cmp, n = _numeric(atime)
+        preds.append((PREDICATES['atime'], cmp, n, 86400, None))
+    if user is not None:
+        uid = _id(user, lambda u: pwd.getpwnam(u).pw_uid, 'user')
+        preds.append((PREDICATES['user'], 0, uid, 1, None))
+    if group is not None:
+        gid = _id(group, lambda g: grp.getgrnam(g).gr_gid, 'group')
+        preds.append((PREDICATES['group'], 0, gid, 1, None))
+    if type is not None:
+        if type not in FILE_TYPES:
+            raise ValueError(f"Invalid type: {type}. Use one of {''.join(FILE_TYPES)}")
+        preds.append((PREDICATES['type'], 0, FILE_TYPES[type], 1, None))
+    if perm is not None:
+        perm = str(perm)
+        cmp = {'-': 1, '/': -1}.get(perm[:1], 0)
+        try:
+            mode = int(perm[1:] if cmp else perm, 8)
+        except ValueError:
+            raise ValueError(f"Invalid perm: {perm}. Use an octal mode like 644, -020 or /022")
+        preds.append((PREDICATES['perm'], cmp, mode, 1, None))
+    if newer is not None:
+        preds.append((PREDICATES['newer'], 1, os.stat(newer).st_mtime_ns, 1, None))
+    return preds
+
+
+def parse_expression(args: Sequence[str]) -> Tuple[List[str], dict]:
+    """
+    Split a GNU find command line (paths, then -name X -size +1M ...)
+    into the paths and find() keyword arguments.
+    """
+    args = list(args)
+    paths = []
+    while args and not args[0].startswith('-'):
+        paths.append(args.pop(0))
+
+    options = {}
+    while args:
+        token = args.pop(0)
+        key = token.lstrip('-')
+        if token in ('-print', '-a', '-and'):
+            continue
+        if token == '-print0':
+            options['print0'] = True
+        elif token in ('-xdev', '-mount'):
+            options['one_filesystem'] = True
+        elif token == '-maxdepth' or key in PREDICATES:
+            if not args:
+                raise ValueError(f"missing argument to `{token}'")
+            value = args.pop(0)
+            if token == '-maxdepth':
+                options['max_depth'] = int(value)
+            else:
+                options[key] = value
+        else:
+            raise ValueError(f"unsupported expression `{token}'")
+    return paths or ['.'], options
+
+
+def find(
+    top: Union[str, Sequence[str]],
+    output: Optional[str] = None,
+    max_depth: Optional[int] = None,
+    one_filesystem: bool = False,
+    skip_names: Optional[Sequence[str]] = None,
+    print0: bool = False,
+    max_threads: Optional[int] = None,
+    **predicates
+) -> ReportResult:
+    """
+    Find paths matching all the given predicates, like GNU find.
+
+    Predicates take find's argument syntax: name/iname (glob), size
+    ('+10M', '-1k', '20' in 512-byte blocks), mtime/atime ('+30', '-7' days),
+    user/group (name or id), type ('f', 'd', 'l', ...), perm (octal:
+    '644' exact, '-020' all bits set, '/022' any bit set) and newer
+    (reference file). All given predicates must match.
+
+    Args:
+        top: Starting path, or a sequence of paths sharing one worker pool
+        output: File to write the matches to, one per line; by default the
+            matches are returned as a list
+        max_depth: Descend at most this many levels below top
+        one_filesystem: Do not cross into other filesystems
+        skip_names: Directory names never descended into (default:
+            ('.snapshot',), as for report())
+        print0: Separate paths with NUL instead of newline
+        max_threads: Number of threads (default: CPU count)
+
+    Returns:
+        (output_path or list of paths, error_list) tuple (a ReportResult);
+        the number of matches is in ``result.stats['count']``
+
+    Example:
+        >>> paths, errors = find('/scratch', name='*.core', mtime='+30')
+    """
+    unknown = set(predicates) - set(PREDICATES)
+    if unknown:
+        raise TypeError(f"Unknown predicate: {', '.join(sorted(unknown))}")
+
+    if max_threads is None:
+        max_threads = int(os.environ.get('SLURM_CPUS_ON_NODE', os.cpu_count() or 4))
+
+    if max_depth is not None and max_depth < 0:
+        raise ValueError(f"Invalid max_depth: {max_depth}. Must be >= 0")
+
+    preds = compile_predicates(**predicates)
+
+    if not isinstance(top, str):
+        top = list(top)
+
+    _require_core()
+
+    target = output
+    if output is None:
+        fd, target = tempfile.mkstemp(prefix='pwalk-find-')
+        os.close(fd)
+
+    try:
+        result = _pwalk_core.find_paths(
+            top,
+            target,
+            preds,
+            max_threads,
+            -1 if max_depth is None else max_depth,
+            one_filesystem=one_filesystem,
+            skip_names=_skip_names(skip_names),
+            print0=print0
+        )
+        if output is None:
+            with open(target, 'rb') as f:
+                data = f.read()
+            matches = [os.fsdecode(p) for p in data.split(b'\0' if print0 else b'\n') if p]
+            return ReportResult(matches, result['errors'], result)
+        return ReportResult(result['output'], result['errors'], result)
+    except OSError:
+        raise
+    except Exception as e:
+        raise RuntimeError(f"Failed to find paths: {e}")
+    finally:
+        if output is None:
+            os.unlink(target)
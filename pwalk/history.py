@@ -0,0 +1,276 @@
+"""
+history.py - Append-only store of scan summaries for growth trending
+
+Each scan can leave its engine-computed totals per user, group and
+top-level directory in a small history file, so growth over months is read
+back instantly instead of keeping and re-reading full weekly scans.
+
+File format: a sequence of self-contained segments, one per scan, so an
+append never rewrites earlier data and a torn final write is cut off by
+the next append:
+
+    b'PWH2' | u32 body length | body
+
+    body: f64 scan time | u32 length + JSON list of scanned paths
+          | u32 new keys, each u8 kind + u16 length + UTF-8 key
+          | u32 rows | u32 key id x rows | i64 count x rows
+          | i64 bytes x rows | i64 disk bytes x rows
+
+Key ids index a dictionary that grows across segments (a segment stores
+only the keys first seen in it), so the columns of a stable tree cost
+28 bytes per user, group and directory per scan. Segments of older
+versions (b'PWHS') are read as well; they have a u16 length of the paths.
+"""
+
+import fcntl
+import json
+import os
+import struct
+import time
+from array import array
+from typing import Dict, List, NamedTuple, Optional, Sequence, Tuple, Union
+
+from .report import HAS_CORE, _require_core, _skip_names
+
+if HAS_CORE:
+    import _pwalk_core
+
+MAGIC = b'PWH2'
+KINDS = ('user', 'group', 'top')
+_HEAD = struct.Struct('<4sI')
+# Scan time and length of the paths, by segment magic
+_TOPS = {b'PWHS': struct.Struct('<dH'), MAGIC: struct.Struct('<dI')}
+
+
+class Snapshot(NamedTuple):
+    """One scan: {(kind, key): (count, bytes, disk bytes)}; key is the uid or
+    gid for 'user' and 'group', the directory path for 'top'."""
+    time: float
+    tops: List[str]
+    totals: Dict[Tuple[str, Union[int, str]], Tuple[int, int, int]]
+
+
+def _column(body: bytes, pos: int, code: str, n: int) -> Tuple[array, int]:
+    col = array(code)
+    col.frombytes(body[pos:pos + n * col.itemsize])
+    if len(col) != n:
+        raise ValueError("short column")
+    if struct.pack('=H', 1) != struct.pack('<H', 1):
+        col.byteswap()
+    return col, pos + n * col.itemsize
+
+
+def _segments(data: bytes):
+    """Yield (end offset, magic, body) of every complete segment."""
+    pos = 0
+    while pos + _HEAD.size <= len(data):
+        magic, size = _HEAD.unpack_from(data, pos)
+        if magic not in _TOPS or pos + _HEAD.size + size > len(data):
+            return
+        pos += _HEAD.size + size
+        yield pos, magic, data[pos - size:pos]
+
+
+def _read_keys(body, pos: int) -> Tuple[List[Tuple[str, str]], int]:
+    """The new keys of a segment whose key section starts at pos."""
+    new_keys = []
+    (nkeys,) = struct.unpack_from('<I', body, pos)
+    pos += 4
+    for _ in range(nkeys):
+        kind, klen = struct.unpack_from('<BH', body, pos)
+        pos += 3
+        if pos + klen > len(body):
+            raise ValueError("short key")
+        new_keys.append((KINDS[kind], body[pos:pos + klen].decode('utf-8', 'surrogateescape')))
+        pos += klen
+    return new_keys, pos
+
+
+def _dictionary(f) -> Tuple[List[Tuple[str, str]], int]:
+    """
+    Key dictionary and end of the valid data of an open history file,
+    reading only the segment headers and key sections, not the rows.
+    """
+    keys, end = [], 0
+    size = os.fstat(f.fileno()).st_size
+    while end + _HEAD.size <= size:
+        f.seek(end)
+        magic, length = _HEAD.unpack(f.read(_HEAD.size))
+        seg_end = end + _HEAD.size + length
+        if magic not in _TOPS or seg_end > size:
+            break
+        try:
+            _, tlen = _TOPS[magic].unpack(f.read(_TOPS[magic].size))
+            f.seek(tlen, os.SEEK_CUR)
+            (nkeys,) = struct.unpack('<I', f.read(4))
+            new_keys = []
+            for _ in range(nkeys):
+                kind, klen = struct.unpack('<BH', f.read(3))
+                new_keys.append((KINDS[kind], f.read(klen).decode('utf-8', 'surrogateescape')))
+        except (struct.error, IndexError):
+            break
+        if f.tell() > seg_end:
+            break
+        keys.extend(new_keys)
+        end = seg_end
+    return keys, end
+
+
+def _parse(data: bytes) -> Tuple[List[Snapshot], List[Tuple[str, str]], int]:
+    """Snapshots, key dictionary and end of the valid data."""
+    snapshots, keys, end = [], [], 0
+    for seg_end, magic, body in _segments(data):
+        try:
+            when, tlen = _TOPS[magic].unpack_from(body, 0)
+            pos = _TOPS[magic].size
+            tops = json.loads(body[pos:pos + tlen].decode('utf-8', 'surrogateescape'))
+            new_keys, pos = _read_keys(body, pos + tlen)
+            (nrows,) = struct.unpack_from('<I', body, pos)
+            ids, pos = _column(body, pos + 4, 'I', nrows)
+            counts, pos = _column(body, pos, 'q', nrows)
+            sizes, pos = _column(body, pos, 'q', nrows)
+            disks, pos = _column(body, pos, 'q', nrows)
+        except (struct.error, ValueError, IndexError):
+            break
+        keys.extend(new_keys)
+        if any(i >= len(keys) for i in ids):
+            del keys[len(keys) - len(new_keys):]
+            break
+        totals = {}
+        for i, c, b, d in zip(ids, counts, sizes, disks):
+            kind, key = keys[i]
+            totals[kind, key if kind == 'top' else int(key)] = (c, b, d)
+        snapshots.append(Snapshot(when, tops, totals))
+        end = seg_end
+    return snapshots, keys, end
+
+
+def read_history(path: str) -> List[Snapshot]:
+    """All snapshots in a history file, oldest first."""
+    with open(path, 'rb') as f:
+        return sorted(_parse(f.read())[0], key=lambda s: s.time)
+
+
+def append_history(path: str, summary: Sequence[tuple], tops: Sequence[str],
+                   when: Optional[float] = None) -> None:
+    """
+    Append one scan's summary rows (kind, key, count, bytes, disk), as
+    returned in ``report(summary=True).summary``, to a history file.
+    """
+    with open(path, 'a+b') as f:
+        fcntl.flock(f, fcntl.LOCK_EX)
+        keys, end = _dictionary(f)
+        ids = {k: i for i, k in enumerate(keys)}
+
+        new_keys, rows = [], []
+        for kind, key, count, size, disk in summary:
+            k = (kind, str(key))
+            if k not in ids:
+                ids[k] = len(ids)
+                new_keys.append(k)
+            rows.append((ids[k], count, size, disk))
+
+        tops_json = json.dumps(list(tops)).encode('utf-8', 'surrogateescape')
+        body = [_TOPS[MAGIC].pack(time.time() if when is None else when, len(tops_json)),
+                tops_json, struct.pack('<I', len(new_keys))]
+        for kind, key in new_keys:
+            raw = key.encode('utf-8', 'surrogateescape')
+            body.append(struct.pack('<BH', KINDS.index(kind), len(raw)) + raw)
+        body.append(struct.pack('<I', len(rows)))
+        for n, code in enumerate('Iqqq'):
+            col = array(code, (r[n] for r in rows))
+            if struct.pack('=H', 1) != struct.pack('<H', 1):
+                col.byteswap()
+            body.append(col.tobytes())
+        body = b''.join(body)
+
+        # Drop a torn segment left by an interrupted append; writes then go
+        # to the end of the file (append mode)
+        f.truncate(end)
+        f.write(_HEAD.pack(MAGIC, len(body)) + body)
+        f.flush()
+        os.fsync(f.fileno())
+
+
+def record_history(
+    top: Union[str, Sequence[str]],
+    history: str,
+    one_filesystem: bool = False,
+    skip_names: Optional[Sequence[str]] = None,
+    max_threads: Optional[int] = None
+) -> Tuple[List[tuple], List[str]]:
+    """
+    Scan top for its summary only (no scan file) and append it to history.
+
+    Returns:
+        (summary rows, error_list)
+
+    Example:
+        >>> record_history('/projects', '/var/lib/pwalk/projects.hist')  # weekly cron
+    """
+    if max_threads is None:
+        max_threads = int(os.environ.get('SLURM_CPUS_ON_NODE', os.cpu_count() or 4))
+    tops = [top] if isinstance(top, str) else list(top)
+
+    _require_core()
+
+    result = _pwalk_core.ext_totals(
+        tops,
+        max_threads,
+        one_filesystem=one_filesystem,
+        skip_names=_skip_names(skip_names),
+        extensions=False,
+        summary=True
+    )
+    append_history(history, result['summary'], [os.fspath(t) for t in tops])
+    return result['summary'], result['errors']
+
+
+def trend(history: str, by: str = 'user', days: Optional[float] = None) -> List[tuple]:
+    """
+    Growth per user, group or top-level directory from a history file.
+
+    Args:
+        history: File written by report(history=...) or record_history()
+        by: 'user', 'group' or 'top'
+        days: Only use scans from the last this many days before the
+            newest one (default: all)
+
+    Returns:
+        Rows (key, count, bytes, disk, bytes_change, bytes_per_day,
+        files_per_day) for the newest scan, fastest growing first. Rates
+        are least-squares slopes over the scans in the window; a key
+        missing from a scan counts as zero there. With a single scan the
+        changes and rates are 0.
+
+    Example:
+        >>> for uid, n, size, disk, change, rate, frate in trend('projects.hist', days=90)[:10]:
+        ...     print(uid, format_size(size), format_size(rate), 'per day')
+    """
+    if by not in KINDS:
+        raise ValueError(f"Invalid by: {by}. Use {', '.join(KINDS)}")
+    snapshots = read_history(history)
+    if not snapshots:
+        return []
+    if days is not None:
+        snapshots = [s for s in snapshots if s.time >= snapshots[-1].time - days * 86400]
+
+    t = [(s.time - snapshots[0].time) / 86400 for s in snapshots]
+    tmean = sum(t) / len(t)
+    var = sum((x - tmean) ** 2 for x in t)
+
+    def slope(ys):
+        if var == 0:
+            return 0.0
+        ymean = sum(ys) / len(ys)
+        return sum((x - tmean) * (y - ymean) for x, y in zip(t, ys)) / var
+
+    keys = {k for s in snapshots for k in s.totals if k[0] == by}
+    rows = []
+    for k in keys:
+        series = [s.totals.get(k, (0, 0, 0)) for s in snapshots]
+        count, size, disk = series[-1]
+        rows.append((k[1], count, size, disk, size - series[0][1],
+                     slope([v[1] for v in series]), slope([v[0] for v in series])))
+    rows.sort(key=lambda r: (-r[5], -r[2], str(r[0])))
+    return rows
@@ -0,0 +1,104 @@
+"""
+index.py - Path and inode lookups in a scan through its path index
+
+report(index=True) writes <output>.pidx next to each scan: a blocked Bloom
+filter over every recorded path and a minimal perfect hash (BBHash) from
+(st_dev, inode) to the location of its record. Both are memory-mapped, so "is this
+path in the last scan" is one cache line and "what does the scan say about
+inode N" a few probes plus reading one record, with no join or parse of
+the scan.
+"""
+
+import csv
+import os
+from typing import Any, Dict, Optional
+
+from .report import HAS_CORE, _require_core
+
+if HAS_CORE:
+    import _pwalk_core
+
+# Columns kept as text in lookup() rows; the others are integers
+_TEXT_COLUMNS = {'filename', 'fileExtension', 'st_mode', 'xattrs', 'xxh64', 'user', 'group'}
+
+
+class ScanIndex:
+    """
+    Lookups in one scan through its path index.
+
+    ``path in index`` tests the Bloom filter: a path that was scanned is
+    always found, one that was not is reported present about 1% of the
+    time. ``inode in index``, ``(inode, dev) in index``, ``os.lstat(path)
+    in index`` and lookup() are exact. Paths are spelled as in the scan:
+    the top directory as it was given, then entry names; repeated and
+    trailing slashes do not matter.
+
+    Inodes are numbered per filesystem, so they are looked up with their
+    st_dev; without one, the device of the top directory (``dev``) is used.
+    """
+
+    def __init__(self, scan: str, index: Optional[str] = None):
+        _require_core()
+        scan = os.fspath(scan)
+        self.scan = scan
+        self._index = _pwalk_core.load_index(index or scan + '.pidx', scan)
+        self.columns = next(csv.reader([self._index.header]))
+        self.dev = self._index.dev
+
+    def __len__(self) -> int:
+        """Number of distinct inodes in the scan."""
+        return len(self._index)
+
+    def __contains__(self, key) -> bool:
+        if isinstance(key, os.stat_result):
+            return self._index.locate(key.st_ino, key.st_dev) is not None
+        if isinstance(key, int):
+            return self._index.locate(key) is not None
+        if isinstance(key, tuple):
+            return self._index.locate(*key) is not None
+        return self._index.contains(key)
+
+    def exists(self, path: str) -> bool:
+        """Whether path may be in the scan (no false negatives)."""
+        return self._index.contains(path)
+
+    def record(self, inode: int, dev: Optional[int] = None) -> Optional[str]:
+        """The raw CSV record of an inode, None if it is not in the scan."""
+        return self._index.record(inode, dev)
+
+    def lookup(self, inode: int, dev: Optional[int] = None) -> Optional[Dict[str, Any]]:
+        """
+        The scan's record of an inode as {column: value}, None if absent.
+
+        dev is the inode's st_dev (default: the top directory's). An inode
+        that is hard linked several times returns its first record.
+        """
+        raw = self._index.record(inode, dev)
+        if raw is None:
+            return None
+        row = {}
+        for column, value in zip(self.columns, next(csv.reader([raw]))):
+            if column in _TEXT_COLUMNS or not value.lstrip('-').isdigit():
+                row[column] = value
+            else:
+                row[column] = int(value)
+        return row
+
+
+def open_index(scan: str, index: Optional[str] = None) -> ScanIndex:
+    """
+    Open the path index of a scan written by report(index=True).
+
+    Args:
+        scan: Scan file (.csv, .csv.zst or .csv.lz4)
+        index: Index file (default: scan + '.pidx')
+
+    Example:
+        >>> idx = open_index('scan.csv.zst')
+        >>> '/data/home/alice/results.h5' in idx
+        True
+        >>> st = os.lstat('/data/home/alice/results.h5')
+        >>> idx.lookup(st.st_ino, st.st_dev)['st_size']
+        1048576
+    """
+    return ScanIndex(scan, index)
@@ -0,0 +1,91 @@
+"""
+query.py - Group-by aggregates over scan files
+
+A small built-in query engine for hosts without DuckDB. The C engine
+decompresses the zstd frames of a scan (or chunks of a plain CSV) in
+parallel, parses only the columns a query needs, and aggregates into
+per-thread hash tables merged at the end.
+"""
+
+import os
+from typing import List, Optional, Sequence, Tuple
+
+from .report import HAS_CORE, _require_core
+
+if HAS_CORE:
+    import _pwalk_core
+
+# Aggregate functions understood by the C engine (AGG_* in pwalk_core.c)
+AGGREGATES = {'count': 0, 'sum': 1, 'min': 2, 'max': 3, 'avg': 4}
+
+
+def _value(text: str):
+    """Group values that are integers come back as int."""
+    if text[1:].isdigit() if text.startswith('-') else text.isdigit():
+        return int(text)
+    return text
+
+
+def query(
+    scan: str,
+    group_by: Sequence[str] = (),
+    aggregates: Sequence[Tuple[str, Optional[str]]] = (('count', None),),
+    max_threads: Optional[int] = None,
+    limit: Optional[int] = None
+) -> Tuple[List[str], List[tuple]]:
+    """
+    Group-by aggregates over a scan written by report().
+
+    Args:
+        scan: Scan file (.csv or .csv.zst)
+        group_by: Column names to group by (case-insensitive), e.g. ('uid',)
+        aggregates: (function, column) pairs with function one of count,
+            sum, min, max, avg; count takes no column
+        max_threads: Number of threads (default: CPU count)
+        limit: Only return the first rows
+
+    Returns:
+        (column_names, rows), rows sorted by the first aggregate, largest
+        first. Empty or non-numeric values are skipped by sum/min/max/avg
+        (min/max/avg of a group without values is None); avg is the mean
+        of the values that are integers.
+
+    Example:
+        >>> columns, rows = query('scan.csv.zst', group_by=['uid'],
+        ...                       aggregates=[('sum', 'st_size'), ('count', None)])
+    """
+    if max_threads is None:
+        max_threads = int(os.environ.get('SLURM_CPUS_ON_NODE', os.cpu_count() or 4))
+
+    if not aggregates:
+        raise ValueError("Need at least one aggregate")
+    for func, column in aggregates:
+        if func not in AGGREGATES:
+            raise ValueError(f"Invalid aggregate: {func}. Use {', '.join(AGGREGATES)}")
+        if (func == 'count') != (column is None):
+            raise ValueError(f"{func} needs {'no' if func == 'count' else 'a'} column")
+
+    _require_core()
+
+    result = _pwalk_core.query_scan(
+        scan,
+        list(group_by),
+        [(AGGREGATES[func], column) for func, column in aggregates],
+        max_threads
+    )
+
+    names = [c for c in result['columns']]
+    lookup = {c.lower(): c for c in names}
+    columns = [lookup[g.lower()] for g in group_by]
+    columns += [func if column is None else f"{func}({lookup[column.lower()]})"
+                for func, column in aggregates]
+
+    ngroup = len(group_by)
+    rows = []
+    for row in result['rows']:
+        rows.append(tuple(_value(v) for v in row[:ngroup]) + tuple(row[ngroup + 1:]))
+
+    rows.sort(key=lambda r: (r[ngroup] is None, -(r[ngroup] or 0)))
+    if limit is not None:
+        rows = rows[:limit]
+    return columns, rows
@@ -2,26 +2,189 @@
 report.py - Filesystem metadata reporting
 
 Generates CSV reports compatible with John Dey's pwalk format.
-Supports zstd compression for 8-10x size reduction.
+Supports zstd compression for 8-10x size reduction, or lz4 for the
+lowest CPU cost.
 """
 
+import csv
 import os
-from typing import Tuple, List, Optional
+from typing import Any, Dict, Iterable, Sequence, Tuple, List, Optional, Union
 
 try:
     import _pwalk_core
     HAS_CORE = True
     HAS_ZSTD = _pwalk_core.HAS_ZSTD
+    HAS_LZ4 = _pwalk_core.HAS_LZ4
 except ImportError:
     HAS_CORE = False
     HAS_ZSTD = False
+    HAS_LZ4 = False
+
+# Snapshot and metadata directories exposed by common storage systems
+# (NetApp, ZFS, Btrfs/snapper, Isilon, GPFS, Lustre). Scanning them
+# multiplies scan time by the number of snapshots.
+SNAPSHOT_DIRS = ('.snapshot', '.snapshots', '~snapshot', '.zfs', '.ckpt', '.lustre')
+
+# Optional extended attribute columns (see report(xattrs=...))
+XATTR_MODES = {None: 0, 'acl': 1, 'all': 2}
+
+# Traversal orders (see report(order=...))
+ORDERS = {'largest': 0, 'bfs': 1, 'dfs': 2, 'hybrid': 3}
+
+# Extension statistics (EXT_* in pwalk_core.c)
+EXT_MODES = {None: 0, 'ext': 1, 'top': 2}
+
+
+class ReportResult(tuple):
+    """
+    (output_path, error_list) tuple returned by report().
+
+    Unpacks like a plain 2-tuple; extra information collected by the
+    C engine during the scan is available through ``stats``.
+    """
+
+    def __new__(cls, output: str, errors: List[str], stats: Optional[Dict[str, Any]] = None):
+        self = super().__new__(cls, (output, errors))
+        self.stats = stats or {}
+        return self
+
+    @property
+    def output(self) -> str:
+        return self[0]
+
+    @property
+    def errors(self) -> List[str]:
+        return self[1]
+
+    @property
+    def mountpoints(self) -> List[str]:
+        """Mountpoints skipped in one-filesystem mode."""
+        return self.stats.get('mountpoints', [])
+
+    @property
+    def depth_counts(self) -> List[int]:
+        """Number of entries per level below the root (index 0 is the root)."""
+        return self.stats.get('depth_counts', [])
+
+    @property
+    def ext_stats(self) -> List[tuple]:
+        """Rows of report(ext_stats=...), see extensions()."""
+        rows = self.stats.get('ext_stats') or []
+        return _ext_rows(rows, by_top_dir=bool(rows) and rows[0][0] is not None)
+
+    @property
+    def summary(self) -> List[tuple]:
+        """Rows (kind, key, count, bytes, disk) of report(summary=True); kind is
+        'user' or 'group' with a numeric id, or 'top' with a directory path."""
+        return self.stats.get('summary') or []
+
+
+def subtree_sizes(scan: str) -> Dict[int, int]:
+    """
+    Compute per-directory subtree entry counts from a previous report.
+
+    The result can be passed to report(size_hints=...) so the next scan
+    starts on the largest subtrees first.
+
+    Args:
+        scan: Uncompressed CSV written by report()
+
+    Returns:
+        Dict mapping directory inode to the number of entries below it
+    """
+    if scan.endswith(('.zst', '.lz4')):
+        raise ValueError(f"Cannot read compressed scan {scan}; decompress it first (zstd -d / lz4 -d)")
+
+    parents = {}
+    depths = {}
+    sizes = {}
+    with open(scan, newline='') as f:
+        reader = csv.reader(f)
+        next(reader)
+        for row in reader:
+            fcount = int(row[15])
+            if fcount < 0:
+                continue  # not a directory
+            inode = int(row[0])
+            parents[inode] = int(row[1])
+            depths[inode] = int(row[2])
+            sizes[inode] = fcount
+
+    # Roll counts up from the deepest directories
+    for inode in sorted(sizes, key=depths.__getitem__, reverse=True):
+        parent = parents[inode]
+        if parent in sizes:
+            sizes[parent] += sizes[inode]
+    return sizes
+
+
+def _compress_mode(compress: str) -> Tuple[int, str]:
+    """Validate a compress mode; returns the C engine's mode and the file suffix."""
+    if compress == 'auto':
+        return (1, '.zst') if HAS_ZSTD else (0, '')
+    if compress == 'zstd':
+        if not HAS_ZSTD:
+            raise ValueError("zstd compression not available. Use compress='auto' or compress='none' instead.")
+        return 1, '.zst'
+    if compress == 'lz4':
+        if not HAS_LZ4:
+            raise ValueError("lz4 compression not available. Use compress='auto' or compress='none' instead.")
+        return 2, '.lz4'
+    if compress == 'none':
+        return 0, ''
+    raise ValueError(f"Invalid compress: {compress}. Use 'auto', 'zstd', 'lz4', or 'none'")
+
+
+def _ext_rows(rows: List[tuple], by_top_dir: bool) -> List[tuple]:
+    """Engine rows to extensions() rows, largest total size first."""
+    if not by_top_dir:
+        rows = [row[1:] for row in rows]
+    return sorted(rows, key=lambda row: (-row[-2], row[:-3]))
+
+
+def _skip_names(skip_names) -> tuple:
+    """skip_names as the C engine takes it; a single name is not split into characters."""
+    if skip_names is None:
+        return ('.snapshot',)
+    if isinstance(skip_names, (str, bytes, os.PathLike)):
+        return (skip_names,)
+    return tuple(skip_names)
+
+
+def _require_core():
+    if not HAS_CORE:
+        raise ImportError(
+            "C extension (_pwalk_core) not available.\n"
+            "Install from PyPI with: pip install pwalk\n"
+            "Or if building from source: python setup.py build_ext --inplace"
+        )
 
 
 def report(
-    top: str,
-    output: Optional[str] = None,
+    top: Union[str, Sequence[str]],
+    output: Optional[Union[str, Sequence[str]]] = None,
     max_threads: Optional[int] = None,
-    compress: str = 'auto'
+    compress: str = 'auto',
+    one_filesystem: bool = False,
+    skip_names: Optional[Iterable[str]] = None,
+    max_depth: Optional[int] = None,
+    count_below: bool = False,
+    xattrs: Optional[str] = None,
+    ns_timestamps: bool = False,
+    inode_order: bool = False,
+    size_hints: Optional[Union[str, Dict[int, int]]] = None,
+    order: str = 'largest',
+    frontier_limit: int = 256 * 1024 * 1024,
+    names: bool = False,
+    ext_stats: Optional[str] = None,
+    prefetch: int = 0,
+    checksum: bool = False,
+    checksum_threads: int = 4,
+    checksum_bandwidth: Optional[float] = None,
+    checksum_direct: bool = False,
+    summary: bool = False,
+    history: Optional[str] = None,
+    index: bool = False
 ) -> Tuple[str, List[str]]:
     """
     Generate filesystem metadata report in CSV format.
@@ -30,18 +193,96 @@ def report(
     Supports zstd compression for fast, efficient storage.
 
     Args:
-        top: Starting directory path
-        output: Output file path (default: scan.csv or scan.csv.zst)
+        top: Starting directory path, or a list of roots scanned together by
+            one worker pool; rows then carry a root_id column (the index
+            of the root in the list)
+        output: Output file path (default: scan.csv or scan.csv.zst), or
+            with a list of roots, a list with one output path per root
         max_threads: Maximum threads (default: SLURM_CPUS_ON_NODE or cpu_count())
-        compress: Compression mode - 'auto', 'zstd', 'none'
+        compress: Compression mode - 'auto', 'zstd', 'lz4', 'none'. lz4
+            (.csv.lz4) costs the least CPU on fast storage but compresses
+            about half as well and is not readable by DuckDB
+        one_filesystem: Do not descend into directories on other filesystems
+            (like ``find -xdev``); skipped mountpoints still get their own
+            row and are listed in ``result.mountpoints``
+        skip_names: Names of directories to skip, or a single name (default:
+            ``('.snapshot',)``; files of those names are still reported;
+            use ``SNAPSHOT_DIRS`` to skip the snapshot directories of most
+            storage systems, or ``()`` to skip nothing)
+        max_depth: Only report entries up to this many levels below ``top``
+            (like ``find -maxdepth``); directories at the cut-off are
+            recorded but not read
+        count_below: With max_depth, still count the entries below the
+            cut-off using readdir() only (no stat); the counts show up in
+            ``result.depth_counts`` and the cut-off directories' pw_fcount
+        xattrs: Extended attribute columns - None (default), 'acl' adds a
+            has_acl flag (POSIX or NFSv4 ACL present), 'all' also adds the
+            semicolon-separated xattr names. Costs one llistxattr() per entry.
+        ns_timestamps: Add st_atime_ns, st_mtime_ns, st_ctime_ns and
+            st_btime_ns (birth time, empty where the filesystem has none)
+            columns, collected with statx() in place of lstat()
+        inode_order: Stat each directory's entries sorted by inode number
+            instead of readdir() (hash) order; cuts seeks on spinning disks
+            and cold caches
+        size_hints: Previous scan (path to an uncompressed report) or a dict
+            {directory inode: subtree entries}. Directories are always
+            handed to workers largest estimated subtree first; the
+            estimate otherwise comes from each directory's st_size and
+            st_nlink. Hints keep a big subtree found late from leaving one
+            thread working alone at the end of the scan.
+        order: Traversal order - 'largest' (default, see size_hints),
+            'bfs' (shallow structure first, frontier can grow large),
+            'dfs' (lowest memory), or 'hybrid' (BFS until the queued
+            directories hold more than frontier_limit bytes, then DFS
+            until they are back under half of it)
+        frontier_limit: Memory limit in bytes for order='hybrid'; the peak
+            is reported in ``result.stats['frontier_peak']``
+        names: Add "user" and "group" name columns. Each distinct id is
+            resolved once per scan by a resolver thread; workers never wait
+            on NSS (LDAP/SSSD). Unknown ids are written as numbers.
+        ext_stats: Also total count and bytes per file type and extension
+            during the scan - 'ext', or 'top' for per top-level directory;
+            rows in ``result.ext_stats`` as for extensions()
+        prefetch: Directory readahead depth (0: off, max 64). That many
+            lightweight threads open and read the next queued directories
+            ahead of the workers, overlapping NFS round trips; the number
+            warmed is in ``result.stats['prefetched']``
+        checksum: Add an "xxh64" column with the XXH64 hash of every
+            regular file's content (hex, as printed by xxhsum). Files are
+            read by a separate pool of checksum_threads readers in 1 MiB
+            preads that are dropped from the page cache as they go, and
+            atime is preserved where permitted; unreadable files get an
+            empty checksum and an entry in the error list
+        checksum_threads: Files read concurrently (max 16)
+        checksum_bandwidth: Cap on the total read rate in bytes per second
+        checksum_direct: Read with O_DIRECT, bypassing the page cache
+            (falls back to buffered reads where unsupported)
+        summary: Total count, bytes and disk bytes per user, group and
+            top-level directory during the scan (``result.summary``)
+        history: Append the summary to this history file for trend()
+        index: Also write a path index next to each output (output +
+            '.pidx', about 18 bytes per entry): a Bloom filter of the
+            scanned paths and a perfect hash from inode to record, read
+            with open_index()
 
     Returns:
-        (output_path, error_list) tuple
+        (output_path, error_list) tuple (a ReportResult)
 
     Examples:
         >>> output, errors = report('/data')
         >>> print(f"Report: {output}")
 
+        >>> # Stay on one filesystem, scan the other mounts separately
+        >>> result = report('/home', one_filesystem=True)
+        >>> print(result.mountpoints)
+
+        >>> # Quick structural survey of the top 3 levels
+        >>> result = report('/projects', max_depth=3, count_below=True)
+        >>> print(result.depth_counts)
+
+        >>> # Many small project filesystems, one saturated worker pool
+        >>> report(['/proj/a', '/proj/b', '/proj/c'], output='projects.csv')
+
         >>> # Use with DuckDB
         >>> import duckdb
         >>> df = duckdb.connect().execute(f"SELECT * FROM '{output}'").fetchdf()
@@ -49,38 +290,149 @@ def report(
     if max_threads is None:
         max_threads = int(os.environ.get('SLURM_CPUS_ON_NODE', os.cpu_count() or 4))
 
-    use_compress = False
-    if compress == 'auto':
-        use_compress = HAS_ZSTD
-    elif compress == 'zstd':
-        if not HAS_ZSTD:
-            raise ValueError("zstd compression not available. Use compress='auto' or compress='none' instead.")
-        use_compress = True
-    elif compress == 'none':
-        use_compress = False
-    else:
-        raise ValueError(f"Invalid compress: {compress}. Use 'auto', 'zstd', or 'none'")
+    if isinstance(size_hints, str):
+        size_hints = subtree_sizes(size_hints)
+
+    if order not in ORDERS:
+        raise ValueError(f"Invalid order: {order}. Use {', '.join(ORDERS)}")
+
+    if xattrs not in XATTR_MODES:
+        raise ValueError(f"Invalid xattrs: {xattrs}. Use None, 'acl', or 'all'")
+
+    if max_depth is not None and max_depth < 0:
+        raise ValueError(f"Invalid max_depth: {max_depth}. Must be >= 0")
+
+    if ext_stats not in EXT_MODES:
+        raise ValueError(f"Invalid ext_stats: {ext_stats}. Use None, 'ext', or 'top'")
+
+    mode, suffix = _compress_mode(compress)
 
     if output is None:
-        output = 'scan.csv.zst' if use_compress else 'scan.csv'
-    elif use_compress and not output.endswith('.zst'):
-        output = output + '.zst'
+        output = 'scan.csv' + suffix
 
-    if not HAS_CORE:
-        raise ImportError(
-            "C extension (_pwalk_core) not available.\n"
-            "Install from PyPI with: pip install pwalk\n"
-            "Or if building from source: python setup.py build_ext --inplace"
-        )
+    if isinstance(output, str):
+        if not output.endswith(suffix):
+            output = output + suffix
+    else:
+        if isinstance(top, str) or len(output) != len(top):
+            raise ValueError("A list of outputs needs a list of roots of the same length")
+        output = [o if o.endswith(suffix) else o + suffix for o in output]
+
+    if not isinstance(top, str):
+        top = list(top)
+        if not top:
+            raise ValueError("No roots to scan")
+
+    _require_core()
+
+    # Outputs are written under a temporary name and renamed into place
+    # when complete, so a directory of scans never shows a partial one
+    outputs = [output] if isinstance(output, str) else output
+    partial = [f"{o}.{os.getpid()}.part" for o in outputs]
 
     try:
         result = _pwalk_core.write_csv(
             top,
-            output.replace('.zst', ''),
+            partial[0] if isinstance(output, str) else partial,
             max_threads,
             1,  # ignore_snapshots
-            1 if use_compress else 0
+            mode,
+            one_filesystem=one_filesystem,
+            skip_names=_skip_names(skip_names),
+            max_depth=-1 if max_depth is None else max_depth,
+            count_below=count_below,
+            xattrs=XATTR_MODES[xattrs],
+            ns_timestamps=ns_timestamps,
+            inode_order=inode_order,
+            size_hints=size_hints,
+            order=ORDERS[order],
+            frontier_limit=frontier_limit,
+            names=names,
+            ext_stats=EXT_MODES[ext_stats],
+            prefetch=prefetch,
+            checksum=checksum,
+            checksum_threads=checksum_threads,
+            checksum_bandwidth=float(checksum_bandwidth or 0),
+            checksum_direct=checksum_direct,
+            summary=summary or history is not None,
+            index=index
         )
-        return result['output'], []
+        for part, final in zip(partial, outputs):
+            if os.path.exists(part + '.pidx'):
+                os.replace(part + '.pidx', final + '.pidx')
+            os.replace(part, final)
+        result['output'] = output
+        if history is not None:
+            from .history import append_history
+            tops = [top] if isinstance(top, str) else top
+            append_history(history, result['summary'], [os.fspath(t) for t in tops])
+        return ReportResult(result['output'], result['errors'], result)
     except Exception as e:
         raise RuntimeError(f"Failed to generate report: {e}")
+    finally:
+        for part in partial:
+            for path in (part, part + '.pidx'):
+                if os.path.exists(path):
+                    os.unlink(path)
+
+
+def stat_many(
+    paths: Iterable[str],
+    output: str = 'stat.csv',
+    max_threads: Optional[int] = None,
+    compress: str = 'none',
+    xattrs: Optional[str] = None,
+    ns_timestamps: bool = False,
+    names: bool = False
+) -> ReportResult:
+    """
+    lstat an explicit list of paths in parallel.
+
+    Writes one record per path in the same CSV format as report(), with
+    the full path in the filename column (changed-file lists from
+    inotify/changelog consumers, backup manifests, ...). Directories are
+    not descended into. Paths that cannot be stat'ed are skipped and
+    returned as "path: reason" in the error list.
+
+    Args:
+        paths: Paths to stat (any iterable of str)
+        output: Output file path
+        max_threads: Number of threads (default: CPU count)
+        compress: Compression mode - 'auto', 'zstd', 'lz4', 'none' (default)
+        xattrs, ns_timestamps, names: Optional columns, as for report()
+
+    Returns:
+        (output_path, error_list) tuple (a ReportResult); the number of
+        records written is in ``result.stats['count']``
+
+    Example:
+        >>> with open('changed.txt') as f:
+        ...     result = stat_many(line.rstrip('\\n') for line in f)
+    """
+    if max_threads is None:
+        max_threads = int(os.environ.get('SLURM_CPUS_ON_NODE', os.cpu_count() or 4))
+
+    if xattrs not in XATTR_MODES:
+        raise ValueError(f"Invalid xattrs: {xattrs}. Use None, 'acl', or 'all'")
+
+    mode, suffix = _compress_mode(compress)
+    if not output.endswith(suffix):
+        output = output + suffix
+
+    paths = [p for p in paths if p]
+
+    _require_core()
+
+    try:
+        result = _pwalk_core.stat_csv(
+            paths,
+            output,
+            max_threads,
+            mode,
+            xattrs=XATTR_MODES[xattrs],
+            ns_timestamps=ns_timestamps,
+            names=names
+        )
+        return ReportResult(result['output'], result['errors'], result)
+    except Exception as e:
+        raise RuntimeError(f"Failed to stat paths: {e}")
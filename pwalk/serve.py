@@ -0,0 +1,216 @@
+"""
+serve.py - Usage lookups from a memory-mapped scan index over a Unix socket
+
+`pwalk serve` turns the latest scan into a tree index (see tree.py): the
+preorder arrays give every directory's rollup as an O(1) prefix-sum
+difference, and the name-sorted child lists are the path trie. The index
+file is mapped, not parsed, so a query costs a few binary searches.
+
+Requests and replies are one JSON object per line:
+
+    {"op": "usage", "path": "/projects/x", "uid": 1000}
+    {"op": "children", "path": "/projects/x"}
+    {"op": "info"}
+
+A newer scan is picked up by a background thread (or on SIGHUP). The new
+index is built and mapped next to the old one and swapped in with a single
+assignment, so queries never wait; requests in flight finish on the index
+they started with.
+"""
+
+import errno
+import glob
+import json
+import os
+import signal
+import socket
+import socketserver
+import sys
+import threading
+import time
+from typing import Optional
+
+from .tree import load_tree
+
+DEFAULT_SOCKET = os.environ.get('PWALK_SOCKET', '/tmp/pwalk.sock')
+
+SCAN_PATTERNS = ('*.csv', '*.csv.zst', '*.csv.lz4')
+
+
+def latest_scan(source: str) -> str:
+    """
+    The scan file itself, or the newest finished scan in a directory.
+
+    report() writes a scan under a temporary name (<output>.<pid>.part)
+    and renames it into place when it is complete, so scans still being
+    written do not match the patterns and are never picked up.
+    """
+    if not os.path.isdir(source):
+        return source
+    scans = [p for pattern in SCAN_PATTERNS for p in glob.glob(os.path.join(source, pattern))]
+    if not scans:
+        raise FileNotFoundError(f"No scans in {source}")
+    return max(scans, key=os.path.getmtime)
+
+
+def build_index(scan: str, root: Optional[str] = None, max_threads: Optional[int] = None) -> str:
+    """
+    Write (or reuse) scan + '.idx', the tree index of a scan.
+
+    The index is written to a temporary file and renamed into place, so a
+    server mapping the previous index is never disturbed.
+    """
+    index = scan + '.idx'
+    if os.path.exists(index) and os.path.getmtime(index) >= os.path.getmtime(scan):
+        try:
+            load_tree(index)
+            return index
+        except ValueError:
+            pass  # written by an older version
+    tmp = f"{index}.{os.getpid()}.tmp"
+    try:
+        load_tree(scan, root=root, max_threads=max_threads).save(tmp)
+        os.replace(tmp, index)
+    finally:
+        if os.path.exists(tmp):
+            os.unlink(tmp)
+    return index
+
+
+class _Handler(socketserver.StreamRequestHandler):
+    def handle(self):
+        for line in self.rfile:
+            try:
+                reply = self.server.answer(json.loads(line))
+            except Exception as e:
+                reply = {'error': str(e)}
+            self.wfile.write(json.dumps(reply).encode() + b'\n')
+            self.wfile.flush()
+
+
+class UsageServer(socketserver.ThreadingMixIn, socketserver.UnixStreamServer):
+    """Answers usage queries from the index of the latest scan in source."""
+
+    daemon_threads = True
+
+    def __init__(self, source: str, socket_path: str = DEFAULT_SOCKET,
+                 root: Optional[str] = None, interval: float = 60,
+                 max_threads: Optional[int] = None):
+        self.source = source
+        self.root = root
+        self.interval = interval
+        self.max_threads = max_threads
+        self.scan = None
+        self.tree = None
+        self.loaded = None
+        self._reload_lock = threading.Lock()
+        self._wakeup = threading.Event()
+        self.reload()
+
+        if os.path.exists(socket_path):
+            # A socket left behind by a server that died is replaced; one
+            # that still answers belongs to a running server
+            with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as probe:
+                try:
+                    probe.connect(socket_path)
+                except OSError:
+                    os.unlink(socket_path)
+                else:
+                    raise OSError(errno.EADDRINUSE, f"A server is already listening on {socket_path}")
+        super().__init__(socket_path, _Handler)
+        # Lookups are for everyone on the host
+        os.chmod(socket_path, 0o666)
+
+    def reload(self) -> bool:
+        """Swap in the latest scan if it changed; True when swapped."""
+        with self._reload_lock:
+            scan = latest_scan(self.source)
+            stamp = (scan, os.path.getmtime(scan))
+            if stamp == self.scan:
+                return False
+            tree = load_tree(build_index(scan, self.root, self.max_threads))
+            self.tree, self.scan, self.loaded = tree, stamp, time.time()
+            return True
+
+    def _watch(self):
+        while True:
+            self._wakeup.wait(self.interval)
+            self._wakeup.clear()
+            try:
+                self.reload()
+            except Exception:
+                pass  # keep serving the current index
+
+    def serve_forever(self, poll_interval=0.5):
+        threading.Thread(target=self._watch, daemon=True).start()
+        super().serve_forever(poll_interval)
+
+    def wakeup(self):
+        """Check for a new scan now (SIGHUP)."""
+        self._wakeup.set()
+
+    def answer(self, request: dict) -> dict:
+        tree = self.tree
+        op = request.get('op', 'usage')
+        if op == 'info':
+            return {'scan': self.scan[0], 'nodes': len(tree), 'loaded': self.loaded}
+
+        path = request['path']
+        try:
+            node = tree.lookup(path.rstrip('/') or '/')
+        except KeyError:
+            return {'error': f"{path}: not in scan {self.scan[0]}"}
+        uid = request.get('uid')
+        uid = -1 if uid is None else uid
+        if op == 'usage':
+            files, size, blocks = tree.usage(node, uid=uid)
+            return {'path': tree.path(node), 'files': files, 'size': size,
+                    'disk': blocks * 512, 'scan_time': self.scan[1]}
+        if op == 'children':
+            children = [(tree.name(c),) + tree.usage(c, uid=uid)[:2] for c in tree.children(node)]
+            children.sort(key=lambda c: -c[2])
+            return {'path': tree.path(node), 'children': children}
+        return {'error': f"unknown op: {op}"}
+
+
+def serve(source: str, socket_path: str = DEFAULT_SOCKET, root: Optional[str] = None,
+          interval: float = 60, max_threads: Optional[int] = None):
+    """
+    Serve usage queries for the latest scan in source until interrupted.
+
+    Args:
+        source: Scan file, or a directory the periodic scans are written to
+        socket_path: Unix socket to listen on
+        root: Path the scans were taken of (see load_tree)
+        interval: Seconds between checks for a newer scan
+        max_threads: Threads for building indexes
+    """
+    server = UsageServer(source, socket_path, root, interval, max_threads)
+    signal.signal(signal.SIGHUP, lambda signum, frame: server.wakeup())
+    signal.signal(signal.SIGTERM, lambda signum, frame: sys.exit(0))
+    try:
+        server.serve_forever()
+    finally:
+        server.server_close()
+        os.unlink(socket_path)
+
+
+def ask(request: dict, socket_path: str = DEFAULT_SOCKET, timeout: float = 10) -> dict:
+    """
+    Send one request to a running server.
+
+    Example:
+        >>> ask({'op': 'usage', 'path': '/projects/x', 'uid': os.getuid()})
+        {'path': '/projects/x', 'files': 1234, 'size': 5678901, ...}
+    """
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as s:
+        s.settimeout(timeout)
+        s.connect(socket_path)
+        s.sendall(json.dumps(request).encode() + b'\n')
+        data = b''
+        while not data.endswith(b'\n'):
+            chunk = s.recv(65536)
+            if not chunk:
+                break
+            data += chunk
+    return json.loads(data)
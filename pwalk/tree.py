@@ -0,0 +1,58 @@
+"""
+tree.py - A scan loaded as a compact in-memory tree
+
+load_tree() builds the tree in C: a parent array, CSR child lists and one
+array per metadata column, with nodes numbered in preorder. The subtree of
+node i is the index interval [i, subtree_end[i]), so subtree counts and
+size/blocks sums are O(1) and path lookups are a binary search per path
+component. Columns are exposed through the buffer protocol, so numpy and
+friends can read them without a copy.
+"""
+
+import os
+from typing import Optional
+
+from .report import HAS_CORE, _require_core
+
+if HAS_CORE:
+    import _pwalk_core
+
+
+def load_tree(scan: str, root: Optional[str] = None, max_threads: Optional[int] = None):
+    """
+    Load a scan written by report() as a Tree.
+
+    Args:
+        scan: Scan file (.csv, .csv.zst or .csv.lz4), or an index written
+            by Tree.save(), which is memory-mapped instead of parsed
+        root: Path the scan was taken of, e.g. '/data'. Paths returned by
+            path() and accepted by lookup() then start with it; without it
+            they start with the name of the top directory. Needs a scan
+            with a single top directory.
+        max_threads: Number of threads parsing the scan (default: CPU count)
+
+    Returns:
+        A Tree with len(tree) nodes and the methods lookup(path), path(i),
+        name(i), parent(i), children(i), subtree(i) -> (start, end),
+        subtree_count(i), subtree_sum(i, column='size'), usage(i, uid=-1)
+        -> (files, size, blocks), save(index) and column(name), which
+        returns a read-only memoryview (columns lists the names).
+        Sums count hardlinked files once per link, as the scan does.
+
+    Example:
+        >>> tree = load_tree('scan.csv.zst', root='/data')
+        >>> home = tree.lookup('/data/home')
+        >>> sizes = [(tree.subtree_sum(c), tree.path(c)) for c in tree.children(home)]
+        >>> import numpy as np
+        >>> mtime = np.frombuffer(tree.column('mtime'), dtype=np.int64)
+    """
+    if max_threads is None:
+        max_threads = int(os.environ.get('SLURM_CPUS_ON_NODE', os.cpu_count() or 4))
+
+    _require_core()
+
+    if root is not None:
+        root = os.fspath(root)
+        root = root.rstrip('/') or '/'
+        return _pwalk_core.load_tree(scan, root=root, max_threads=max_threads)
+    return _pwalk_core.load_tree(scan, max_threads=max_threads)
@@ -6,6 +6,8 @@ Setup script for python-pwalk
 import os
 import sys
 import subprocess
+import sysconfig
+import tempfile
 from setuptools import setup, Extension
 from pathlib import Path
 
@@ -13,23 +15,33 @@ from pathlib import Path
 this_directory = Path(__file__).parent
 long_description = (this_directory / "README.md").read_text()
 
-# Check for zstd library (silently)
-has_zstd = False
-try:
-    result = subprocess.run(['ldconfig', '-p'], capture_output=True, text=True, timeout=5)
-    has_zstd = 'libzstd' in result.stdout
-except:
-    try:
-        result = subprocess.run(['pkg-config', '--exists', 'libzstd'], capture_output=True, timeout=5)
-        has_zstd = result.returncode == 0
-    except:
-        pass
+# Check for optional compression libraries (silently): a library counts
+# only if a program including its header compiles and links against it
+def has_library(name, header):
+    cc = (os.environ.get('CC') or sysconfig.get_config_var('CC') or 'cc').split()
+    with tempfile.TemporaryDirectory() as tmp:
+        src = os.path.join(tmp, 'check.c')
+        with open(src, 'w') as f:
+            f.write(f'#include <{header}>\nint main(void) {{ return 0; }}\n')
+        try:
+            result = subprocess.run(cc + os.environ.get('CFLAGS', '').split() +
+                                    [src, '-o', os.path.join(tmp, 'check')] +
+                                    os.environ.get('LDFLAGS', '').split() + [f'-l{name}'],
+                                    capture_output=True, timeout=30)
+            return result.returncode == 0
+        except (OSError, subprocess.SubprocessError):
+            return False
+
+has_zstd = has_library('zstd', 'zstd.h')
+has_lz4 = has_library('lz4', 'lz4frame.h')
 
 # Configure C extension
 pwalk_core_args = {
     'sources': ['src/pwalk_ext/pwalk_core.c'],
     'libraries': ['pthread'],
-    'extra_compile_args': ['-O3', '-pthread', '-march=native', '-D_GNU_SOURCE'],
+    # No -march=native: vector kernels are selected at import via cpuid, so
+    # one build runs on every x86-64 node generation
+    'extra_compile_args': ['-O3', '-pthread', '-D_GNU_SOURCE'],
     'extra_link_args': ['-pthread'],
 }
 
@@ -37,6 +49,10 @@ if has_zstd:
     pwalk_core_args['libraries'].append('zstd')
     pwalk_core_args['extra_compile_args'].append('-DHAVE_ZSTD')
 
+if has_lz4:
+    pwalk_core_args['libraries'].append('lz4')
+    pwalk_core_args['extra_compile_args'].append('-DHAVE_LZ4')
+
 pwalk_core = Extension('_pwalk_core', **pwalk_core_args)
 
 setup(
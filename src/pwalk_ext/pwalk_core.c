@@ -10,324 +10,5700 @@
 
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/xattr.h>
+#include <sys/sysmacros.h>
 #include <time.h>
 #include <errno.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <grp.h>
+#include <stdint.h>
+#include <fnmatch.h>
+#include <sys/syscall.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PW_X86 1
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+#define MAXTHRDS 32
+#define MAXPATH 4096
+#define BUFFER_SIZE (512 * 1024)
+#define MAXLEVELS 256  /* per-depth statistics; deeper levels share the last bucket */
+#define INODE_BATCH 65536  /* dirents sorted by inode at a time in inode-order mode */
+
+/* Output compression: every buffer flush becomes one independent frame */
+#define COMPRESS_NONE 0
+#define COMPRESS_ZSTD 1
+#define COMPRESS_LZ4  2
+#define FRAME_BOUND (BUFFER_SIZE + BUFFER_SIZE / 128 + 1024)  /* >= zstd and lz4 bounds */
+
+/* Index mode: a record's inode, its device and where it starts, in the
+ * buffer while buffered and then in the output (see sink_index()) */
+typedef struct {
+    uint64_t ino;
+    uint64_t dev;
+    uint64_t loc;
+} IndexNote;
+
+/* Index mode: hash of a recorded path (see path_key()) and its output */
+typedef struct {
+    uint64_t key;
+    int sink;
+} PathNote;
+
+/* Thread-local CSV buffer and statistics */
+typedef struct {
+    char csv_buffer[BUFFER_SIZE];
+    size_t used;
+    int sink;                  /* output the buffered records belong to */
+    long depthCnt[MAXLEVELS];  /* entries per level below the root */
+    IndexNote *notes;          /* index mode: records in csv_buffer */
+    size_t nnotes, capnotes;
+    PathNote *paths;           /* index mode: paths recorded by this worker */
+    size_t npaths, cappaths;
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx *cctx;           /* created on first compressed flush, kept across scans */
+#endif
+} ThreadBuffer;
+
+/* A directory waiting to be scanned */
+typedef struct DirTask {
+    struct DirTask *parent;  /* du mode: task the subtree total rolls up into */
+    uint64_t total;          /* du mode: bytes used by the subtree so far */
+    long pending;            /* du mode: unfinished subdirectories, plus one for itself */
+    int64_t newest;          /* cold mode: latest access/modification in the subtree */
+    struct stat pstat;
+    struct timespec pbtime;  /* birth time of dname (tv_sec -1: unknown) */
+    ino_t pinode;
+    long depth;
+    int root;                /* index of the scan root this directory is under */
+    uint64_t prio;           /* estimated subtree size, see dir_priority() */
+    uint64_t key;            /* heap key for the traversal order */
+    int prefetched;          /* handed to a prefetch thread (frontier.lock) */
+    char dname[];
+} DirTask;
+
+/* Traversal orders: all are max-heap keys over the same frontier */
+#define ORDER_LARGEST 0  /* largest estimated subtree first */
+#define ORDER_BFS     1  /* FIFO */
+#define ORDER_DFS     2  /* LIFO */
+#define ORDER_HYBRID  3  /* FIFO until the frontier exceeds its memory limit, then LIFO */
+
+/* Frontier of directories shared by the worker pool: a max-heap on key */
+typedef struct {
+    DirTask **heap;
+    size_t n, cap;
+    long active;             /* tasks popped but not finished */
+    uint64_t seq;            /* push counter for FIFO/LIFO keys */
+    size_t bytes, peak;      /* memory held by queued tasks */
+    int deep;                /* hybrid order currently in LIFO mode */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} Frontier;
+
+/* Global state */
+static Frontier frontier = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+static int ORDER = ORDER_LARGEST;
+static size_t FRONTIER_LIMIT = 256UL << 20;
+
+/* Directory readahead: PREFETCH threads open and read the first block of
+ * the next PREFETCH queued directories (the top slots of the heap), so on
+ * NFS their LOOKUP and READDIR round trips overlap with the workers */
+#define PREFETCH_MAX 64
+#define PREFETCH_BUF (64 * 1024)
+static int PREFETCH = 0;
+static int prefetchStop = 0;
+static long prefetchCount = 0;
+static pthread_cond_t prefetchCond = PTHREAD_COND_INITIALIZER;
+static ThreadBuffer buffers[MAXTHRDS];
+
+/* Output file: one shared by all roots, or one per root */
+typedef struct {
+    FILE *file;
+    pthread_mutex_t lock;
+    int compress;  /* COMPRESS_* */
+    IndexNote *rows;  /* index mode: every record written, in output order */
+    size_t nrows, caprows;
+    int failed;  /* a frame could not be compressed: records are missing */
+    uint64_t rootDev;  /* st_dev of its (first) top directory */
+} OutputSink;
+
+static OutputSink *sinks = NULL;
+static int nsinks = 0;
+
+/* Path index (write_csv index=True): next to each output, <output>.pidx
+ * holds a Bloom filter of the recorded paths and a minimal perfect hash
+ * from (st_dev, inode) to record location. A location is the byte offset of the
+ * record, or in a compressed output the frame's offset shifted left by
+ * INDEX_FRAME_SHIFT plus the record's offset in the decompressed frame. */
+#define INDEX_FRAME_SHIFT 20  /* > log2(BUFFER_SIZE) */
+static int INDEXING = 0;
+static int indexFailed = 0;   /* out of memory while collecting: no index */
+
+/* Scan roots: st_dev for one-filesystem mode, and whether rows carry root_id */
+static dev_t *rootDevs = NULL;
+static int ROOTIDS = 0;
+
+/* Directory entry names skipped during traversal (open-addressing hash set) */
+static char **skipSet = NULL;
+static size_t skipMask = 0;
+
+/* One-filesystem mode: do not descend into directories on another st_dev */
+static int ONEFS = 0;
+/* max_depth: directories at this level below the root are not opened (-1: no limit) */
+static long MAXDEPTH = -1;
+static int COUNTBELOW = 0;
+
+/* Optional extended attribute columns */
+#define XATTR_NONE 0
+#define XATTR_ACL  1  /* has_acl flag only */
+#define XATTR_ALL  2  /* has_acl flag and the list of xattr names */
+#define XATTR_NAMES_MAX 1024
+static int XATTRS = XATTR_NONE;
+
+/* Nanosecond timestamp and birth time columns (statx) */
+static int NSTIMES = 0;
+
+/* Stat directory entries in inode order instead of readdir() order */
+static int INODEORDER = 0;
+
+/* User and group name columns, resolved off the hot path (see resolver) */
+static int NAMES = 0;
+
+/* Content checksum column: regular files are handed to a pool of reader
+ * threads that hash them (XXH64) and write the completed records */
+#define CHECKSUM_MAX 16
+#define CHECKSUM_CHUNK (1 << 20)
+#define CHECKSUM_QUEUE 65536      /* queued files before the workers wait */
+static int CHECKSUM = 0;
+static int CHECKSUMTHREADS = 4;   /* files read at once */
+static double CHECKSUMBW = 0;     /* bytes/s over all readers (0: unlimited) */
+static int CHECKSUMDIRECT = 0;    /* O_DIRECT reads where the filesystem allows */
+
+/* Subtree size hints from a previous scan: sorted by inode */
+typedef struct {
+    uint64_t ino;
+    uint64_t entries;
+} SizeHint;
+static SizeHint *sizeHints = NULL;
+static size_t hintCnt = 0;
+
+/* Thread-safe list of paths reported back to Python */
+typedef struct {
+    pthread_mutex_t lock;
+    char **items;
+    size_t n, cap;
+} StrList;
+
+static StrList mountPoints = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0 };  /* one-filesystem mode */
+static StrList errorList = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0 };    /* "path: error" */
+
+/* Record the filename column as the full path (stat_many) */
+static int FULLPATHS = 0;
+
+/* du mode: roll sizes up to directory totals instead of writing records */
+static int DUMODE = 0;
+static long DUDEPTH = -1;      /* deepest directory level reported (-1: all) */
+static int DUAPPARENT = 0;     /* st_size instead of allocated blocks */
+static int DUCOUNTLINKS = 0;   /* count hard-linked files once per link */
+
+/* Cold mode (du mode variant): report the largest subtrees nothing in
+ * which was used since coldCutoff. Directory atimes are never used: the
+ * scan itself updates them. */
+#define COLD_NONE  0
+#define COLD_MTIME 1   /* modification times only */
+#define COLD_BOTH  2   /* file access and modification times */
+static int COLDMODE = COLD_NONE;
+static int64_t coldCutoff = 0;
+static uint64_t coldMinSize = 0;
+
+typedef struct {
+    char *path;
+    uint64_t bytes;
+    int64_t newest;          /* cold mode */
+} DuTotal;
+
+static pthread_mutex_t mutexTotals = PTHREAD_MUTEX_INITIALIZER;
+static DuTotal *duTotals = NULL;
+static size_t duCnt = 0, duCap = 0;
+
+/* Extension statistics: count and bytes per (top-level directory, file
+ * type, extension), kept in per-thread hash tables merged at the end */
+#define EXT_NONE   0
+#define EXT_BY_EXT 1
+#define EXT_BY_TOP 2   /* also per top-level directory */
+static int EXTSTATS = EXT_NONE;
+static int EXTMODE = 0;          /* ext_totals: statistics only, no records */
+static int SUMMARY = 0;          /* totals per user, group and top-level directory */
+static size_t *rootLens = NULL;  /* length of each root path */
+
+/* find mode: print the paths matching every predicate instead of records */
+#define PRED_NAME  0  /* fnmatch() on the file name */
+#define PRED_INAME 1  /* case-insensitive PRED_NAME */
+#define PRED_SIZE  2  /* st_size in units, rounded up */
+#define PRED_MTIME 3  /* whole units since st_mtime */
+#define PRED_ATIME 4  /* whole units since st_atime */
+#define PRED_UID   5
+#define PRED_GID   6
+#define PRED_TYPE  7  /* st_mode & S_IFMT */
+#define PRED_PERM  8  /* cmp 0: exact, 1: all bits set, -1: any bit set */
+#define PRED_NEWER 9  /* st_mtime in ns after value */
+
+typedef struct {
+    int kind;
+    int cmp;          /* -1: less than, 0: equal, 1: greater than value */
+    int64_t value;
+    int64_t unit;
+    char *pattern;
+} FindPred;
+
+static int FINDMODE = 0;
+static FindPred *findPreds = NULL;
+static int nFindPreds = 0;
+static char findSep = '\n';
+static time_t findNow;
+static long findCount = 0;
+
+/* (st_dev, st_ino) of hard-linked files already counted, sharded by hash */
+#define INODE_SHARDS 64
+typedef struct {
+    pthread_mutex_t lock;
+    uint64_t (*keys)[2];  /* {dev, ino}; ino 0 marks an empty slot */
+    size_t n, mask;
+} InodeShard;
+
+static InodeShard seenInodes[INODE_SHARDS];
+
+/* Flush buffer */
+/* Compress src into one frame; returns its size, 0 on error. buf (may be
+ * NULL) holds the thread's reusable zstd context. */
+static size_t compress_frame(ThreadBuffer *buf, int mode, char *dst, size_t cap,
+                             const char *src, size_t n) {
+#ifdef HAVE_ZSTD
+    if (mode == COMPRESS_ZSTD) {
+        size_t len;
+        if (buf && !buf->cctx) buf->cctx = ZSTD_createCCtx();
+        if (buf && buf->cctx) len = ZSTD_compressCCtx(buf->cctx, dst, cap, src, n, 1);
+        else len = ZSTD_compress(dst, cap, src, n, 1);
+        return ZSTD_isError(len) ? 0 : len;
+    }
+#endif
+#ifdef HAVE_LZ4
+    if (mode == COMPRESS_LZ4) {
+        LZ4F_preferences_t prefs;
+        memset(&prefs, 0, sizeof(prefs));
+        prefs.frameInfo.blockSizeID = LZ4F_max4MB;  /* one block per flush */
+        prefs.frameInfo.contentSize = n;            /* lets readers size the output */
+        size_t len = LZ4F_compressFrame(dst, cap, src, n, &prefs);
+        return LZ4F_isError(len) ? 0 : len;
+    }
+#endif
+    (void)buf; (void)mode; (void)dst; (void)cap; (void)src; (void)n;
+    return 0;
+}
+
+/* Move the buffer's index notes to its output, which is locked and
+ * positioned at base, where the buffer (or its frame) is written */
+static void sink_index(OutputSink *out, ThreadBuffer *buf, uint64_t base) {
+    if (out->nrows + buf->nnotes > out->caprows) {
+        size_t cap = out->caprows ? out->caprows * 2 : 65536;
+        while (cap < out->nrows + buf->nnotes) cap *= 2;
+        IndexNote *grown = realloc(out->rows, cap * sizeof(IndexNote));
+        if (!grown) {
+            indexFailed = 1;
+            buf->nnotes = 0;
+            return;
+        }
+        out->rows = grown;
+        out->caprows = cap;
+    }
+    for (size_t i = 0; i < buf->nnotes; i++) {
+        IndexNote *r = &out->rows[out->nrows++];
+        r->ino = buf->notes[i].ino;
+        r->dev = buf->notes[i].dev;
+        r->loc = out->compress ? base << INDEX_FRAME_SHIFT | buf->notes[i].loc
+                               : base + buf->notes[i].loc;
+    }
+    buf->nnotes = 0;
+}
+
+static void flush_buffer(ThreadBuffer *buf) {
+    if (buf->used == 0) return;
+
+    OutputSink *out = &sinks[buf->sink];
+
+    if (out->compress) {
+        /* Every flush is an independent frame of whole records, compressed
+         * before taking the lock; readers can decompress frames in parallel */
+        char compressed[FRAME_BOUND];
+        size_t n = compress_frame(buf, out->compress, compressed, sizeof(compressed),
+                                  buf->csv_buffer, buf->used);
+        pthread_mutex_lock(&out->lock);
+        if (n) {
+            if (buf->nnotes) sink_index(out, buf, (uint64_t)ftello(out->file));
+            fwrite(compressed, 1, n, out->file);
+        } else {
+            out->failed = 1;  /* write_csv() raises */
+        }
+        pthread_mutex_unlock(&out->lock);
+        buf->used = 0;
+        buf->nnotes = 0;
+        return;
+    }
+
+    pthread_mutex_lock(&out->lock);
+    if (buf->nnotes) sink_index(out, buf, (uint64_t)ftello(out->file));
+    fwrite(buf->csv_buffer, 1, buf->used, out->file);
+    buf->used = 0;
+    pthread_mutex_unlock(&out->lock);
+}
+
+/* FNV-1a hash of a NUL-terminated name */
+static uint64_t name_hash(const char *s) {
+    uint64_t h = 14695981039346656037ULL;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* splitmix64 finalizer: spreads every input bit over the whole word */
+static inline uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/* Path index key of a path: repeated and trailing slashes are ignored, so
+ * "/data//a/" and "/data/a" (the spelling of a scan of "/data/") match */
+static uint64_t path_key(const char *s) {
+    uint64_t h = 14695981039346656037ULL;
+    for (; *s; s++) {
+        if (*s == '/' && (s[1] == '/' || (s[1] == '\0' && h != 14695981039346656037ULL)))
+            continue;
+        h ^= (unsigned char)*s;
+        h *= 1099511628211ULL;
+    }
+    return mix64(h);
+}
+
+static int skip_name(const char *name) {
+    if (!skipSet) return 0;
+    size_t i = name_hash(name) & skipMask;
+    while (skipSet[i]) {
+        if (strcmp(skipSet[i], name) == 0) return 1;
+        i = (i + 1) & skipMask;
+    }
+    return 0;
+}
+
+static void free_skipset(void) {
+    if (!skipSet) return;
+    for (size_t i = 0; i <= skipMask; i++) free(skipSet[i]);
+    free(skipSet);
+    skipSet = NULL;
+    skipMask = 0;
+}
+
+/* Build the skip set from a Python sequence of names (str or bytes) */
+static int build_skipset(PyObject *names) {
+    /* A single name is a one-name set, not a sequence of characters */
+    PyObject *seq = PyUnicode_Check(names) || PyBytes_Check(names)
+                        ? Py_BuildValue("(O)", names)
+                        : PySequence_Fast(names, "skip_names must be a sequence");
+    if (!seq) return -1;
+
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    size_t size = 8;
+    while (size < (size_t)n * 2) size <<= 1;
+
+    free_skipset();
+    skipSet = calloc(size, sizeof(char *));
+    if (!skipSet) {
+        Py_DECREF(seq);
+        PyErr_NoMemory();
+        return -1;
+    }
+    skipMask = size - 1;
+
+    for (Py_ssize_t k = 0; k < n; k++) {
+        PyObject *bytes = NULL;
+        if (!PyUnicode_FSConverter(PySequence_Fast_GET_ITEM(seq, k), &bytes)) {
+            Py_DECREF(seq);
+            free_skipset();
+            return -1;
+        }
+        const char *name = PyBytes_AS_STRING(bytes);
+        if (!skip_name(name)) {
+            size_t i = name_hash(name) & skipMask;
+            while (skipSet[i]) i = (i + 1) & skipMask;
+            skipSet[i] = strdup(name);
+        }
+        Py_DECREF(bytes);
+    }
+    Py_DECREF(seq);
+    return 0;
+}
+
+static void strlist_add(StrList *l, const char *item) {
+    pthread_mutex_lock(&l->lock);
+    if (l->n == l->cap) {
+        size_t ncap = l->cap ? l->cap * 2 : 16;
+        char **grown = realloc(l->items, ncap * sizeof(char *));
+        if (grown) {
+            l->items = grown;
+            l->cap = ncap;
+        }
+    }
+    if (l->n < l->cap) {
+        char *copy = strdup(item);
+        if (copy) l->items[l->n++] = copy;
+    }
+    pthread_mutex_unlock(&l->lock);
+}
+
+static void strlist_free(StrList *l) {
+    for (size_t i = 0; i < l->n; i++) free(l->items[i]);
+    free(l->items);
+    l->items = NULL;
+    l->n = l->cap = 0;
+}
+
+/* Move the list into a new Python list of str */
+static PyObject *strlist_to_py(StrList *l) {
+    PyObject *list = PyList_New(0);
+    for (size_t i = 0; list && i < l->n; i++) {
+        PyObject *p = PyUnicode_DecodeFSDefault(l->items[i]);
+        if (!p || PyList_Append(list, p) < 0) Py_CLEAR(list);
+        Py_XDECREF(p);
+    }
+    strlist_free(l);
+    return list;
+}
+
+/* Remember a path that could not be read, with the reason */
+static void record_error(const char *path, int err) {
+    char msg[MAXPATH + 128];
+    snprintf(msg, sizeof(msg), "%s: %s", path, strerror(err));
+    strlist_add(&errorList, msg);
+}
+
+static uint64_t inode_hash(uint64_t dev, uint64_t ino) {
+    uint64_t h = (ino ^ (dev * 0x9e3779b97f4a7c15ULL)) * 0xbf58476d1ce4e5b9ULL;
+    return h ^ (h >> 31);
+}
+
+/* Add (dev, ino) to the seen set; returns 1 if it was already there */
+static int inode_seen(dev_t dev, ino_t ino) {
+    uint64_t h = inode_hash(dev, ino);
+    InodeShard *sh = &seenInodes[h % INODE_SHARDS];
+    int found = 0;
+
+    pthread_mutex_lock(&sh->lock);
+    if (2 * (sh->n + 1) > sh->mask + 1) {
+        /* Grow to keep the load factor under 1/2 */
+        size_t ncap = sh->keys ? 2 * (sh->mask + 1) : 1024;
+        uint64_t (*keys)[2] = calloc(ncap, sizeof(*keys));
+        if (!keys) {
+            pthread_mutex_unlock(&sh->lock);
+            return 0;  /* out of memory: count the link again */
+        }
+        for (size_t i = 0; sh->keys && i <= sh->mask; i++) {
+            if (!sh->keys[i][1]) continue;
+            size_t j = (inode_hash(sh->keys[i][0], sh->keys[i][1]) / INODE_SHARDS) & (ncap - 1);
+            while (keys[j][1]) j = (j + 1) & (ncap - 1);
+            keys[j][0] = sh->keys[i][0];
+            keys[j][1] = sh->keys[i][1];
+        }
+        free(sh->keys);
+        sh->keys = keys;
+        sh->mask = ncap - 1;
+    }
+    size_t i = (h / INODE_SHARDS) & sh->mask;
+    while (sh->keys[i][1]) {
+        if (sh->keys[i][0] == (uint64_t)dev && sh->keys[i][1] == (uint64_t)ino) {
+            found = 1;
+            break;
+        }
+        i = (i + 1) & sh->mask;
+    }
+    if (!found) {
+        sh->keys[i][0] = dev;
+        sh->keys[i][1] = ino;
+        sh->n++;
+    }
+    pthread_mutex_unlock(&sh->lock);
+    return found;
+}
+
+static void free_seen_inodes(void) {
+    for (int i = 0; i < INODE_SHARDS; i++) {
+        free(seenInodes[i].keys);
+        seenInodes[i].keys = NULL;
+        seenInodes[i].n = seenInodes[i].mask = 0;
+    }
+}
+
+/* Bytes an entry adds to its directory's du total */
+static uint64_t du_usage(const struct stat *st) {
+    if (!DUCOUNTLINKS && !S_ISDIR(st->st_mode) && st->st_nlink > 1 &&
+        inode_seen(st->st_dev, st->st_ino))
+        return 0;
+    return DUAPPARENT ? (uint64_t)st->st_size : (uint64_t)st->st_blocks * 512;
+}
+
+static void du_record(const char *path, uint64_t bytes, int64_t newest) {
+    pthread_mutex_lock(&mutexTotals);
+    if (duCnt == duCap) {
+        size_t ncap = duCap ? duCap * 2 : 256;
+        DuTotal *grown = realloc(duTotals, ncap * sizeof(DuTotal));
+        if (grown) {
+            duTotals = grown;
+            duCap = ncap;
+        }
+    }
+    if (duCnt < duCap && (duTotals[duCnt].path = strdup(path)) != NULL) {
+        duTotals[duCnt].newest = newest;
+        duTotals[duCnt++].bytes = bytes;
+    }
+    pthread_mutex_unlock(&mutexTotals);
+}
+
+static void free_du_totals(void) {
+    for (size_t i = 0; i < duCnt; i++) free(duTotals[i].path);
+    free(duTotals);
+    duTotals = NULL;
+    duCnt = duCap = 0;
+}
+
+/* Byte-scanning kernels behind CSV escaping and parsing. Each has a
+ * scalar version plus SSE2, AVX2 and AVX-512 variants compiled with
+ * target attributes, so the module is built for the baseline ISA and
+ * simd_init() picks the widest the CPU supports via cpuid at import.
+ * PWALK_SIMD=scalar|sse2|avx2|avx512 caps the choice. */
+#define SIMD_SCALAR 0
+#define SIMD_SSE2   1
+#define SIMD_AVX2   2
+#define SIMD_AVX512 3
+static const char *simdNames[] = {"scalar", "sse2", "avx2", "avx512"};
+static int SIMDLEVEL = SIMD_SCALAR;
+
+/* Length of s up to its first '"' or NUL */
+static size_t quote_span_scalar(const char *s) {
+    const char *p = s;
+    while (*p && *p != '"') p++;
+    return p - s;
+}
+
+/* First byte in [p, end) equal to a or b, or end */
+static const char *find2_scalar(const char *p, const char *end, char a, char b) {
+    while (p < end && *p != a && *p != b) p++;
+    return p;
+}
+
+#ifdef PW_X86
+/* The quote_span variants only issue aligned loads, which never cross a
+ * page boundary, so reading past the NUL is safe; bits for the bytes
+ * before s are shifted out of the first mask. The loads still reach past
+ * the object, so they are not instrumented by AddressSanitizer. */
+__attribute__((target("sse2"), no_sanitize_address))
+static size_t quote_span_sse2(const char *s) {
+    const __m128i q = _mm_set1_epi8('"'), z = _mm_setzero_si128();
+    unsigned off = (uintptr_t)s & 15;
+    const char *p = s - off;
+    __m128i v = _mm_load_si128((const __m128i *)p);
+    unsigned m = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, q),
+                                                          _mm_cmpeq_epi8(v, z))) >> off;
+    if (m) return __builtin_ctz(m);
+    for (;;) {
+        p += 16;
+        v = _mm_load_si128((const __m128i *)p);
+        m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, q), _mm_cmpeq_epi8(v, z)));
+        if (m) return p + __builtin_ctz(m) - s;
+    }
+}
+
+__attribute__((target("avx2"), no_sanitize_address))
+static size_t quote_span_avx2(const char *s) {
+    const __m256i q = _mm256_set1_epi8('"'), z = _mm256_setzero_si256();
+    unsigned off = (uintptr_t)s & 31;
+    const char *p = s - off;
+    __m256i v = _mm256_load_si256((const __m256i *)p);
+    uint32_t m = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, q),
+                                                                _mm256_cmpeq_epi8(v, z))) >> off;
+    if (m) return __builtin_ctz(m);
+    for (;;) {
+        p += 32;
+        v = _mm256_load_si256((const __m256i *)p);
+        m = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, q),
+                                                 _mm256_cmpeq_epi8(v, z)));
+        if (m) return p + __builtin_ctz(m) - s;
+    }
+}
+
+__attribute__((target("avx512f,avx512bw"), no_sanitize_address))
+static size_t quote_span_avx512(const char *s) {
+    const __m512i q = _mm512_set1_epi8('"');
+    unsigned off = (uintptr_t)s & 63;
+    const char *p = s - off;
+    __m512i v = _mm512_load_si512((const void *)p);
+    uint64_t m = (_mm512_cmpeq_epi8_mask(v, q) | _mm512_testn_epi8_mask(v, v)) >> off;
+    if (m) return __builtin_ctzll(m);
+    for (;;) {
+        p += 64;
+        v = _mm512_load_si512((const void *)p);
+        m = _mm512_cmpeq_epi8_mask(v, q) | _mm512_testn_epi8_mask(v, v);
+        if (m) return p + __builtin_ctzll(m) - s;
+    }
+}
+
+__attribute__((target("sse2")))
+static const char *find2_sse2(const char *p, const char *end, char a, char b) {
+    const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        unsigned m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+        if (m) return p + __builtin_ctz(m);
+    }
+    return find2_scalar(p, end, a, b);
+}
+
+__attribute__((target("avx2")))
+static const char *find2_avx2(const char *p, const char *end, char a, char b) {
+    const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+    for (; end - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        uint32_t m = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va),
+                                                          _mm256_cmpeq_epi8(v, vb)));
+        if (m) return p + __builtin_ctz(m);
+    }
+    return find2_scalar(p, end, a, b);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static const char *find2_avx512(const char *p, const char *end, char a, char b) {
+    const __m512i va = _mm512_set1_epi8(a), vb = _mm512_set1_epi8(b);
+    for (; end - p >= 64; p += 64) {
+        __m512i v = _mm512_loadu_si512((const void *)p);
+        uint64_t m = _mm512_cmpeq_epi8_mask(v, va) | _mm512_cmpeq_epi8_mask(v, vb);
+        if (m) return p + __builtin_ctzll(m);
+    }
+    if (p < end) {
+        /* Masked load for the tail: no bytes past end are touched */
+        __mmask64 k = ~0ULL >> (64 - (end - p));
+        __m512i v = _mm512_maskz_loadu_epi8(k, (const void *)p);
+        uint64_t m = (_mm512_cmpeq_epi8_mask(v, va) | _mm512_cmpeq_epi8_mask(v, vb)) & k;
+        return m ? p + __builtin_ctzll(m) : end;
+    }
+    return p;
+}
+#endif
+
+static size_t (*quote_span)(const char *s) = quote_span_scalar;
+static const char *(*find2)(const char *p, const char *end, char a, char b) = find2_scalar;
+
+static void simd_init(void) {
+    int level = SIMD_SCALAR;
+#ifdef PW_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) level = SIMD_SSE2;
+    if (__builtin_cpu_supports("avx2")) level = SIMD_AVX2;
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        level = SIMD_AVX512;
+#endif
+    const char *cap = getenv("PWALK_SIMD");
+    if (cap) {
+        for (int i = 0; i <= SIMD_AVX512; i++)
+            if (strcmp(cap, simdNames[i]) == 0 && i < level) level = i;
+    }
+    SIMDLEVEL = level;
+#ifdef PW_X86
+    switch (level) {
+    case SIMD_AVX512:
+        quote_span = quote_span_avx512;
+        find2 = find2_avx512;
+        break;
+    case SIMD_AVX2:
+        quote_span = quote_span_avx2;
+        find2 = find2_avx2;
+        break;
+    case SIMD_SSE2:
+        quote_span = quote_span_sse2;
+        find2 = find2_sse2;
+        break;
+    }
+#endif
+}
+
+/* CSV escape */
+static void csv_escape(const char *in, char *out) {
+    for (;;) {
+        size_t n = quote_span(in);
+        memcpy(out, in, n);
+        out += n;
+        in += n;
+        if (!*in) break;
+        *out++ = '"';
+        *out++ = '"';
+        in++;
+    }
+    *out = '\0';
+}
+
+/* lstat() replacement: with ns timestamps on, a single statx() call also
+ * returns the birth time. btime->tv_sec is -1 when it is not available. */
+static int pw_lstat(const char *path, struct stat *st, struct timespec *btime) {
+    btime->tv_sec = -1;
+    btime->tv_nsec = 0;
+#ifdef STATX_BTIME
+    if (NSTIMES) {
+        struct statx sx;
+        if (statx(AT_FDCWD, path, AT_SYMLINK_NOFOLLOW | AT_STATX_SYNC_AS_STAT,
+                  STATX_BASIC_STATS | STATX_BTIME, &sx) == -1)
+            return -1;
+
+        memset(st, 0, sizeof(*st));
+        st->st_dev = makedev(sx.stx_dev_major, sx.stx_dev_minor);
+        st->st_ino = sx.stx_ino;
+        st->st_mode = sx.stx_mode;
+        st->st_nlink = sx.stx_nlink;
+        st->st_uid = sx.stx_uid;
+        st->st_gid = sx.stx_gid;
+        st->st_rdev = makedev(sx.stx_rdev_major, sx.stx_rdev_minor);
+        st->st_size = sx.stx_size;
+        st->st_blksize = sx.stx_blksize;
+        st->st_blocks = sx.stx_blocks;
+        st->st_atim.tv_sec = sx.stx_atime.tv_sec;
+        st->st_atim.tv_nsec = sx.stx_atime.tv_nsec;
+        st->st_mtim.tv_sec = sx.stx_mtime.tv_sec;
+        st->st_mtim.tv_nsec = sx.stx_mtime.tv_nsec;
+        st->st_ctim.tv_sec = sx.stx_ctime.tv_sec;
+        st->st_ctim.tv_nsec = sx.stx_ctime.tv_nsec;
+        if (sx.stx_mask & STATX_BTIME) {
+            btime->tv_sec = sx.stx_btime.tv_sec;
+            btime->tv_nsec = sx.stx_btime.tv_nsec;
+        }
+        return 0;
+    }
+#endif
+    return lstat(path, st);
+}
+
+static inline long long ts_ns(const struct timespec *ts) {
+    return (long long)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+/* ACL-bearing xattrs: POSIX access/default ACLs and NFSv4 ACLs */
+static int is_acl_xattr(const char *name) {
+    return strcmp(name, "system.posix_acl_access") == 0 ||
+           strcmp(name, "system.posix_acl_default") == 0 ||
+           strcmp(name, "system.nfs4_acl") == 0;
+}
+
+/* Format the optional xattr columns for path: one llistxattr() call returns
+ * all names at once; values are never read. */
+static int format_xattrs(char *out, size_t size, const char *path) {
+    char stackbuf[4096], *list = stackbuf;
+    char names[XATTR_NAMES_MAX], esc[XATTR_NAMES_MAX * 2];
+    ssize_t len = llistxattr(path, list, sizeof(stackbuf));
+    int has_acl = 0;
+    size_t used = 0;
+
+    if (len < 0 && errno == ERANGE) {
+        ssize_t need = llistxattr(path, NULL, 0);
+        list = need > 0 ? malloc(need) : NULL;
+        len = list ? llistxattr(path, list, need) : -1;
+    }
+
+    names[0] = '\0';
+    for (ssize_t i = 0; i < len; i += strlen(list + i) + 1) {
+        const char *name = list + i;
+        if (is_acl_xattr(name)) has_acl = 1;
+        if (XATTRS == XATTR_ALL) {
+            size_t n = strlen(name);
+            if (used + n + 2 > sizeof(names)) break;
+            if (used) names[used++] = ';';
+            memcpy(names + used, name, n + 1);
+            used += n;
+        }
+    }
+    if (list != stackbuf) free(list);
+
+    if (XATTRS == XATTR_ALL) {
+        csv_escape(names, esc);
+        return snprintf(out, size, ",%d,\"%s\"", has_acl, esc);
+    }
+    return snprintf(out, size, ",%d", has_acl);
+}
+
+/* uid/gid -> name cache shared by all workers (open addressing) */
+typedef struct {
+    uint32_t id;
+    char *name;   /* NULL: empty slot */
+} NameSlot;
+
+typedef struct {
+    NameSlot *slots;
+    size_t mask, n;
+} NameTable;
+
+static NameTable userNames, groupNames;
+static pthread_rwlock_t namesLock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* Records whose names were not cached yet, completed by the resolver */
+typedef struct Deferred {
+    struct Deferred *next;
+    uid_t uid;
+    gid_t gid;
+    int sink;
+    size_t len;
+    char line[];
+} Deferred;
+
+static struct {
+    Deferred *head, *tail;
+    int done;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} resolver = { NULL, NULL, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+static ThreadBuffer resolverBuf;
+
+/* Caller holds namesLock */
+static const char *name_lookup(const NameTable *t, uint32_t id) {
+    if (!t->slots) return NULL;
+    size_t i = (id * 2654435761U) & t->mask;
+    while (t->slots[i].name) {
+        if (t->slots[i].id == id) return t->slots[i].name;
+        i = (i + 1) & t->mask;
+    }
+    return NULL;
+}
+
+/* Caller holds namesLock for writing; takes ownership of name */
+static void name_insert(NameTable *t, uint32_t id, char *name) {
+    if (!name) return;
+    if ((t->n + 1) * 2 > t->mask + 1 || !t->slots) {
+        size_t size = t->slots ? (t->mask + 1) * 2 : 256;
+        NameSlot *slots = calloc(size, sizeof(NameSlot));
+        if (!slots) {
+            free(name);
+            return;
+        }
+        for (size_t k = 0; t->slots && k <= t->mask; k++) {
+            if (!t->slots[k].name) continue;
+            size_t i = (t->slots[k].id * 2654435761U) & (size - 1);
+            while (slots[i].name) i = (i + 1) & (size - 1);
+            slots[i] = t->slots[k];
+        }
+        free(t->slots);
+        t->slots = slots;
+        t->mask = size - 1;
+    }
+    size_t i = (id * 2654435761U) & t->mask;
+    while (t->slots[i].name) i = (i + 1) & t->mask;
+    t->slots[i].id = id;
+    t->slots[i].name = name;
+    t->n++;
+}
+
+static void name_table_free(NameTable *t) {
+    for (size_t k = 0; t->slots && k <= t->mask; k++) free(t->slots[k].name);
+    free(t->slots);
+    t->slots = NULL;
+    t->mask = t->n = 0;
+}
+
+/* NSS lookup; unknown ids resolve to the number, like ls -l */
+static char *resolve_name(int is_group, uint32_t id) {
+    char stackbuf[16384], *buf = stackbuf, *name = NULL;
+    size_t size = sizeof(stackbuf);
+    int rc;
+
+    for (;;) {
+        if (is_group) {
+            struct group gr, *res = NULL;
+            rc = getgrgid_r(id, &gr, buf, size, &res);
+            if (rc == 0 && res) name = strdup(res->gr_name);
+        } else {
+            struct passwd pw, *res = NULL;
+            rc = getpwuid_r(id, &pw, buf, size, &res);
+            if (rc == 0 && res) name = strdup(res->pw_name);
+        }
+        if (rc != ERANGE || size >= (1 << 22)) break;
+        size *= 2;
+        char *grown = realloc(buf == stackbuf ? NULL : buf, size);
+        if (!grown) break;
+        buf = grown;
+    }
+    if (buf != stackbuf) free(buf);
+
+    if (!name) {
+        char num[16];
+        snprintf(num, sizeof(num), "%u", id);
+        name = strdup(num);
+    }
+    return name;
+}
+
+/* Append the quoted user and group columns if both names are cached and
+ * fit in size; escaped straight into line, so names of any length work */
+static int append_names(char *line, int *len, size_t size, uid_t uid, gid_t gid) {
+    int found = 0;
+
+    pthread_rwlock_rdlock(&namesLock);
+    const char *user = name_lookup(&userNames, uid);
+    const char *group = name_lookup(&groupNames, gid);
+    if (user && group && *len + 2 * (strlen(user) + strlen(group)) + 6 <= size) {
+        char *out = line + *len;
+        *out++ = ',';
+        *out++ = '"';
+        csv_escape(user, out);
+        out += strlen(out);
+        memcpy(out, "\",\"", 3);
+        out += 3;
+        csv_escape(group, out);
+        out += strlen(out);
+        *out++ = '"';
+        *len = (int)(out - line);
+        found = 1;
+    }
+    pthread_rwlock_unlock(&namesLock);
+    return found;
+}
+
+/* Bytes append_names() or append_ids() may add for uid and gid */
+static size_t names_room(uid_t uid, gid_t gid) {
+    size_t room = 32;
+
+    pthread_rwlock_rdlock(&namesLock);
+    const char *user = name_lookup(&userNames, uid);
+    const char *group = name_lookup(&groupNames, gid);
+    if (user && group) room += 2 * (strlen(user) + strlen(group));
+    pthread_rwlock_unlock(&namesLock);
+    return room;
+}
+
+/* Grow a heap line buffer to at least need bytes; -1 if out of memory */
+static int line_reserve(char **line, size_t *cap, size_t need) {
+    if (need <= *cap) return 0;
+    size_t ncap = *cap ? *cap : MAXPATH * 4 + 1024;
+    while (ncap < need) ncap *= 2;
+    char *grown = realloc(*line, ncap);
+    if (!grown) return -1;
+    *line = grown;
+    *cap = ncap;
+    return 0;
+}
+
+/* st_dev of a record: its ninth field, after the two quoted name fields */
+static uint64_t record_dev(const char *p, const char *end) {
+    for (int field = 0; field < 8 && p < end; field++, p++) {
+        if (*p == '"') {
+            for (p++; p < end && !(*p == '"' && (p + 1 == end || p[1] != '"')); p++)
+                if (*p == '"') p++;
+            p++;
+        }
+        while (p < end && *p != ',') p++;
+    }
+    return p < end ? strtoull(p, NULL, 10) : 0;
+}
+
+/* Index mode: note the inode (leading field), device and buffer offset of a record */
+static void index_note(ThreadBuffer *buf, const char *line, size_t len) {
+    if (buf->nnotes == buf->capnotes) {
+        size_t cap = buf->capnotes ? buf->capnotes * 2 : 4096;
+        IndexNote *grown = realloc(buf->notes, cap * sizeof(IndexNote));
+        if (!grown) {
+            indexFailed = 1;
+            return;
+        }
+        buf->notes = grown;
+        buf->capnotes = cap;
+    }
+    buf->notes[buf->nnotes].ino = strtoull(line, NULL, 10);
+    buf->notes[buf->nnotes].dev = record_dev(line, line + len);
+    buf->notes[buf->nnotes++].loc = buf->used;
+}
+
+/* Index mode: remember the hash of a recorded path for the Bloom filter */
+static void index_path(ThreadBuffer *buf, int sink, const char *path) {
+    if (buf->npaths == buf->cappaths) {
+        size_t cap = buf->cappaths ? buf->cappaths * 2 : 4096;
+        PathNote *grown = realloc(buf->paths, cap * sizeof(PathNote));
+        if (!grown) {
+            indexFailed = 1;
+            return;
+        }
+        buf->paths = grown;
+        buf->cappaths = cap;
+    }
+    buf->paths[buf->npaths].key = path_key(path);
+    buf->paths[buf->npaths++].sink = sink;
+}
+
+static void buffer_append(ThreadBuffer *buf, int sink, const char *line, size_t len) {
+    if (buf->used + len >= BUFFER_SIZE || (buf->used && buf->sink != sink)) {
+        flush_buffer(buf);
+    }
+    buf->sink = sink;
+    if (INDEXING) index_note(buf, line, len);
+    memcpy(buf->csv_buffer + buf->used, line, len);
+    buf->used += len;
+}
+
+/* Name columns holding the ids themselves, for ids without a name */
+static void append_ids(char *line, int *len, size_t size, uid_t uid, gid_t gid) {
+    *len += snprintf(line + *len, size - *len, ",\"%u\",\"%u\"", (unsigned)uid, (unsigned)gid);
+}
+
+/* Hand a record with uncached names to the resolver instead of blocking;
+ * -1 if out of memory, the caller then writes it with append_ids() */
+static int defer_record(const char *line, size_t len, uid_t uid, gid_t gid, int sink) {
+    Deferred *r = malloc(sizeof(Deferred) + len);
+    if (!r) return -1;
+    r->next = NULL;
+    r->uid = uid;
+    r->gid = gid;
+    r->sink = sink;
+    r->len = len;
+    memcpy(r->line, line, len);
+
+    pthread_mutex_lock(&resolver.lock);
+    if (resolver.tail) resolver.tail->next = r;
+    else resolver.head = r;
+    resolver.tail = r;
+    pthread_cond_signal(&resolver.cond);
+    pthread_mutex_unlock(&resolver.lock);
+    return 0;
+}
+
+/* Resolver thread: the only caller of NSS, so each distinct id is looked
+ * up once per scan and an LDAP/SSSD stall never blocks the workers */
+static void *resolver_main(void *arg) {
+    char *line = NULL;
+    size_t cap = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&resolver.lock);
+        while (!resolver.head && !resolver.done)
+            pthread_cond_wait(&resolver.cond, &resolver.lock);
+        Deferred *batch = resolver.head;
+        resolver.head = resolver.tail = NULL;
+        int done = resolver.done;
+        pthread_mutex_unlock(&resolver.lock);
+
+        if (!batch && done) break;
+
+        while (batch) {
+            Deferred *r = batch;
+            batch = r->next;
+
+            pthread_rwlock_rdlock(&namesLock);
+            int need_user = !name_lookup(&userNames, r->uid);
+            int need_group = !name_lookup(&groupNames, r->gid);
+            pthread_rwlock_unlock(&namesLock);
+
+            char *user = need_user ? resolve_name(0, r->uid) : NULL;
+            char *group = need_group ? resolve_name(1, r->gid) : NULL;
+            if (user || group) {
+                pthread_rwlock_wrlock(&namesLock);
+                name_insert(&userNames, r->uid, user);
+                name_insert(&groupNames, r->gid, group);
+                pthread_rwlock_unlock(&namesLock);
+            }
+
+            if (line_reserve(&line, &cap, r->len + names_room(r->uid, r->gid) + 1) != 0) {
+                record_error("name resolver", ENOMEM);
+                free(r);
+                continue;
+            }
+            int len = (int)r->len;
+            memcpy(line, r->line, len);
+            if (!append_names(line, &len, cap - 1, r->uid, r->gid))
+                append_ids(line, &len, cap - 1, r->uid, r->gid);
+            line[len++] = '\n';
+            buffer_append(&resolverBuf, r->sink, line, len);
+            free(r);
+        }
+    }
+    free(line);
+    flush_buffer(&resolverBuf);
+    return NULL;
+}
+
+/* XXH64 (Yann Collet's xxHash, 64-bit variant), streaming */
+#define XXH_P1 11400714785074694791ULL
+#define XXH_P2 14029467366897019727ULL
+#define XXH_P3 1609587929392839161ULL
+#define XXH_P4 9650029242287828579ULL
+#define XXH_P5 2870177450012600261ULL
+
+typedef struct {
+    uint64_t total, v[4];
+    unsigned char buf[32];
+    size_t bufLen;
+} Xxh64;
+
+static inline uint64_t xxh_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh_read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_P2;
+    return xxh_rotl(acc, 31) * XXH_P1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t v) {
+    acc ^= xxh_round(0, v);
+    return acc * XXH_P1 + XXH_P4;
+}
+
+static void xxh64_init(Xxh64 *h) {
+    memset(h, 0, sizeof(*h));
+    h->v[0] = XXH_P1 + XXH_P2;
+    h->v[1] = XXH_P2;
+    h->v[2] = 0;
+    h->v[3] = -XXH_P1;
+}
+
+static void xxh64_stripes(Xxh64 *h, const unsigned char *p, size_t n) {
+    uint64_t v0 = h->v[0], v1 = h->v[1], v2 = h->v[2], v3 = h->v[3];
+    for (; n >= 32; p += 32, n -= 32) {
+        v0 = xxh_round(v0, xxh_read64(p));
+        v1 = xxh_round(v1, xxh_read64(p + 8));
+        v2 = xxh_round(v2, xxh_read64(p + 16));
+        v3 = xxh_round(v3, xxh_read64(p + 24));
+    }
+    h->v[0] = v0, h->v[1] = v1, h->v[2] = v2, h->v[3] = v3;
+}
+
+static void xxh64_update(Xxh64 *h, const unsigned char *p, size_t n) {
+    h->total += n;
+    if (h->bufLen + n < 32) {
+        memcpy(h->buf + h->bufLen, p, n);
+        h->bufLen += n;
+        return;
+    }
+    if (h->bufLen) {
+        size_t fill = 32 - h->bufLen;
+        memcpy(h->buf + h->bufLen, p, fill);
+        xxh64_stripes(h, h->buf, 32);
+        p += fill;
+        n -= fill;
+        h->bufLen = 0;
+    }
+    xxh64_stripes(h, p, n & ~(size_t)31);
+    memcpy(h->buf, p + (n & ~(size_t)31), n & 31);
+    h->bufLen = n & 31;
+}
+
+static uint64_t xxh64_digest(const Xxh64 *h) {
+    uint64_t r;
+    if (h->total >= 32) {
+        r = xxh_rotl(h->v[0], 1) + xxh_rotl(h->v[1], 7) + xxh_rotl(h->v[2], 12) +
+            xxh_rotl(h->v[3], 18);
+        for (int i = 0; i < 4; i++) r = xxh_merge(r, h->v[i]);
+    } else {
+        r = XXH_P5;
+    }
+    r += h->total;
+
+    const unsigned char *p = h->buf, *end = h->buf + h->bufLen;
+    for (; end - p >= 8; p += 8) r = xxh_rotl(r ^ xxh_round(0, xxh_read64(p)), 27) * XXH_P1 + XXH_P4;
+    if (end - p >= 4) {
+        uint32_t k;
+        memcpy(&k, p, 4);
+        r = xxh_rotl(r ^ (k * XXH_P1), 23) * XXH_P2 + XXH_P3;
+        p += 4;
+    }
+    for (; p < end; p++) r = xxh_rotl(r ^ (*p * XXH_P5), 11) * XXH_P1;
+
+    r ^= r >> 33;
+    r *= XXH_P2;
+    r ^= r >> 29;
+    r *= XXH_P3;
+    return r ^ (r >> 32);
+}
+
+/* Records of regular files waiting for their checksum */
+typedef struct HashJob {
+    struct HashJob *next;
+    uid_t uid;
+    gid_t gid;
+    int sink;
+    size_t len;        /* record without the checksum column */
+    char line[];       /* record, then the NUL-terminated path */
+} HashJob;
+
+static struct {
+    HashJob *head, *tail;
+    size_t n;
+    int done;
+    int readers;       /* running reader threads; the queue is unbounded without them */
+    double next;       /* bandwidth cap: earliest start of the next read */
+    pthread_mutex_t lock;
+    pthread_cond_t cond, space;
+} hasher = { NULL, NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+             PTHREAD_COND_INITIALIZER };
+static ThreadBuffer hashBufs[CHECKSUM_MAX];
+
+/* Queue a regular file's record for a reader thread to checksum; -1 if
+ * out of memory, the caller then writes it without a checksum */
+static int defer_checksum(const char *line, size_t len, const char *path, uid_t uid,
+                          gid_t gid, int sink) {
+    size_t plen = strlen(path) + 1;
+    HashJob *j = malloc(sizeof(HashJob) + len + plen);
+    if (!j) return -1;
+    j->next = NULL;
+    j->uid = uid;
+    j->gid = gid;
+    j->sink = sink;
+    j->len = len;
+    memcpy(j->line, line, len);
+    memcpy(j->line + len, path, plen);
+
+    pthread_mutex_lock(&hasher.lock);
+    while (hasher.n >= CHECKSUM_QUEUE && hasher.readers) pthread_cond_wait(&hasher.space, &hasher.lock);
+    if (hasher.tail) hasher.tail->next = j;
+    else hasher.head = j;
+    hasher.tail = j;
+    hasher.n++;
+    pthread_cond_signal(&hasher.cond);
+    pthread_mutex_unlock(&hasher.lock);
+    return 0;
+}
+
+static double mono_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Pace the readers to CHECKSUMBW bytes per second in total */
+static void io_throttle(size_t n) {
+    if (CHECKSUMBW <= 0) return;
+    double now = mono_seconds();
+    pthread_mutex_lock(&hasher.lock);
+    if (hasher.next < now) hasher.next = now;
+    double wait = hasher.next - now;
+    hasher.next += n / CHECKSUMBW;
+    pthread_mutex_unlock(&hasher.lock);
+    if (wait > 0) {
+        struct timespec ts = { (time_t)wait, (long)((wait - (time_t)wait) * 1e9) };
+        nanosleep(&ts, NULL);
+    }
+}
+
+/* XXH64 of a file's content in large sequential reads that are dropped
+ * from the page cache behind us (or bypass it with O_DIRECT) and leave
+ * atime alone where permitted. Returns 0 or an errno value. */
+static int checksum_file(const char *path, unsigned char *chunk, uint64_t *digest) {
+    int flags = O_RDONLY | O_CLOEXEC | O_NOATIME | (CHECKSUMDIRECT ? O_DIRECT : 0);
+    int fd = open(path, flags);
+    if (fd < 0 && errno == EPERM) fd = open(path, flags &= ~O_NOATIME);
+    if (fd < 0 && errno == EINVAL && (flags & O_DIRECT)) fd = open(path, flags &= ~O_DIRECT);
+    if (fd < 0) return errno;
+    if (!(flags & O_DIRECT)) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    Xxh64 h;
+    xxh64_init(&h);
+    off_t off = 0;
+    for (;;) {
+        ssize_t n = pread(fd, chunk, CHECKSUM_CHUNK, off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EINVAL && (flags & O_DIRECT)) {
+            /* No direct I/O on this filesystem: continue buffered */
+            int fd2 = open(path, flags &= ~O_DIRECT);
+            close(fd);
+            if (fd2 < 0) return errno;
+            fd = fd2;
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            continue;
+        }
+        if (n < 0) {
+            int err = errno;
+            close(fd);
+            return err;
+        }
+        if (n == 0) break;
+        xxh64_update(&h, chunk, n);
+        if (!(flags & O_DIRECT)) posix_fadvise(fd, off, n, POSIX_FADV_DONTNEED);
+        off += n;
+        io_throttle(n);
+        /* O_DIRECT reads at the unaligned end-of-file offset fail */
+        if ((flags & O_DIRECT) && n < CHECKSUM_CHUNK) break;
+    }
+    close(fd);
+    *digest = xxh64_digest(&h);
+    return 0;
+}
+
+/* Reader thread: checksum queued files and write their records */
+static void *hasher_main(void *arg) {
+    ThreadBuffer *buf = (ThreadBuffer *)arg;
+    char *line = NULL;
+    size_t cap = 0;
+    unsigned char *chunk = NULL;
+    int have_chunk = posix_memalign((void **)&chunk, 4096, CHECKSUM_CHUNK) == 0;
+
+    for (;;) {
+        pthread_mutex_lock(&hasher.lock);
+        while (!hasher.head && !hasher.done) pthread_cond_wait(&hasher.cond, &hasher.lock);
+        HashJob *j = hasher.head;
+        if (j) {
+            hasher.head = j->next;
+            if (!hasher.head) hasher.tail = NULL;
+            hasher.n--;
+            pthread_cond_signal(&hasher.space);
+        }
+        pthread_mutex_unlock(&hasher.lock);
+        if (!j) break;
+
+        const char *path = j->line + j->len;
+        uint64_t digest = 0;
+        int err = have_chunk ? checksum_file(path, chunk, &digest) : ENOMEM;
+        if (line_reserve(&line, &cap, j->len + 18 + names_room(j->uid, j->gid)) != 0) {
+            record_error(path, ENOMEM);
+            free(j);
+            continue;
+        }
+        int len = (int)j->len;
+        memcpy(line, j->line, len);
+        if (err) {
+            record_error(path, err);
+            line[len++] = ',';
+        } else {
+            len += snprintf(line + len, cap - 1 - len, ",%016llx", (unsigned long long)digest);
+        }
+        if (NAMES && !append_names(line, &len, cap - 1, j->uid, j->gid)) {
+            if (defer_record(line, len, j->uid, j->gid, j->sink) == 0) {
+                free(j);
+                continue;
+            }
+            record_error(path, ENOMEM);
+            append_ids(line, &len, cap - 1, j->uid, j->gid);
+        }
+        line[len++] = '\n';
+        buffer_append(buf, j->sink, line, len);
+        free(j);
+    }
+    free(line);
+    free(chunk);
+    flush_buffer(buf);
+    return NULL;
+}
+
+/* Write CSV record */
+static inline int pred_compare(int64_t x, const FindPred *p) {
+    return p->cmp < 0 ? x < p->value : p->cmp > 0 ? x > p->value : x == p->value;
+}
+
+/* Whole units between t and the start of the search, rounded down as find
+ * does: a time in the future is -1 units old, so -mtime -0 matches it */
+static inline int64_t find_age(time_t t, int64_t unit) {
+    int64_t d = (int64_t)findNow - t;
+    return d / unit - (d % unit < 0);
+}
+
+static int find_match(const char *filename, const struct stat *st) {
+    for (int i = 0; i < nFindPreds; i++) {
+        const FindPred *p = &findPreds[i];
+        int ok;
+
+        switch (p->kind) {
+        case PRED_NAME:
+        case PRED_INAME:
+            ok = fnmatch(p->pattern, filename, p->kind == PRED_INAME ? FNM_CASEFOLD : 0) == 0;
+            break;
+        case PRED_SIZE:
+            ok = pred_compare((st->st_size + p->unit - 1) / p->unit, p);
+            break;
+        case PRED_MTIME:
+            ok = pred_compare(find_age(st->st_mtime, p->unit), p);
+            break;
+        case PRED_ATIME:
+            ok = pred_compare(find_age(st->st_atime, p->unit), p);
+            break;
+        case PRED_UID:
+            ok = (int64_t)st->st_uid == p->value;
+            break;
+        case PRED_GID:
+            ok = (int64_t)st->st_gid == p->value;
+            break;
+        case PRED_TYPE:
+            ok = (int64_t)(st->st_mode & S_IFMT) == p->value;
+            break;
+        case PRED_PERM:
+            if (p->cmp == 0) ok = (int64_t)(st->st_mode & 07777) == p->value;
+            else if (p->cmp > 0) ok = ((int64_t)st->st_mode & p->value) == p->value;
+            else ok = p->value == 0 || ((int64_t)st->st_mode & p->value) != 0;
+            break;
+        case PRED_NEWER:
+            ok = ts_ns(&st->st_mtim) > p->value;
+            break;
+        default:
+            ok = 0;
+        }
+        if (!ok) return 0;
+    }
+    return 1;
+}
+
+static void ext_record(ThreadBuffer *buf, int root, const char *path, const char *ext,
+                       const struct stat *st);
+static void ext_reset(int mode);
+static PyObject *ext_collect(void);
+static void sum_record(ThreadBuffer *buf, int root, const char *path, const struct stat *st);
+static void sum_reset(void);
+static PyObject *sum_collect(void);
+
+static void write_record(ThreadBuffer *buf, int root, const char *path, struct stat *st,
+                        const struct timespec *btime, ino_t parent_inode, int depth,
+                        long fcount, long dirsum) {
+    char line[MAXPATH * 4];
+    char esc_name[MAXPATH * 2], esc_ext[256];
+
+    const char *filename = strrchr(path, '/');
+    filename = filename ? filename + 1 : path;
+
+    if (FINDMODE) {
+        if (find_match(filename, st)) {
+            size_t len = strlen(path);
+            memcpy(line, path, len);
+            line[len++] = findSep;
+            buffer_append(buf, 0, line, len);
+            __atomic_add_fetch(&findCount, 1, __ATOMIC_RELAXED);
+        }
+        return;
+    }
+
+    const char *ext = strrchr(filename, '.');
+    ext = (ext && ext > filename) ? ext + 1 : "";
+
+    if (SUMMARY) sum_record(buf, root, path, st);
+    if (EXTSTATS) ext_record(buf, root, path, ext, st);
+    if (EXTMODE) return;
+
+    csv_escape(FULLPATHS ? path : filename, esc_name);
+    csv_escape(ext, esc_ext);
+
+    int len = snprintf(line, sizeof(line),
+        "%lu,%lu,%d,\"%s\",\"%s\",%u,%u,%ld,%lu,%ld,%lu,\"%o\",%ld,%ld,%ld,%ld,%ld",
+        (unsigned long)st->st_ino, (unsigned long)parent_inode, depth,
+        esc_name, esc_ext, st->st_uid, st->st_gid, (long)st->st_size,
+        (unsigned long)st->st_dev, (long)st->st_blocks,
+        (unsigned long)st->st_nlink, st->st_mode,
+        (long)st->st_atime, (long)st->st_mtime, (long)st->st_ctime,
+        fcount, dirsum);
+
+    if (NSTIMES) {
+        len += snprintf(line + len, sizeof(line) - len, ",%lld,%lld,%lld,",
+                        ts_ns(&st->st_atim), ts_ns(&st->st_mtim), ts_ns(&st->st_ctim));
+        if (btime->tv_sec != -1)
+            len += snprintf(line + len, sizeof(line) - len, "%lld", ts_ns(btime));
+    }
+    if (XATTRS != XATTR_NONE) {
+        len += format_xattrs(line + len, sizeof(line) - len - 1, path);
+    }
+    if (ROOTIDS) {
+        len += snprintf(line + len, sizeof(line) - len, ",%d", root);
+    }
+    int sink = nsinks > 1 ? root : 0;
+    if (INDEXING) index_path(buf, sink, path);
+    if (CHECKSUM) {
+        if (S_ISREG(st->st_mode)) {
+            if (defer_checksum(line, len, path, st->st_uid, st->st_gid, sink) == 0) return;
+            /* Out of memory: keep the row, with an empty checksum */
+            record_error(path, ENOMEM);
+        }
+        line[len++] = ',';
+    }
+    if (NAMES && !append_names(line, &len, sizeof(line) - 1, st->st_uid, st->st_gid)) {
+        if (defer_record(line, len, st->st_uid, st->st_gid, sink) == 0) return;
+        /* Out of memory: keep the row, with the ids in the name columns */
+        record_error(path, ENOMEM);
+        append_ids(line, &len, sizeof(line) - 1, st->st_uid, st->st_gid);
+    }
+    line[len++] = '\n';
+
+    buffer_append(buf, sink, line, len);
+}
+
+static inline void count_level(ThreadBuffer *buf, long level) {
+    buf->depthCnt[level < MAXLEVELS ? level : MAXLEVELS - 1]++;
+}
+
+/* Count entries below the max_depth cut-off with readdir() only. The
+ * directories still to read are kept on an explicit stack, so a deep tree
+ * does not grow the worker's stack. Returns the number of entries directly
+ * inside path. */
+typedef struct {
+    char *path;
+    long level;
+} CountDir;
+
+static long count_entries(const char *path, long level, dev_t rootDev, ThreadBuffer *buf) {
+    CountDir *stack = malloc(64 * sizeof(CountDir));
+    size_t depth = 0, cap = 64;
+    long top = 0;
+    int first = 1;
+
+    if (!stack || !(stack[0].path = strdup(path))) {
+        free(stack);
+        record_error(path, ENOMEM);
+        return 0;
+    }
+    stack[depth++].level = level;
+
+    while (depth) {
+        CountDir dir = stack[--depth];
+        long n = 0;
+        DIR *dirp = opendir(dir.path);
+        if (!dirp) {
+            record_error(dir.path, errno);
+            free(dir.path);
+            first = 0;
+            continue;
+        }
+
+        struct dirent *d;
+        struct stat f;
+        while ((d = readdir(dirp)) != NULL) {
+            if (strcmp(".", d->d_name) == 0 || strcmp("..", d->d_name) == 0)
+                continue;
+
+            int isdir = d->d_type == DT_DIR, mounted = 0;
+            if (isdir && skip_name(d->d_name))
+                continue;
+            if (d->d_type == DT_UNKNOWN || (isdir && ONEFS)) {
+                if (fstatat(dirfd(dirp), d->d_name, &f, AT_SYMLINK_NOFOLLOW) == -1) {
+                    char fullpath[MAXPATH];
+                    snprintf(fullpath, MAXPATH, "%s/%s", dir.path, d->d_name);
+                    record_error(fullpath, errno);
+                    continue;
+                }
+                isdir = S_ISDIR(f.st_mode);
+                if (isdir && d->d_type == DT_UNKNOWN && skip_name(d->d_name))
+                    continue;
+                /* Counted, but its entries belong to another filesystem */
+                mounted = ONEFS && isdir && f.st_dev != rootDev;
+            }
+
+            n++;
+            count_level(buf, dir.level);
+            if (!isdir) continue;
+
+            size_t len = strlen(dir.path) + strlen(d->d_name) + 2;
+            char *sub = malloc(len);
+            if (sub) snprintf(sub, len, "%s/%s", dir.path, d->d_name);
+            if (sub && mounted) {
+                strlist_add(&mountPoints, sub);
+                free(sub);
+                continue;
+            }
+            if (sub && depth == cap) {
+                CountDir *grown = realloc(stack, cap * 2 * sizeof(CountDir));
+                if (grown) {
+                    stack = grown;
+                    cap *= 2;
+                }
+            }
+            if (!sub || depth == cap) {
+                record_error(sub ? sub : dir.path, ENOMEM);
+                free(sub);
+                continue;
+            }
+            stack[depth].path = sub;
+            stack[depth++].level = dir.level + 1;
+        }
+
+        closedir(dirp);
+        free(dir.path);
+        if (first) top = n;
+        first = 0;
+    }
+
+    free(stack);
+    return top;
+}
+
+/* Directory reader that, in inode-order mode, hands out entries in batches
+ * sorted by d_ino so the inode table is read sequentially. */
+typedef struct {
+    uint64_t ino;
+    size_t name;  /* offset into names */
+} BatchEntry;
+
+typedef struct {
+    DIR *dirp;
+    BatchEntry *ents, *tmp;
+    size_t n, pos, cap;
+    char *names;
+    size_t namesUsed, namesCap;
+    int eof;
+    int err;  /* errno that cut the listing short, 0 if none */
+} DirBatch;
+
+/* LSD radix sort on the inode number, one byte per pass; passes where all
+ * keys share the same byte (the high bytes, usually) are skipped. */
+static void radix_sort_ino(BatchEntry *a, BatchEntry *tmp, size_t n) {
+    BatchEntry *src = a, *dst = tmp;
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        size_t count[256] = {0};
+        for (size_t i = 0; i < n; i++) count[(src[i].ino >> shift) & 0xff]++;
+        if (count[(src[0].ino >> shift) & 0xff] == n) continue;
+
+        size_t sum = 0;
+        for (int b = 0; b < 256; b++) {
+            size_t c = count[b];
+            count[b] = sum;
+            sum += c;
+        }
+        for (size_t i = 0; i < n; i++) dst[count[(src[i].ino >> shift) & 0xff]++] = src[i];
+
+        BatchEntry *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != a) memcpy(a, src, n * sizeof(BatchEntry));
+}
+
+/* Read and sort the next batch; out of memory, the batch read so far is
+ * kept and the listing ends with b->err set */
+static void batch_fill(DirBatch *b) {
+    struct dirent *d;
+
+    b->n = b->pos = b->namesUsed = 0;
+    while (b->n < INODE_BATCH && (d = readdir(b->dirp)) != NULL) {
+        size_t len = strlen(d->d_name) + 1;
+        if (b->n == b->cap) {
+            size_t ncap = b->cap ? b->cap * 2 : 256;
+            BatchEntry *e = realloc(b->ents, ncap * sizeof(BatchEntry));
+            if (e) b->ents = e;
+            if (e && (e = realloc(b->tmp, ncap * sizeof(BatchEntry)))) b->tmp = e;
+            if (!e) {
+                b->err = ENOMEM;
+                break;
+            }
+            b->cap = ncap;
+        }
+        if (b->namesUsed + len > b->namesCap) {
+            size_t ncap = b->namesCap ? b->namesCap * 2 : 16384;
+            while (ncap < b->namesUsed + len) ncap *= 2;
+            char *names = realloc(b->names, ncap);
+            if (!names) {
+                b->err = ENOMEM;
+                break;
+            }
+            b->names = names;
+            b->namesCap = ncap;
+        }
+        memcpy(b->names + b->namesUsed, d->d_name, len);
+        b->ents[b->n].ino = d->d_ino;
+        b->ents[b->n].name = b->namesUsed;
+        b->namesUsed += len;
+        b->n++;
+    }
+    if (b->n < INODE_BATCH || b->err) b->eof = 1;
+    if (b->n > 1) radix_sort_ino(b->ents, b->tmp, b->n);
+}
+
+/* Next entry name, or NULL at the end of the directory */
+static const char *batch_next(DirBatch *b) {
+    if (!INODEORDER) {
+        struct dirent *d = readdir(b->dirp);
+        return d ? d->d_name : NULL;
+    }
+    if (b->pos == b->n) {
+        if (b->eof) return NULL;
+        batch_fill(b);
+        if (b->n == 0) return NULL;
+    }
+    return b->names + b->ents[b->pos++].name;
+}
+
+static void batch_free(DirBatch *b) {
+    free(b->ents);
+    free(b->tmp);
+    free(b->names);
+}
+
+/* Subtree size from the previous scan's hints, 0 when unknown */
+static uint64_t lookup_hint(uint64_t ino) {
+    size_t lo = 0, hi = hintCnt;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (sizeHints[mid].ino < ino) lo = mid + 1;
+        else hi = mid;
+    }
+    return (lo < hintCnt && sizeHints[lo].ino == ino) ? sizeHints[lo].entries : 0;
+}
+
+/* Scheduling priority: the estimated number of entries below a directory.
+ * The previous scan's subtree size wins when known; otherwise guess from
+ * the directory's own size (~24 bytes per dirent on ext4/XFS) times its
+ * subdirectory count (st_nlink - 2, where the filesystem maintains it). */
+static uint64_t dir_priority(const struct stat *st) {
+    uint64_t hint = hintCnt ? lookup_hint(st->st_ino) : 0;
+    if (hint) return hint;
+
+    uint64_t entries = (uint64_t)st->st_size / 24 + 1;
+    uint64_t subdirs = st->st_nlink > 2 ? st->st_nlink - 2 : 0;
+    return entries * (subdirs + 1);
+}
+
+static int compare_hints(const void *a, const void *b) {
+    uint64_t x = ((const SizeHint *)a)->ino, y = ((const SizeHint *)b)->ino;
+    return (x > y) - (x < y);
+}
+
+/* Build the hint table from a Python mapping {inode: subtree entries} */
+static int build_hints(PyObject *mapping) {
+    PyObject *key, *value;
+    Py_ssize_t pos = 0, n;
+
+    free(sizeHints);
+    sizeHints = NULL;
+    hintCnt = 0;
+    if (mapping == Py_None) return 0;
+    if (!PyDict_Check(mapping)) {
+        PyErr_SetString(PyExc_TypeError, "size_hints must be a dict {inode: entries}");
+        return -1;
+    }
+
+    n = PyDict_Size(mapping);
+    if (n == 0) return 0;
+    sizeHints = malloc(n * sizeof(SizeHint));
+    if (!sizeHints) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    while (PyDict_Next(mapping, &pos, &key, &value)) {
+        unsigned long long ino = PyLong_AsUnsignedLongLong(key);
+        unsigned long long entries = PyLong_AsUnsignedLongLong(value);
+        if (PyErr_Occurred()) {
+            free(sizeHints);
+            sizeHints = NULL;
+            return -1;
+        }
+        sizeHints[hintCnt].ino = ino;
+        sizeHints[hintCnt].entries = entries;
+        hintCnt++;
+    }
+    qsort(sizeHints, hintCnt, sizeof(SizeHint), compare_hints);
+    return 0;
+}
+
+static DirTask *new_task(const char *path, const struct stat *st, const struct timespec *btime,
+                         ino_t pinode, long depth, int root) {
+    size_t len = strlen(path) + 1;
+    DirTask *t = malloc(sizeof(DirTask) + len);
+    if (!t) return NULL;
+    memcpy(&t->pstat, st, sizeof(struct stat));
+    t->pbtime = *btime;
+    t->pinode = pinode;
+    t->depth = depth;
+    t->root = root;
+    t->prio = dir_priority(st);
+    t->parent = NULL;
+    t->total = 0;
+    t->pending = 1;
+    t->prefetched = 0;
+    t->newest = st->st_mtime;
+    memcpy(t->dname, path, len);
+    return t;
+}
+
+static void atomic_max(int64_t *target, int64_t value) {
+    int64_t cur = __atomic_load_n(target, __ATOMIC_RELAXED);
+    while (value > cur &&
+           !__atomic_compare_exchange_n(target, &cur, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/* Done with a task. In du mode the last reference to finish a subtree
+ * reports its total and rolls it up into the parent. */
+static void task_release(DirTask *t) {
+    if (!DUMODE) {
+        free(t);
+        return;
+    }
+    while (t && __atomic_sub_fetch(&t->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        DirTask *parent = t->parent;
+        uint64_t total = __atomic_load_n(&t->total, __ATOMIC_RELAXED);
+        int64_t newest = __atomic_load_n(&t->newest, __ATOMIC_RELAXED);
+        if (COLDMODE) {
+            if (newest < coldCutoff && total >= coldMinSize) du_record(t->dname, total, newest);
+            if (parent) atomic_max(&parent->newest, newest);
+        } else if (DUDEPTH < 0 || t->depth + 1 <= DUDEPTH) {
+            du_record(t->dname, total, newest);
+        }
+        if (parent) __atomic_add_fetch(&parent->total, total, __ATOMIC_RELAXED);
+        free(t);
+        t = parent;
+    }
+}
+
+static inline size_t task_bytes(const DirTask *t) {
+    return sizeof(DirTask) + strlen(t->dname) + 1 + sizeof(DirTask *);
+}
+
+/* Heap key of a task being pushed (frontier.lock held) */
+static uint64_t task_key(const DirTask *t) {
+    uint64_t seq = frontier.seq++;
+
+    switch (ORDER) {
+    case ORDER_BFS:
+        return UINT64_MAX - seq;
+    case ORDER_DFS:
+        return seq;
+    case ORDER_HYBRID:
+        /* LIFO keys sort above every FIFO key, so once the frontier grows
+         * too large the newest subtrees are drained depth-first */
+        return frontier.deep ? (1ULL << 63) | seq : (1ULL << 63) - 1 - seq;
+    default:
+        return t->prio;
+    }
+}
+
+/* Push a directory's subdirectories in one critical section */
+static void frontier_push(DirTask **tasks, size_t n) {
+    if (n == 0) return;
+    pthread_mutex_lock(&frontier.lock);
+    if (frontier.n + n > frontier.cap) {
+        size_t ncap = frontier.cap ? frontier.cap : 1024;
+        while (ncap < frontier.n + n) ncap *= 2;
+        DirTask **heap = realloc(frontier.heap, ncap * sizeof(DirTask *));
+        if (!heap) {
+            /* Out of memory: drop the subtrees rather than the whole scan */
+            pthread_mutex_unlock(&frontier.lock);
+            for (size_t i = 0; i < n; i++) task_release(tasks[i]);
+            return;
+        }
+        frontier.heap = heap;
+        frontier.cap = ncap;
+    }
+    for (size_t k = 0; k < n; k++) {
+        size_t i = frontier.n++;
+        tasks[k]->key = task_key(tasks[k]);
+        frontier.bytes += task_bytes(tasks[k]);
+        while (i > 0 && frontier.heap[(i - 1) / 2]->key < tasks[k]->key) {
+            frontier.heap[i] = frontier.heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        frontier.heap[i] = tasks[k];
+    }
+    if (frontier.bytes > frontier.peak) frontier.peak = frontier.bytes;
+    if (frontier.bytes > FRONTIER_LIMIT) frontier.deep = 1;
+    pthread_cond_broadcast(&frontier.cond);
+    if (PREFETCH) pthread_cond_broadcast(&prefetchCond);
+    pthread_mutex_unlock(&frontier.lock);
+}
+
+/* Pop the next pending directory; NULL once the scan is complete */
+static DirTask *frontier_pop(void) {
+    DirTask *top;
+
+    pthread_mutex_lock(&frontier.lock);
+    while (frontier.n == 0 && frontier.active > 0)
+        pthread_cond_wait(&frontier.cond, &frontier.lock);
+    if (frontier.n == 0) {
+        pthread_mutex_unlock(&frontier.lock);
+        return NULL;
+    }
+
+    top = frontier.heap[0];
+    DirTask *last = frontier.heap[--frontier.n];
+    size_t i = 0;
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= frontier.n) break;
+        if (c + 1 < frontier.n && frontier.heap[c + 1]->key > frontier.heap[c]->key) c++;
+        if (frontier.heap[c]->key <= last->key) break;
+        frontier.heap[i] = frontier.heap[c];
+        i = c;
+    }
+    if (frontier.n) frontier.heap[i] = last;
+    frontier.bytes -= task_bytes(top);
+    if (frontier.bytes < FRONTIER_LIMIT / 2) frontier.deep = 0;
+    frontier.active++;
+    if (PREFETCH) pthread_cond_signal(&prefetchCond);  /* a new task entered the window */
+    pthread_mutex_unlock(&frontier.lock);
+    return top;
+}
+
+static void frontier_done(void) {
+    pthread_mutex_lock(&frontier.lock);
+    if (--frontier.active == 0 && frontier.n == 0)
+        pthread_cond_broadcast(&frontier.cond);
+    pthread_mutex_unlock(&frontier.lock);
+}
+
+/* Prefetch thread: warm the client cache for queued directories. Paths
+ * are copied under the lock, so tasks never outlive their workers here. */
+static void *prefetch_main(void *arg) {
+    char path[MAXPATH];
+    char *dents = malloc(PREFETCH_BUF);
+    if (!dents) return NULL;
+
+    pthread_mutex_lock(&frontier.lock);
+    while (!prefetchStop) {
+        /* The next PREFETCH tasks to be popped, in pop order: a best-first
+         * walk of the heap from its root, which never holds more than
+         * PREFETCH + 1 candidate slots */
+        size_t cand[PREFETCH_MAX + 1], ncand = frontier.n > 0;
+        DirTask *t = NULL;
+        cand[0] = 0;
+        for (int seen = 0; seen < PREFETCH && ncand && !t; seen++) {
+            size_t best = 0;
+            for (size_t c = 1; c < ncand; c++) {
+                if (frontier.heap[cand[c]]->key > frontier.heap[cand[best]]->key) best = c;
+            }
+            size_t i = cand[best];
+            cand[best] = cand[--ncand];
+            if (!frontier.heap[i]->prefetched) t = frontier.heap[i];
+            if (2 * i + 1 < frontier.n) cand[ncand++] = 2 * i + 1;
+            if (2 * i + 2 < frontier.n) cand[ncand++] = 2 * i + 2;
+        }
+        if (!t) {
+            pthread_cond_wait(&prefetchCond, &frontier.lock);
+            continue;
+        }
+        t->prefetched = 1;
+        snprintf(path, MAXPATH, "%s", t->dname);
+        pthread_mutex_unlock(&frontier.lock);
+
+        int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0) {
+            if (syscall(SYS_getdents64, fd, dents, PREFETCH_BUF) > 0)
+                __atomic_add_fetch(&prefetchCount, 1, __ATOMIC_RELAXED);
+            close(fd);
+        }
+        pthread_mutex_lock(&frontier.lock);
+    }
+    pthread_mutex_unlock(&frontier.lock);
+    free(dents);
+    return NULL;
+}
+
+/* Scan one directory: write its entries, queue its subdirectories */
+static void traverse(DirTask *cur, ThreadBuffer *buf) {
+    DIR *dirp;
+    DirBatch batch = {0};
+    const char *name;
+    struct stat f;
+    struct timespec fbtime;
+    char fullpath[MAXPATH];
+    DirTask **subdirs = NULL;
+    size_t nsub = 0, capsub = 0;
+    long localCnt = 0, localSz = 0;
+    uint64_t localUse = 0;
+    int64_t localNewest = INT64_MIN;
+
+    /* Level of cur's entries below the root (the root's entries are level 1) */
+    long level = cur->depth + 2;
+
+    if (MAXDEPTH >= 0 && level > MAXDEPTH) {
+        /* Cut off: record the directory without reading it */
+        if (COUNTBELOW) localCnt = count_entries(cur->dname, level, rootDevs[cur->root], buf);
+        write_record(buf, cur->root, cur->dname, &cur->pstat, &cur->pbtime, cur->pinode, cur->depth,
+                     localCnt, 0);
+        return;
+    }
+
+    if (DUMODE) cur->total = du_usage(&cur->pstat);
+
+    dirp = opendir(cur->dname);
+    if (!dirp) {
+        record_error(cur->dname, errno);
+        return;
+    }
+
+    batch.dirp = dirp;
+    while ((name = batch_next(&batch)) != NULL) {
+        if (strcmp(".", name) == 0 || strcmp("..", name) == 0)
+            continue;
+        snprintf(fullpath, MAXPATH, "%s/%s", cur->dname, name);
+
+        if (pw_lstat(fullpath, &f, &fbtime) == -1)
+            continue;
+        if (S_ISDIR(f.st_mode) && skip_name(name))
+            continue;
+
+        /* Mountpoint of another filesystem: recorded (as find -xdev prints
+         * it) but not read, it gets its own scan; du -x leaves it out */
+        if (ONEFS && S_ISDIR(f.st_mode) && f.st_dev != rootDevs[cur->root]) {
+            strlist_add(&mountPoints, fullpath);
+            if (DUMODE) continue;
+            localCnt++;
+            count_level(buf, level);
+            write_record(buf, cur->root, fullpath, &f, &fbtime, cur->pstat.st_ino,
+                         cur->depth + 1, 0, 0);
+            continue;
+        }
+
+        localCnt++;
+        count_level(buf, level);
+
+        if (S_ISDIR(f.st_mode)) {
+            DirTask *t = new_task(fullpath, &f, &fbtime, cur->pstat.st_ino, cur->depth + 1,
+                                  cur->root);
+            if (!t) continue;
+            t->parent = cur;
+
+            /* Directories past max_depth are only recorded: never worth queueing */
+            if (MAXDEPTH >= 0 && level >= MAXDEPTH) {
+                traverse(t, buf);
+                free(t);
+                continue;
+            }
+            if (nsub == capsub) {
+                size_t ncap = capsub ? capsub * 2 : 16;
+                DirTask **grown = realloc(subdirs, ncap * sizeof(DirTask *));
+                if (!grown) {
+                    free(t);
+                    continue;
+                }
+                subdirs = grown;
+                capsub = ncap;
+            }
+            subdirs[nsub++] = t;
+        } else if (DUMODE) {
+            localUse += du_usage(&f);
+            if (COLDMODE == COLD_BOTH && f.st_atime > localNewest) localNewest = f.st_atime;
+            if (f.st_mtime > localNewest) localNewest = f.st_mtime;
+        } else {
+            localSz += f.st_size;
+            write_record(buf, cur->root, fullpath, &f, &fbtime, cur->pstat.st_ino, cur->depth,
+                         -1, 0);
+        }
+    }
+
+    closedir(dirp);
+    batch_free(&batch);
+    if (batch.err) record_error(cur->dname, batch.err);
+    if (DUMODE) {
+        /* Children roll up into cur once they are queued */
+        cur->total += localUse;
+        cur->pending += nsub;
+        if (localNewest > cur->newest) atomic_max(&cur->newest, localNewest);
+    } else {
+        write_record(buf, cur->root, cur->dname, &cur->pstat, &cur->pbtime, cur->pinode,
+                     cur->depth, localCnt, localSz);
+    }
+
+    frontier_push(subdirs, nsub);
+    free(subdirs);
+}
+
+/* Worker thread: scan directories from the frontier until it runs dry */
+static void *worker(void *arg) {
+    ThreadBuffer *buf = (ThreadBuffer *)arg;
+    DirTask *t;
+
+    while ((t = frontier_pop()) != NULL) {
+        traverse(t, buf);
+        task_release(t);
+        frontier_done();
+    }
+    flush_buffer(buf);
+    return NULL;
+}
+
+/* Run fn on max_threads worker threads (GIL must be released), plus the
+ * name resolver thread when name columns are on */
+static void run_workers(void *(*fn)(void *), int max_threads) {
+    pthread_t workers[MAXTHRDS], resolverThread, readers[CHECKSUM_MAX];
+    int started = 0, resolving = 0;
+
+    resolverBuf.used = 0;
+    resolver.done = 0;
+    if (NAMES) resolving = pthread_create(&resolverThread, NULL, resolver_main, NULL) == 0;
+
+    /* Checksum readers, started before the workers can fill their queue */
+    hasher.done = 0;
+    hasher.readers = 0;
+    hasher.next = 0;
+    for (int i = 0; CHECKSUM && i < CHECKSUMTHREADS; i++) {
+        hashBufs[i].used = 0;
+        if (pthread_create(&readers[hasher.readers], NULL, hasher_main, &hashBufs[i]) == 0)
+            hasher.readers++;
+    }
+
+    for (int i = 0; i < max_threads; i++) {
+        if (pthread_create(&workers[started], NULL, fn, &buffers[i]) == 0) started++;
+    }
+    if (started == 0) fn(&buffers[0]);
+    for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+
+    /* Let the readers drain the queue; they may still defer to the resolver */
+    if (CHECKSUM) {
+        pthread_mutex_lock(&hasher.lock);
+        hasher.done = 1;
+        pthread_cond_broadcast(&hasher.cond);
+        pthread_mutex_unlock(&hasher.lock);
+        for (int i = 0; i < hasher.readers; i++) pthread_join(readers[i], NULL);
+        if (!hasher.readers) hasher_main(&hashBufs[0]);
+    }
+
+    /* Let the resolver drain the deferred records */
+    pthread_mutex_lock(&resolver.lock);
+    resolver.done = 1;
+    pthread_cond_signal(&resolver.cond);
+    pthread_mutex_unlock(&resolver.lock);
+    if (resolving) pthread_join(resolverThread, NULL);
+    else if (NAMES) resolver_main(NULL);
+
+    name_table_free(&userNames);
+    name_table_free(&groupNames);
+}
+
+static void reset_buffers(void) {
+    for (int i = 0; i < MAXTHRDS; i++) {
+        buffers[i].used = 0;
+        buffers[i].sink = 0;
+        buffers[i].nnotes = 0;
+        buffers[i].npaths = 0;
+        memset(buffers[i].depthCnt, 0, sizeof(buffers[i].depthCnt));
+    }
+}
+
+/* lstat the roots (a list of bytes) into new tasks and fill rootDevs.
+ * Returns NULL with an exception set if any root cannot be stat'ed. */
+static DirTask **stat_roots(PyObject *tops) {
+    int nroots = (int)PyList_GET_SIZE(tops);
+    DirTask **rootTasks = calloc(nroots, sizeof(DirTask *));
+
+    free(rootDevs);
+    free(rootLens);
+    rootDevs = calloc(nroots, sizeof(dev_t));
+    rootLens = calloc(nroots, sizeof(size_t));
+    if (!rootTasks || !rootDevs || !rootLens) {
+        free(rootTasks);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    for (int r = 0; r < nroots; r++) {
+        const char *path = PyBytes_AS_STRING(PyList_GET_ITEM(tops, r));
+        struct stat root;
+        struct timespec root_btime;
+
+        if (pw_lstat(path, &root, &root_btime) == -1) {
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        } else if (!(rootTasks[r] = new_task(path, &root, &root_btime, 0, -1, r))) {
+            PyErr_NoMemory();
+        }
+        if (PyErr_Occurred()) {
+            for (int k = 0; k < r; k++) free(rootTasks[k]);
+            free(rootTasks);
+            return NULL;
+        }
+        rootDevs[r] = root.st_dev;
+        rootLens[r] = strlen(path);
+    }
+    return rootTasks;
+}
+
+/* Scan from the root tasks until the frontier runs dry (GIL released).
+ * Takes ownership of the tasks and the array. */
+static void scan_roots(DirTask **rootTasks, int nroots, int max_threads) {
+    frontier.n = 0;
+    frontier.active = 0;
+    frontier.seq = 0;
+    frontier.bytes = frontier.peak = 0;
+    frontier.deep = 0;
+    prefetchStop = 0;
+    prefetchCount = 0;
+    frontier_push(rootTasks, nroots);
+    free(rootTasks);
+
+    /* Prefetch threads only block in open() and getdents(): small stacks */
+    pthread_t prefetchers[PREFETCH_MAX];
+    pthread_attr_t attr;
+    int nprefetch = 0;
+    if (PREFETCH) {
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, 64 * 1024 + MAXPATH);
+        for (int i = 0; i < PREFETCH; i++) {
+            if (pthread_create(&prefetchers[nprefetch], &attr, prefetch_main, NULL) == 0)
+                nprefetch++;
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    run_workers(worker, max_threads);
+
+    pthread_mutex_lock(&frontier.lock);
+    prefetchStop = 1;
+    pthread_cond_broadcast(&prefetchCond);
+    pthread_mutex_unlock(&frontier.lock);
+    for (int i = 0; i < nprefetch; i++) pthread_join(prefetchers[i], NULL);
+
+    free(frontier.heap);
+    frontier.heap = NULL;
+    frontier.cap = 0;
+    free(sizeHints);
+    sizeHints = NULL;
+    hintCnt = 0;
+    free(rootDevs);
+    rootDevs = NULL;
+    free(rootLens);
+    rootLens = NULL;
+}
+
+/* Convert a path or a sequence of paths into a new list of bytes objects */
+static PyObject *fs_path_list(PyObject *obj, int *is_seq) {
+    PyObject *list = PyList_New(0);
+    if (!list) return NULL;
+
+    *is_seq = !(PyUnicode_Check(obj) || PyBytes_Check(obj) || PyObject_HasAttrString(obj, "__fspath__"));
+    PyObject *seq = *is_seq ? PySequence_Fast(obj, "expected a path or a sequence of paths")
+                            : Py_BuildValue("(O)", obj);
+    if (!seq) {
+        Py_DECREF(list);
+        return NULL;
+    }
+    for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+        PyObject *bytes = NULL;
+        if (!PyUnicode_FSConverter(PySequence_Fast_GET_ITEM(seq, i), &bytes) ||
+            PyList_Append(list, bytes) < 0) {
+            Py_XDECREF(bytes);
+            Py_DECREF(seq);
+            Py_DECREF(list);
+            return NULL;
+        }
+        Py_DECREF(bytes);
+    }
+    Py_DECREF(seq);
+    return list;
+}
+
+/* Close all outputs */
+static void close_sinks(void) {
+    for (int i = 0; i < nsinks; i++) {
+        if (sinks[i].file) fclose(sinks[i].file);
+        pthread_mutex_destroy(&sinks[i].lock);
+        free(sinks[i].rows);
+    }
+    free(sinks);
+    sinks = NULL;
+    nsinks = 0;
+}
+
+/* Open one output per path and write the CSV header */
+static int open_sinks(PyObject *paths, int compress) {
+    Py_ssize_t n = PyList_GET_SIZE(paths);
+
+    if (compress < COMPRESS_NONE || compress > COMPRESS_LZ4) {
+        PyErr_Format(PyExc_ValueError, "invalid compression mode: %d", compress);
+        return -1;
+    }
+#ifndef HAVE_ZSTD
+    if (compress == COMPRESS_ZSTD) {
+        PyErr_SetString(PyExc_ValueError, "pwalk was built without zstd");
+        return -1;
+    }
+#endif
+#ifndef HAVE_LZ4
+    if (compress == COMPRESS_LZ4) {
+        PyErr_SetString(PyExc_ValueError, "pwalk was built without lz4");
+        return -1;
+    }
+#endif
+
+    sinks = calloc(n, sizeof(OutputSink));
+    if (!sinks) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (nsinks = 0; nsinks < n; nsinks++) {
+        OutputSink *out = &sinks[nsinks];
+        const char *path = PyBytes_AS_STRING(PyList_GET_ITEM(paths, nsinks));
+
+        out->file = fopen(path, "wb");
+        if (!out->file) {
+            PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+            close_sinks();
+            return -1;
+        }
+        pthread_mutex_init(&out->lock, NULL);
+        out->compress = compress;
+
+        if (FINDMODE) continue;
+
+        /* Write header (its own zstd frame when compressing) */
+        char header[512] = "inode,parent-inode,directory-depth,\"filename\",\"fileExtension\","
+                           "UID,GID,st_size,st_dev,st_blocks,st_nlink,\"st_mode\","
+                           "st_atime,st_mtime,st_ctime,pw_fcount,pw_dirsum";
+        if (NSTIMES) strcat(header, ",st_atime_ns,st_mtime_ns,st_ctime_ns,st_btime_ns");
+        if (XATTRS == XATTR_ACL) strcat(header, ",has_acl");
+        if (XATTRS == XATTR_ALL) strcat(header, ",has_acl,\"xattrs\"");
+        if (ROOTIDS) strcat(header, ",root_id");
+        if (CHECKSUM) strcat(header, ",xxh64");
+        if (NAMES) strcat(header, ",\"user\",\"group\"");
+        strcat(header, "\n");
+        if (compress) {
+            char frame[sizeof(header) + 1024];
+            size_t len = compress_frame(NULL, compress, frame, sizeof(frame), header, strlen(header));
+            if (len == 0) {
+                PyErr_Format(PyExc_RuntimeError, "%s: cannot compress the CSV header", path);
+                nsinks++;
+                close_sinks();
+                return -1;
+            }
+            fwrite(frame, 1, len, out->file);
+            continue;
+        }
+        fputs(header, out->file);
+    }
+    return 0;
+}
+
+/* Path index file: the header, then arrays of uint64_t in this order: the
+ * Bloom filter (nblocks * 8), the perfect hash level bits (sum of
+ * levelWords), the rank of every 512-bit block of them (nwords / 8 + 1),
+ * the keys no level placed (nleft, sorted), and the inode, device and
+ * location of the record in every hash slot (nkeys each). Inode and device
+ * are kept to turn away keys that are not in the scan, which the hash maps
+ * to some slot, and to tell apart the rare pairs that share a key. */
+#define BLOOM_BITS   10  /* per path: about 1% false positives */
+#define BLOOM_PROBES 7
+#define MPH_GAMMA    2   /* level bits per key: larger builds faster, in more space */
+#define MPH_LEVELS   32
+
+static const char pidxMagic[8] = "PWIDX2\n";
+
+typedef struct {
+    char magic[8];
+    uint64_t nkeys, npaths, nblocks, nlevels, nleft;
+    uint64_t compress;  /* COMPRESS_* of the scan: how locations are encoded */
+    uint64_t dev;       /* st_dev of the (first) top directory */
+    uint64_t levelWords[MPH_LEVELS];
+} PathIndexHeader;
+
+/* Map a hash onto [0, n) without a division */
+static inline uint64_t hash_range(uint64_t h, uint64_t n) {
+    return (uint64_t)(((unsigned __int128)h * n) >> 64);
+}
+
+/* Hash key of an inode: distinct inodes of one device never share one */
+static inline uint64_t index_key(uint64_t dev, uint64_t ino) {
+    return ino ^ mix64(dev);
+}
+
+static inline uint64_t mph_hash(uint64_t key, uint64_t level) {
+    return mix64(key ^ (level + 1) * 0x9E3779B97F4A7C15ULL);
+}
+
+/* Blocked Bloom filter: all probes of a key hit one 512-bit block, so a
+ * lookup touches a single cache line */
+static void bloom_add(uint64_t *bloom, uint64_t nblocks, uint64_t key) {
+    uint64_t *block = bloom + hash_range(key, nblocks) * 8;
+    uint64_t g = mix64(key ^ 0x9E3779B97F4A7C15ULL);
+    for (int i = 0; i < BLOOM_PROBES; i++, g >>= 9) block[(g & 511) >> 6] |= 1ULL << (g & 63);
+}
+
+static int bloom_test(const uint64_t *bloom, uint64_t nblocks, uint64_t key) {
+    const uint64_t *block = bloom + hash_range(key, nblocks) * 8;
+    uint64_t g = mix64(key ^ 0x9E3779B97F4A7C15ULL);
+    for (int i = 0; i < BLOOM_PROBES; i++, g >>= 9)
+        if (!(block[(g & 511) >> 6] & 1ULL << (g & 63))) return 0;
+    return 1;
+}
+
+/* Minimal perfect hash (BBHash): the slot of a key in [0, nkeys) is the
+ * rank of its bit in the first level where it landed alone; keys that
+ * collided on every level are numbered after them, a key shared by several
+ * inodes once per inode. -1 if it has no slot. */
+static int64_t mph_slot(const PathIndexHeader *h, const uint64_t *bits, const uint64_t *ranks,
+                        const uint64_t *left, uint64_t key) {
+    uint64_t start = 0;
+    for (uint64_t l = 0; l < h->nlevels; l++) {
+        uint64_t pos = start * 64 + hash_range(mph_hash(key, l), h->levelWords[l] * 64);
+        if (bits[pos >> 6] & 1ULL << (pos & 63)) {
+            uint64_t r = ranks[pos >> 9];
+            for (uint64_t w = pos >> 9 << 3; w < pos >> 6; w++) r += __builtin_popcountll(bits[w]);
+            return (int64_t)(r + __builtin_popcountll(bits[pos >> 6] & ((1ULL << (pos & 63)) - 1)));
+        }
+        start += h->levelWords[l];
+    }
+    size_t lo = 0, hi = h->nleft;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (left[mid] < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < h->nleft && left[lo] == key ? (int64_t)(h->nkeys - h->nleft + lo) : -1;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Records by key, then inode and device, then location */
+static int cmp_note(const void *a, const void *b) {
+    const IndexNote *x = a, *y = b;
+    uint64_t kx = index_key(x->dev, x->ino), ky = index_key(y->dev, y->ino);
+    if (kx != ky) return kx < ky ? -1 : 1;
+    if (x->ino != y->ino) return x->ino < y->ino ? -1 : 1;
+    if (x->dev != y->dev) return x->dev < y->dev ? -1 : 1;
+    return (x->loc > y->loc) - (x->loc < y->loc);
+}
+
+static int write_words(FILE *f, const uint64_t *w, uint64_t n) {
+    return fwrite(w, sizeof(uint64_t), n, f) == n;
+}
+
+/* Build the path index of output s and write it to path; 0 or an errno */
+static int write_index(int s, const char *path) {
+    OutputSink *out = &sinks[s];
+    PathIndexHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, pidxMagic, sizeof(h.magic));
+    h.compress = out->compress;
+    h.dev = out->rootDev;
+
+    /* One entry per inode: its first record (hard links are recorded once per link) */
+    IndexNote *rows = out->rows;
+    size_t n = 0;
+    if (out->nrows) qsort(rows, out->nrows, sizeof(IndexNote), cmp_note);
+    for (size_t i = 0; i < out->nrows; i++)
+        if (n == 0 || rows[i].ino != rows[n - 1].ino || rows[i].dev != rows[n - 1].dev)
+            rows[n++] = rows[i];
+    h.nkeys = n;
+
+    for (int i = 0; i < MAXTHRDS; i++)
+        for (size_t j = 0; j < buffers[i].npaths; j++) h.npaths += buffers[i].paths[j].sink == s;
+    h.nblocks = (h.npaths * BLOOM_BITS + 511) / 512;
+    if (h.nblocks == 0) h.nblocks = 1;
+
+    uint64_t *bloom = calloc(h.nblocks * 8, sizeof(uint64_t));
+    uint64_t *keys = malloc((n ? n : 1) * sizeof(uint64_t));
+    uint64_t *slotKeys = malloc((n ? n : 1) * sizeof(uint64_t));
+    uint64_t *slotDevs = malloc((n ? n : 1) * sizeof(uint64_t));
+    uint64_t *slotLocs = malloc((n ? n : 1) * sizeof(uint64_t));
+    uint64_t *bits = NULL, *ranks = NULL, *seen = NULL;
+    size_t nwords = 0, m = n;
+    int err = ENOMEM;
+    if (!bloom || !keys || !slotKeys || !slotDevs || !slotLocs) goto done;
+
+    for (int i = 0; i < MAXTHRDS; i++)
+        for (size_t j = 0; j < buffers[i].npaths; j++)
+            if (buffers[i].paths[j].sink == s) bloom_add(bloom, h.nblocks, buffers[i].paths[j].key);
+
+    /* Each level keeps the keys that hashed to a bit of their own and
+     * passes the colliding ones on to the next, smaller level */
+    for (size_t i = 0; i < n; i++) keys[i] = index_key(rows[i].dev, rows[i].ino);
+    for (h.nlevels = 0; m && h.nlevels < MPH_LEVELS; h.nlevels++) {
+        uint64_t words = (m * MPH_GAMMA + 63) / 64, nbits = words * 64;
+        uint64_t *grown = realloc(bits, (nwords + words) * sizeof(uint64_t));
+        if (!grown) goto done;
+        bits = grown;
+        free(seen);
+        if (!(seen = calloc(words, sizeof(uint64_t)))) goto done;
+
+        uint64_t *level = bits + nwords;
+        memset(level, 0, words * sizeof(uint64_t));
+        for (size_t i = 0; i < m; i++) {
+            uint64_t pos = hash_range(mph_hash(keys[i], h.nlevels), nbits);
+            if (seen[pos >> 6] & 1ULL << (pos & 63)) level[pos >> 6] |= 1ULL << (pos & 63);
+            else seen[pos >> 6] |= 1ULL << (pos & 63);
+        }
+        for (uint64_t w = 0; w < words; w++) level[w] = seen[w] & ~level[w];
+
+        size_t kept = 0;
+        for (size_t i = 0; i < m; i++) {
+            uint64_t pos = hash_range(mph_hash(keys[i], h.nlevels), nbits);
+            if (!(level[pos >> 6] & 1ULL << (pos & 63))) keys[kept++] = keys[i];
+        }
+        h.levelWords[h.nlevels] = words;
+        nwords += words;
+        m = kept;
+    }
+    h.nleft = m;  /* still in key order */
+
+    if (!(ranks = malloc((nwords / 8 + 1) * sizeof(uint64_t)))) goto done;
+    uint64_t total = 0;
+    for (size_t w = 0; w < nwords; w++) {
+        if (w % 8 == 0) ranks[w / 8] = total;
+        total += __builtin_popcountll(bits[w]);
+    }
+    if (nwords % 8 == 0) ranks[nwords / 8] = total;
+
+    /* Inodes sharing a key were all left over: they take consecutive slots */
+    memset(slotLocs, 0xff, n * sizeof(uint64_t));
+    for (size_t i = 0; i < n; i++) {
+        int64_t slot = mph_slot(&h, bits, ranks, keys, index_key(rows[i].dev, rows[i].ino));
+        while (slotLocs[slot] != UINT64_MAX) slot++;
+        slotKeys[slot] = rows[i].ino;
+        slotDevs[slot] = rows[i].dev;
+        slotLocs[slot] = rows[i].loc;
+    }
+
+    errno = 0;
+    FILE *f = fopen(path, "wb");
+    int ok = f && fwrite(&h, sizeof(h), 1, f) == 1 && write_words(f, bloom, h.nblocks * 8) &&
+             write_words(f, bits, nwords) && write_words(f, ranks, nwords / 8 + 1) &&
+             write_words(f, keys, h.nleft) && write_words(f, slotKeys, n) &&
+             write_words(f, slotDevs, n) && write_words(f, slotLocs, n);
+    err = ok ? 0 : errno ? errno : EIO;
+    if (f && fclose(f) != 0 && !err) err = errno;
+
+done:
+    free(bloom);
+    free(keys);
+    free(slotKeys);
+    free(slotDevs);
+    free(slotLocs);
+    free(bits);
+    free(ranks);
+    free(seen);
+    return err;
+}
+
+/* Index mode: the per-worker path lists are only needed until the index is built */
+static void index_release(void) {
+    for (int i = 0; i < MAXTHRDS; i++) {
+        free(buffers[i].paths);
+        buffers[i].paths = NULL;
+        buffers[i].npaths = buffers[i].cappaths = 0;
+    }
+}
+
+/* Python API */
+static PyObject* csv_write(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"top", "output", "max_threads", "ignore_snapshots",
+                             "compress", "one_filesystem", "skip_names", "max_depth",
+                             "count_below", "xattrs", "ns_timestamps", "inode_order",
+                             "size_hints", "order", "frontier_limit", "names", "ext_stats",
+                             "prefetch", "checksum", "checksum_threads", "checksum_bandwidth",
+                             "checksum_direct", "summary", "index", NULL};
+    PyObject *top, *output;
+    int max_threads = 8, ignore_snaps = 1, compress = 0, one_fs = 0, count_below = 0;
+    int xattrs = XATTR_NONE, ns_times = 0, inode_order = 0, order = ORDER_LARGEST, names = 0;
+    int ext_stats = EXT_NONE, prefetch = 0, checksum = 0, checksum_threads = 4;
+    int checksum_direct = 0, summary = 0, index = 0;
+    double checksum_bw = 0;
+    Py_ssize_t frontier_limit = 256L << 20;
+    long max_depth = -1;
+    PyObject *skip_names = Py_None, *size_hints = Py_None;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|iiipOlpippOinpiipidppp", kwlist, &top,
+                                     &output, &max_threads, &ignore_snaps, &compress, &one_fs,
+                                     &skip_names, &max_depth, &count_below, &xattrs,
+                                     &ns_times, &inode_order, &size_hints, &order,
+                                     &frontier_limit, &names, &ext_stats, &prefetch, &checksum,
+                                     &checksum_threads, &checksum_bw, &checksum_direct,
+                                     &summary, &index)) {
+        return NULL;
+    }
+    if (ext_stats < EXT_NONE || ext_stats > EXT_BY_TOP) {
+        PyErr_Format(PyExc_ValueError, "invalid ext_stats mode: %d", ext_stats);
+        return NULL;
+    }
+    if (order < ORDER_LARGEST || order > ORDER_HYBRID) {
+        PyErr_Format(PyExc_ValueError, "invalid traversal order: %d", order);
+        return NULL;
+    }
+    if (xattrs < XATTR_NONE || xattrs > XATTR_ALL) {
+        PyErr_Format(PyExc_ValueError, "invalid xattrs mode: %d", xattrs);
+        return NULL;
+    }
+
+    /* skip_names overrides the legacy ignore_snapshots flag */
+    if (skip_names == Py_None) {
+        free_skipset();
+        if (ignore_snaps) {
+            PyObject *snap = Py_BuildValue("(s)", ".snapshot");
+            int rc = snap ? build_skipset(snap) : -1;
+            Py_XDECREF(snap);
+            if (rc < 0) return NULL;
+        }
+    } else if (build_skipset(skip_names) < 0) {
+        return NULL;
+    }
+    if (build_hints(size_hints) < 0) return NULL;
+    if (max_threads < 1) max_threads = 1;
+    if (max_threads > MAXTHRDS) max_threads = MAXTHRDS;
+    ONEFS = one_fs;
+    MAXDEPTH = max_depth < 0 ? -1 : max_depth;
+    COUNTBELOW = count_below;
+    XATTRS = xattrs;
+    NSTIMES = ns_times;
+    INODEORDER = inode_order;
+    PREFETCH = prefetch < 0 ? 0 : prefetch > PREFETCH_MAX ? PREFETCH_MAX : prefetch;
+    ORDER = order;
+    FRONTIER_LIMIT = frontier_limit > 0 ? (size_t)frontier_limit : 0;
+    NAMES = names;
+    CHECKSUMTHREADS = checksum_threads < 1 ? 1 : checksum_threads > CHECKSUM_MAX ? CHECKSUM_MAX
+                                                                                 : checksum_threads;
+    CHECKSUMBW = checksum_bw > 0 ? checksum_bw : 0;
+    CHECKSUMDIRECT = checksum_direct;
+
+    /* Roots and outputs: a single path or sequences (one output per root) */
+    int tops_seq, outputs_seq;
+    PyObject *tops = fs_path_list(top, &tops_seq);
+    if (!tops) return NULL;
+    PyObject *outputs = fs_path_list(output, &outputs_seq);
+    if (!outputs) {
+        Py_DECREF(tops);
+        return NULL;
+    }
+    int nroots = (int)PyList_GET_SIZE(tops);
+    if (nroots == 0 || (outputs_seq && PyList_GET_SIZE(outputs) != nroots)) {
+        PyErr_SetString(PyExc_ValueError,
+                        "need at least one root, and one output per root when output is a list");
+        Py_DECREF(tops);
+        Py_DECREF(outputs);
+        return NULL;
+    }
+    ROOTIDS = tops_seq;
+
+    /* Stat the roots before creating any output */
+    DirTask **rootTasks = stat_roots(tops);
+    Py_DECREF(tops);
+    if (!rootTasks) {
+        Py_DECREF(outputs);
+        return NULL;
+    }
+
+    /* Set only once nothing can fail before the scan resets it; other
+     * entry points share write_record() */
+    CHECKSUM = checksum;
+    if (open_sinks(outputs, compress) < 0) {
+        CHECKSUM = 0;
+        for (int r = 0; r < nroots; r++) free(rootTasks[r]);
+        free(rootTasks);
+        Py_DECREF(outputs);
+        return NULL;
+    }
+    for (int s = 0; s < nsinks; s++) sinks[s].rootDev = rootDevs[nsinks > 1 ? s : 0];
+
+    reset_buffers();
+    strlist_free(&mountPoints);
+    strlist_free(&errorList);
+    FULLPATHS = 0;
+    EXTMODE = 0;
+    if (ext_stats) ext_reset(ext_stats);
+    if (summary) sum_reset();
+    INDEXING = index;
+    indexFailed = 0;
+
+    /* Run the worker pool with the GIL released */
+    int failed = -1;
+    Py_BEGIN_ALLOW_THREADS
+    scan_roots(rootTasks, nroots, max_threads);
+    for (int s = 0; s < nsinks; s++)
+        if (sinks[s].failed && failed < 0) failed = s;
+    for (int s = 0; INDEXING && failed < 0 && s < nsinks; s++) {
+        const char *out = PyBytes_AS_STRING(PyList_GET_ITEM(outputs, s));
+        char path[MAXPATH + 8];
+        snprintf(path, sizeof(path), "%s.pidx", out);
+        int err = indexFailed ? ENOMEM : write_index(s, path);
+        if (err) record_error(path, err);
+    }
+    if (INDEXING) index_release();
+    Py_END_ALLOW_THREADS
+    CHECKSUM = 0;
+    INDEXING = 0;
+
+    close_sinks();
+    if (failed >= 0) {
+        PyErr_Format(PyExc_RuntimeError, "%s: cannot compress a frame, records are missing",
+                     PyBytes_AS_STRING(PyList_GET_ITEM(outputs, failed)));
+        EXTSTATS = EXT_NONE;
+        SUMMARY = 0;
+        Py_DECREF(outputs);
+        return NULL;
+    }
+    PyObject *extRows = ext_stats ? ext_collect() : Py_None;
+    if (!extRows) {
+        Py_DECREF(outputs);
+        return NULL;
+    }
+    if (!ext_stats) Py_INCREF(extRows);
+    PyObject *sumRows = summary ? sum_collect() : Py_None;
+    if (!sumRows) {
+        Py_DECREF(extRows);
+        Py_DECREF(outputs);
+        return NULL;
+    }
+    if (!summary) Py_INCREF(sumRows);
+
+    /* Report the output paths the way they were given */
+    PyObject *written = PyList_New(0);
+    for (Py_ssize_t i = 0; written && i < PyList_GET_SIZE(outputs); i++) {
+        PyObject *p = PyUnicode_DecodeFSDefault(PyBytes_AS_STRING(PyList_GET_ITEM(outputs, i)));
+        if (!p || PyList_Append(written, p) < 0) Py_CLEAR(written);
+        Py_XDECREF(p);
+    }
+    Py_DECREF(outputs);
+    if (!written) {
+        Py_DECREF(extRows);
+        Py_DECREF(sumRows);
+        return NULL;
+    }
+    if (!outputs_seq) {
+        PyObject *single = PyList_GET_ITEM(written, 0);
+        Py_INCREF(single);
+        Py_DECREF(written);
+        written = single;
+    }
+
+    PyObject *errors = strlist_to_py(&errorList);
+    PyObject *mounts = strlist_to_py(&mountPoints);
+    if (!mounts || !errors) {
+        Py_XDECREF(mounts);
+        Py_XDECREF(errors);
+        Py_DECREF(written);
+        Py_DECREF(extRows);
+        Py_DECREF(sumRows);
+        return NULL;
+    }
+
+    /* Merge per-thread depth counts; level 0 holds the roots themselves */
+    long depthCnt[MAXLEVELS] = {nroots};
+    int levels = 1;
+    for (int i = 0; i < MAXTHRDS; i++) {
+        for (int l = 1; l < MAXLEVELS; l++) {
+            depthCnt[l] += buffers[i].depthCnt[l];
+            if (depthCnt[l] && l >= levels) levels = l + 1;
+        }
+    }
+    PyObject *depths = PyList_New(levels);
+    if (!depths) {
+        Py_DECREF(mounts);
+        Py_DECREF(errors);
+        Py_DECREF(written);
+        Py_DECREF(extRows);
+        Py_DECREF(sumRows);
+        return NULL;
+    }
+    for (int l = 0; l < levels; l++) {
+        PyList_SET_ITEM(depths, l, PyLong_FromLong(depthCnt[l]));
+    }
+
+    return Py_BuildValue("{s:N,s:i,s:N,s:N,s:N,s:n,s:N,s:l,s:N}", "output", written,
+                         "compressed", compress, "errors", errors, "mountpoints", mounts,
+                         "depth_counts", depths, "frontier_peak", (Py_ssize_t)frontier.peak,
+                         "ext_stats", extRows, "prefetched", prefetchCount, "summary", sumRows);
+}
+
+/* stat_many: lstat an explicit list of paths over the worker pool */
+static PyObject *statPaths = NULL;  /* list of bytes */
+static size_t statNext = 0;
+static long statCount = 0;          /* paths stat'ed and recorded */
+
+static void *stat_worker(void *arg) {
+    ThreadBuffer *buf = (ThreadBuffer *)arg;
+    size_t n = (size_t)PyList_GET_SIZE(statPaths);
+    struct stat f;
+    struct timespec fbtime;
+    long recorded = 0;
+
+    for (;;) {
+        /* Claim paths in small chunks to keep the counter uncontended */
+        size_t start = __atomic_fetch_add(&statNext, 64, __ATOMIC_RELAXED);
+        if (start >= n) break;
+        size_t end = start + 64 < n ? start + 64 : n;
+
+        for (size_t i = start; i < end; i++) {
+            const char *path = PyBytes_AS_STRING(PyList_GET_ITEM(statPaths, i));
+            if (pw_lstat(path, &f, &fbtime) == -1) {
+                record_error(path, errno);
+                continue;
+            }
+            recorded++;
+            write_record(buf, 0, path, &f, &fbtime, 0, 0, S_ISDIR(f.st_mode) ? 0 : -1, 0);
+        }
+    }
+    __atomic_add_fetch(&statCount, recorded, __ATOMIC_RELAXED);
+    flush_buffer(buf);
+    return NULL;
+}
+
+static PyObject* stat_write(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"paths", "output", "max_threads", "compress", "xattrs",
+                             "ns_timestamps", "names", NULL};
+    PyObject *paths, *output;
+    int max_threads = 8, compress = 0, xattrs = XATTR_NONE, ns_times = 0, names = 0;
+    int paths_seq, outputs_seq;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|iiipp", kwlist, &paths, &output,
+                                     &max_threads, &compress, &xattrs, &ns_times, &names)) {
+        return NULL;
+    }
+    if (xattrs < XATTR_NONE || xattrs > XATTR_ALL) {
+        PyErr_Format(PyExc_ValueError, "invalid xattrs mode: %d", xattrs);
+        return NULL;
+    }
+    if (max_threads < 1) max_threads = 1;
+    if (max_threads > MAXTHRDS) max_threads = MAXTHRDS;
+    XATTRS = xattrs;
+    NSTIMES = ns_times;
+    NAMES = names;
+    CHECKSUM = 0;
+    ROOTIDS = 0;
+
+    PyObject *outputs = fs_path_list(output, &outputs_seq);
+    if (!outputs) return NULL;
+    if (PyList_GET_SIZE(outputs) != 1) {
+        Py_DECREF(outputs);
+        PyErr_SetString(PyExc_ValueError, "stat_many writes exactly one output");
+        return NULL;
+    }
+    statPaths = fs_path_list(paths, &paths_seq);
+    if (!statPaths || open_sinks(outputs, compress) < 0) {
+        Py_CLEAR(statPaths);
+        Py_DECREF(outputs);
+        return NULL;
+    }
+    Py_DECREF(outputs);
+
+    reset_buffers();
+    strlist_free(&errorList);
+    statNext = 0;
+    statCount = 0;
+    FULLPATHS = 1;
+
+    Py_BEGIN_ALLOW_THREADS
+    run_workers(stat_worker, max_threads);
+    Py_END_ALLOW_THREADS
+
+    FULLPATHS = 0;
+    close_sinks();
+
+    Py_CLEAR(statPaths);
+
+    PyObject *errors = strlist_to_py(&errorList);
+    if (!errors) return NULL;
+    return Py_BuildValue("{s:O,s:i,s:N,s:l}", "output", output, "compressed", compress,
+                         "errors", errors, "count", statCount);
+}
+
+/* du_totals: recursive usage per directory, rolled up bottom-up */
+static PyObject* du_totals(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"top", "max_threads", "max_depth", "apparent_size", "count_links",
+                             "one_filesystem", "skip_names", "prefetch", NULL};
+    PyObject *top, *skip_names = Py_None;
+    int max_threads = 8, apparent = 0, count_links = 0, one_fs = 0, prefetch = 0, is_seq;
+    long max_depth = -1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|ilpppOi", kwlist, &top, &max_threads,
+                                     &max_depth, &apparent, &count_links, &one_fs,
+                                     &skip_names, &prefetch)) {
+        return NULL;
+    }
+    if (skip_names == Py_None) free_skipset();
+    else if (build_skipset(skip_names) < 0) return NULL;
+    if (build_hints(Py_None) < 0) return NULL;
+    if (max_threads < 1) max_threads = 1;
+    if (max_threads > MAXTHRDS) max_threads = MAXTHRDS;
+
+    PyObject *tops = fs_path_list(top, &is_seq);
+    if (!tops) return NULL;
+    if (PyList_GET_SIZE(tops) == 0) {
+        Py_DECREF(tops);
+        PyErr_SetString(PyExc_ValueError, "need at least one path");
+        return NULL;
+    }
+    DirTask **rootTasks = stat_roots(tops);
+    int nroots = (int)PyList_GET_SIZE(tops);
+    Py_DECREF(tops);
+    if (!rootTasks) return NULL;
+
+    ONEFS = one_fs;
+    MAXDEPTH = -1;
+    COUNTBELOW = 0;
+    INODEORDER = 0;
+    PREFETCH = prefetch < 0 ? 0 : prefetch > PREFETCH_MAX ? PREFETCH_MAX : prefetch;
+    ORDER = ORDER_LARGEST;
+    XATTRS = XATTR_NONE;
+    NSTIMES = 0;
+    NAMES = 0;
+    DUDEPTH = max_depth < 0 ? -1 : max_depth;
+    DUAPPARENT = apparent;
+    DUCOUNTLINKS = count_links;
+
+    reset_buffers();
+    strlist_free(&mountPoints);
+    strlist_free(&errorList);
+    free_du_totals();
+
+    /* A root that is not a directory is its own total */
+    int ndirs = 0;
+    for (int r = 0; r < nroots; r++) {
+        if (S_ISDIR(rootTasks[r]->pstat.st_mode)) {
+            rootTasks[ndirs++] = rootTasks[r];
+        } else {
+            du_record(rootTasks[r]->dname, du_usage(&rootTasks[r]->pstat),
+                      rootTasks[r]->pstat.st_mtime);
+            free(rootTasks[r]);
+        }
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    DUMODE = 1;
+    scan_roots(rootTasks, ndirs, max_threads);
+    DUMODE = 0;
+    Py_END_ALLOW_THREADS
+
+    free_seen_inodes();
+
+    PyObject *totals = PyList_New(0);
+    for (size_t i = 0; totals && i < duCnt; i++) {
+        PyObject *item = Py_BuildValue("(O&K)", PyUnicode_DecodeFSDefault, duTotals[i].path,
+                                       (unsigned long long)duTotals[i].bytes);
+        if (!item || PyList_Append(totals, item) < 0) Py_CLEAR(totals);
+        Py_XDECREF(item);
+    }
+    free_du_totals();
+
+    PyObject *errors = strlist_to_py(&errorList);
+    PyObject *mounts = strlist_to_py(&mountPoints);
+    if (!totals || !errors || !mounts) {
+        Py_XDECREF(totals);
+        Py_XDECREF(errors);
+        Py_XDECREF(mounts);
+        return NULL;
+    }
+    return Py_BuildValue("{s:N,s:N,s:N}", "totals", totals, "errors", errors,
+                         "mountpoints", mounts);
+}
+
+/* ------------------------------------------------------------------ */
+/* estimate_totals: approximate file counts and bytes. The top levels are
+ * read in full; every directory at the first level below them is a
+ * stratum sampled by random probes (Knuth, "Estimating the efficiency of
+ * backtrack programs", 1975). A probe reads one directory per level and
+ * descends into a uniformly chosen subdirectory, weighting what it sees by
+ * the product of the branching factors on its way down; that makes each
+ * probe an unbiased estimate of the stratum's totals. */
+
+enum { EST_FILES, EST_DIRS, EST_BYTES, EST_BLOCKS, EST_NSTATS };
+
+static StrList estLevel = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0 };
+static StrList estNextLevel = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0 };
+static size_t estNext = 0;
+static int estProbes = 16;
+static uint64_t estSeed = 0;
+static dev_t estDev;
+
+typedef struct {
+    int64_t exact[EST_NSTATS];
+    double sum[EST_NSTATS], var[EST_NSTATS];
+    long reads, probeErrors;
+} EstCounters;
+static EstCounters estCounters[MAXTHRDS];
+
+static uint64_t splitmix64(uint64_t *state) {
+    return mix64(*state += 0x9e3779b97f4a7c15ULL);
+}
+
+/* Read one directory: totals of its entries into stats and the number of
+ * subdirectories. With next set, the subdirectories are queued on it;
+ * with pick set, one of them is chosen uniformly (reservoir sampling)
+ * into pick. Returns -1 (errno set) if the directory cannot be read. */
+static long est_read_dir(const char *path, int64_t *stats, StrList *next, uint64_t *rng,
+                         char *pick) {
+    DIR *dir = opendir(path);
+    if (!dir) return -1;
+
+    struct dirent *d;
+    char fullpath[MAXPATH];
+    long nsub = 0;
+    int dfd = dirfd(dir);
+    while ((d = readdir(dir)) != NULL) {
+        if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) continue;
+
+        struct stat f;
+        if (fstatat(dfd, d->d_name, &f, AT_SYMLINK_NOFOLLOW) != 0) continue;
+        if (S_ISDIR(f.st_mode) && skip_name(d->d_name)) continue;
+        stats[S_ISDIR(f.st_mode) ? EST_DIRS : EST_FILES]++;
+        stats[EST_BYTES] += f.st_size;
+        stats[EST_BLOCKS] += (int64_t)f.st_blocks * 512;
+        if (!S_ISDIR(f.st_mode) || (ONEFS && f.st_dev != estDev)) continue;
+        if (snprintf(fullpath, MAXPATH, "%s/%s", path, d->d_name) >= MAXPATH) continue;
+
+        nsub++;
+        if (next) strlist_add(next, fullpath);
+        if (pick && splitmix64(rng) % nsub == 0) strcpy(pick, fullpath);
+    }
+    closedir(dir);
+    return nsub;
+}
+
+/* Exact pass over one level of the top directories */
+static void *est_level_worker(void *arg) {
+    EstCounters *c = &estCounters[(ThreadBuffer *)arg - buffers];
+
+    for (;;) {
+        size_t i = __atomic_fetch_add(&estNext, 1, __ATOMIC_RELAXED);
+        if (i >= estLevel.n) break;
+        c->reads++;
+        if (est_read_dir(estLevel.items[i], c->exact, &estNextLevel, NULL, NULL) < 0)
+            record_error(estLevel.items[i], errno);
+    }
+    return NULL;
+}
+
+/* Probes of the strata (the directories left in estLevel) */
+static void *est_probe_worker(void *arg) {
+    EstCounters *c = &estCounters[(ThreadBuffer *)arg - buffers];
+    char path[MAXPATH], pick[MAXPATH];
+
+    for (;;) {
+        size_t s = __atomic_fetch_add(&estNext, 1, __ATOMIC_RELAXED);
+        if (s >= estLevel.n) break;
+
+        /* Seeded per stratum, so results do not depend on scheduling */
+        uint64_t rng = estSeed ^ (s * 0xd6e8feb86659fd93ULL);
+        double mean[EST_NSTATS] = {0}, m2[EST_NSTATS] = {0};
+        for (int k = 1; k <= estProbes; k++) {
+            double total[EST_NSTATS] = {0}, weight = 1;
+            strcpy(path, estLevel.items[s]);
+            for (;;) {
+                int64_t stats[EST_NSTATS] = {0};
+                long nsub = est_read_dir(path, stats, NULL, &rng, pick);
+                c->reads++;
+                if (nsub < 0) {
+                    c->probeErrors++;
+                    break;
+                }
+                for (int j = 0; j < EST_NSTATS; j++) total[j] += weight * stats[j];
+                if (nsub == 0) break;
+                weight *= nsub;
+                strcpy(path, pick);
+            }
+            /* Welford's running mean and variance over the probes */
+            for (int j = 0; j < EST_NSTATS; j++) {
+                double delta = total[j] - mean[j];
+                mean[j] += delta / k;
+                m2[j] += delta * (total[j] - mean[j]);
+            }
+        }
+        /* Variance of the stratum mean is s^2 / probes */
+        for (int j = 0; j < EST_NSTATS; j++) {
+            c->sum[j] += mean[j];
+            c->var[j] += m2[j] / (estProbes - 1) / estProbes;
+        }
+    }
+    return NULL;
+}
+
+static PyObject* estimate_totals(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"top", "max_threads", "full_depth", "probes", "seed",
+                             "one_filesystem", "skip_names", NULL};
+    PyObject *top_obj, *skip_names = Py_None;
+    int max_threads = 8, full_depth = 2, probes = 16, one_fs = 0;
+    unsigned long long seed = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O&|iiiKpO", kwlist, PyUnicode_FSConverter,
+                                     &top_obj, &max_threads, &full_depth, &probes, &seed,
+                                     &one_fs, &skip_names)) {
+        return NULL;
+    }
+    if (probes < 2 || full_depth < 0) {
+        Py_DECREF(top_obj);
+        PyErr_SetString(PyExc_ValueError, "need probes >= 2 and full_depth >= 0");
+        return NULL;
+    }
+    if (skip_names == Py_None) free_skipset();
+    else if (build_skipset(skip_names) < 0) {
+        Py_DECREF(top_obj);
+        return NULL;
+    }
+    if (max_threads < 1) max_threads = 1;
+    if (max_threads > MAXTHRDS) max_threads = MAXTHRDS;
+
+    const char *top = PyBytes_AS_STRING(top_obj);
+    struct stat st;
+    int err = lstat(top, &st) != 0 ? errno : S_ISDIR(st.st_mode) ? 0 : ENOTDIR;
+    if (err) {
+        errno = err;
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, top);
+        Py_DECREF(top_obj);
+        return NULL;
+    }
+
+    ONEFS = one_fs;
+    NAMES = 0;
+    estDev = st.st_dev;
+    estProbes = probes;
+    estSeed = seed;
+    memset(estCounters, 0, sizeof(estCounters));
+    strlist_free(&errorList);
+    strlist_free(&estLevel);
+    strlist_free(&estNextLevel);
+    strlist_add(&estLevel, top);
+    estCounters[0].exact[EST_DIRS] = 1;
+    estCounters[0].exact[EST_BYTES] = st.st_size;
+    estCounters[0].exact[EST_BLOCKS] = (int64_t)st.st_blocks * 512;
+
+    size_t strata;
+    Py_BEGIN_ALLOW_THREADS
+    for (int level = 0; level < full_depth && estLevel.n; level++) {
+        estNext = 0;
+        run_workers(est_level_worker, max_threads);
+        strlist_free(&estLevel);
+        StrList swap = estLevel;
+        estLevel = estNextLevel;
+        estNextLevel = swap;
+    }
+    strata = estLevel.n;
+    estNext = 0;
+    run_workers(est_probe_worker, max_threads);
+    strlist_free(&estLevel);
+    Py_END_ALLOW_THREADS
+
+    EstCounters total = {0};
+    for (int t = 0; t < MAXTHRDS; t++) {
+        for (int j = 0; j < EST_NSTATS; j++) {
+            total.exact[j] += estCounters[t].exact[j];
+            total.sum[j] += estCounters[t].sum[j];
+            total.var[j] += estCounters[t].var[j];
+        }
+        total.reads += estCounters[t].reads;
+        total.probeErrors += estCounters[t].probeErrors;
+    }
+    Py_DECREF(top_obj);
+
+    static const char *names[EST_NSTATS] = { "files", "dirs", "bytes", "disk_bytes" };
+    PyObject *exact = PyDict_New(), *estimate = PyDict_New(), *variance = PyDict_New();
+    for (int j = 0; exact && estimate && variance && j < EST_NSTATS; j++) {
+        PyObject *e = PyLong_FromLongLong(total.exact[j]);
+        PyObject *m = PyFloat_FromDouble(total.exact[j] + total.sum[j]);
+        PyObject *v = PyFloat_FromDouble(total.var[j]);
+        if (!e || !m || !v || PyDict_SetItemString(exact, names[j], e) < 0 ||
+            PyDict_SetItemString(estimate, names[j], m) < 0 ||
+            PyDict_SetItemString(variance, names[j], v) < 0)
+            Py_CLEAR(exact);
+        Py_XDECREF(e);
+        Py_XDECREF(m);
+        Py_XDECREF(v);
+    }
+    PyObject *errors = strlist_to_py(&errorList);
+    if (!exact || !estimate || !variance || !errors) {
+        Py_XDECREF(exact);
+        Py_XDECREF(estimate);
+        Py_XDECREF(variance);
+        Py_XDECREF(errors);
+        return NULL;
+    }
+    return Py_BuildValue("{s:N,s:N,s:N,s:n,s:i,s:l,s:l,s:N}", "exact", exact,
+                         "estimate", estimate, "variance", variance, "strata",
+                         (Py_ssize_t)strata, "probes", probes, "reads", total.reads,
+                         "probe_errors", total.probeErrors, "errors", errors);
+}
+
+/* Path order with '/' below every other byte, so that the paths under a
+ * directory sort right after it */
+static int path_tree_cmp(const void *pa, const void *pb) {
+    const unsigned char *a = (const unsigned char *)((const DuTotal *)pa)->path;
+    const unsigned char *b = (const unsigned char *)((const DuTotal *)pb)->path;
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    int ca = *a == '/' ? 1 : *a ? *a + 1 : 0;
+    int cb = *b == '/' ? 1 : *b ? *b + 1 : 0;
+    return ca - cb;
+}
+
+/* cold_totals: the largest subtrees not used since a cutoff time */
+static PyObject* cold_totals(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"top", "cutoff", "min_size", "max_threads", "use_atime",
+                             "apparent_size", "one_filesystem", "skip_names", NULL};
+    PyObject *top, *skip_names = Py_None;
+    long long cutoff;
+    unsigned long long min_size = 0;
+    int max_threads = 8, use_atime = 1, apparent = 0, one_fs = 0, is_seq;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OL|KipppO", kwlist, &top, &cutoff,
+                                     &min_size, &max_threads, &use_atime, &apparent, &one_fs,
+                                     &skip_names)) {
+        return NULL;
+    }
+    if (skip_names == Py_None) free_skipset();
+    else if (build_skipset(skip_names) < 0) return NULL;
+    if (build_hints(Py_None) < 0) return NULL;
+    if (max_threads < 1) max_threads = 1;
+    if (max_threads > MAXTHRDS) max_threads = MAXTHRDS;
+
+    PyObject *tops = fs_path_list(top, &is_seq);
+    if (!tops) return NULL;
+    if (PyList_GET_SIZE(tops) == 0) {
+        Py_DECREF(tops);
+        PyErr_SetString(PyExc_ValueError, "need at least one path");
+        return NULL;
+    }
+    DirTask **rootTasks = stat_roots(tops);
+    int nroots = (int)PyList_GET_SIZE(tops);
+    Py_DECREF(tops);
+    if (!rootTasks) return NULL;
+
+    ONEFS = one_fs;
+    MAXDEPTH = -1;
+    COUNTBELOW = 0;
+    INODEORDER = 0;
+    PREFETCH = 0;
+    ORDER = ORDER_LARGEST;
+    XATTRS = XATTR_NONE;
+    NSTIMES = 0;
+    NAMES = 0;
+    DUDEPTH = -1;
+    DUAPPARENT = apparent;
+    DUCOUNTLINKS = 0;
+    coldCutoff = cutoff;
+    coldMinSize = min_size;
+
+    reset_buffers();
+    strlist_free(&mountPoints);
+    strlist_free(&errorList);
+    free_du_totals();
+
+    /* Only directories are candidates */
+    int ndirs = 0;
+    for (int r = 0; r < nroots; r++) {
+        if (S_ISDIR(rootTasks[r]->pstat.st_mode)) rootTasks[ndirs++] = rootTasks[r];
+        else free(rootTasks[r]);
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    DUMODE = 1;
+    COLDMODE = use_atime ? COLD_BOTH : COLD_MTIME;
+    scan_roots(rootTasks, ndirs, max_threads);
+    COLDMODE = COLD_NONE;
+    DUMODE = 0;
+
+    /* Keep the maximal subtrees: drop those under another cold directory */
+    qsort(duTotals, duCnt, sizeof(DuTotal), path_tree_cmp);
+    size_t kept = 0;
+    for (size_t i = 0; i < duCnt; i++) {
+        if (kept) {
+            const char *top_path = duTotals[kept - 1].path;
+            size_t len = strlen(top_path);
+            if (strncmp(duTotals[i].path, top_path, len) == 0 &&
+                (duTotals[i].path[len] == '/' || (len && top_path[len - 1] == '/'))) {
+                free(duTotals[i].path);
+                continue;
+            }
+        }
+        duTotals[kept++] = duTotals[i];
+    }
+    duCnt = kept;
+    Py_END_ALLOW_THREADS
+
+    free_seen_inodes();
+
+    PyObject *rows = PyList_New(0);
+    for (size_t i = 0; rows && i < duCnt; i++) {
+        PyObject *item = Py_BuildValue("(O&KL)", PyUnicode_DecodeFSDefault, duTotals[i].path,
+                                       (unsigned long long)duTotals[i].bytes,
+                                       (long long)duTotals[i].newest);
+        if (!item || PyList_Append(rows, item) < 0) Py_CLEAR(rows);
+        Py_XDECREF(item);
+    }
+    free_du_totals();
+
+    PyObject *errors = strlist_to_py(&errorList);
+    PyObject *mounts = strlist_to_py(&mountPoints);
+    if (!rows || !errors || !mounts) {
+        Py_XDECREF(rows);
+        Py_XDECREF(errors);
+        Py_XDECREF(mounts);
+        return NULL;
+    }
+    return Py_BuildValue("{s:N,s:N,s:N}", "rows", rows, "errors", errors, "mountpoints", mounts);
+}
+
+static void free_find_preds(void) {
+    for (int i = 0; i < nFindPreds; i++) free(findPreds[i].pattern);
+    free(findPreds);
+    findPreds = NULL;
+    nFindPreds = 0;
+}
+
+/* Compile [(kind, cmp, value, unit, pattern or None), ...] into findPreds */
+static int build_find_preds(PyObject *preds) {
+    PyObject *seq = PySequence_Fast(preds, "predicates must be a sequence");
+    if (!seq) return -1;
+
+    free_find_preds();
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    findPreds = calloc(n ? n : 1, sizeof(FindPred));
+    if (!findPreds) {
+        Py_DECREF(seq);
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (Py_ssize_t i = 0; i < n; i++) {
+        FindPred *p = &findPreds[nFindPreds];
+        long long value, unit;
+        PyObject *pattern;
+
+        if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(seq, i), "iiLLO", &p->kind, &p->cmp,
+                              &value, &unit, &pattern)) {
+            free_find_preds();
+            Py_DECREF(seq);
+            return -1;
+        }
+        if (p->kind < PRED_NAME || p->kind > PRED_NEWER || unit < 1) {
+            PyErr_Format(PyExc_ValueError, "invalid predicate %zd", i);
+            free_find_preds();
+            Py_DECREF(seq);
+            return -1;
+        }
+        p->value = value;
+        p->unit = unit;
+        if (pattern != Py_None) {
+            PyObject *bytes;
+            if (!PyUnicode_FSConverter(pattern, &bytes)) {
+                free_find_preds();
+                Py_DECREF(seq);
+                return -1;
+            }
+            p->pattern = strdup(PyBytes_AS_STRING(bytes));
+            Py_DECREF(bytes);
+        }
+        nFindPreds++;
+        if ((p->kind == PRED_NAME || p->kind == PRED_INAME) && !p->pattern) {
+            PyErr_SetString(PyExc_ValueError, "name predicates need a pattern");
+            free_find_preds();
+            Py_DECREF(seq);
+            return -1;
+        }
+    }
+    Py_DECREF(seq);
+    return 0;
+}
+
+/* find_paths: write the paths matching all predicates, one per line */
+static PyObject* find_paths(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"top", "output", "predicates", "max_threads", "max_depth",
+                             "one_filesystem", "skip_names", "print0", NULL};
+    PyObject *top, *output, *preds, *skip_names = Py_None;
+    int max_threads = 8, one_fs = 0, print0 = 0, is_seq;
+    long max_depth = -1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOO|ilpOp", kwlist, &top, &output, &preds,
+                                     &max_threads, &max_depth, &one_fs, &skip_names, &print0)) {
+        return NULL;
+    }
+    if (build_find_preds(preds) < 0) return NULL;
+    if (skip_names == Py_None) free_skipset();
+    else if (build_skipset(skip_names) < 0) return NULL;
+    if (build_hints(Py_None) < 0) return NULL;
+    if (max_threads < 1) max_threads = 1;
+    if (max_threads > MAXTHRDS) max_threads = MAXTHRDS;
+
+    PyObject *tops = fs_path_list(top, &is_seq);
+    if (!tops) return NULL;
+    PyObject *outputs = fs_path_list(output, &is_seq);
+    if (!outputs) {
+        Py_DECREF(tops);
+        return NULL;
+    }
+    int nroots = (int)PyList_GET_SIZE(tops);
+    if (nroots == 0 || PyList_GET_SIZE(outputs) != 1) {
+        PyErr_SetString(PyExc_ValueError, "need at least one path and exactly one output");
+        Py_DECREF(tops);
+        Py_DECREF(outputs);
+        return NULL;
+    }
+    DirTask **rootTasks = stat_roots(tops);
+    Py_DECREF(tops);
+    if (!rootTasks) {
+        Py_DECREF(outputs);
+        return NULL;
+    }
+
+    ONEFS = one_fs;
+    MAXDEPTH = max_depth < 0 ? -1 : max_depth;
+    COUNTBELOW = 0;
+    INODEORDER = 0;
+    PREFETCH = 0;
+    ORDER = ORDER_LARGEST;
+    XATTRS = XATTR_NONE;
+    NSTIMES = 0;
+    NAMES = 0;
+    ROOTIDS = 0;
+    FULLPATHS = 0;
+    FINDMODE = 1;
+    findSep = print0 ? '\0' : '\n';
+    findNow = time(NULL);
+    findCount = 0;
+
+    int rc = open_sinks(outputs, 0);
+    Py_DECREF(outputs);
+    if (rc < 0) {
+        FINDMODE = 0;
+        for (int r = 0; r < nroots; r++) free(rootTasks[r]);
+        free(rootTasks);
+        return NULL;
+    }
+
+    reset_buffers();
+    strlist_free(&mountPoints);
+    strlist_free(&errorList);
+
+    Py_BEGIN_ALLOW_THREADS
+    scan_roots(rootTasks, nroots, max_threads);
+    Py_END_ALLOW_THREADS
+
+    close_sinks();
+    FINDMODE = 0;
+    free_find_preds();
+
+    PyObject *errors = strlist_to_py(&errorList);
+    PyObject *mounts = strlist_to_py(&mountPoints);
+    if (!errors || !mounts) {
+        Py_XDECREF(errors);
+        Py_XDECREF(mounts);
+        return NULL;
+    }
+    return Py_BuildValue("{s:O,s:l,s:N,s:N}", "output", output, "count", findCount,
+                         "errors", errors, "mountpoints", mounts);
+}
+
+/* Query engine: group-by aggregates over a scan file. Units of work are
+ * zstd frames (every flush is an independent frame) or newline-aligned
+ * chunks of a plain CSV; each worker aggregates into its own hash table
+ * and the tables are merged at the end. */
+#define AGG_COUNT 0
+#define AGG_SUM   1
+#define AGG_MIN   2
+#define AGG_MAX   3
+#define AGG_AVG   4          /* sum over the values that parsed */
+#define MAXQCOLS  16         /* group-by columns, and aggregates */
+#define MAXQFIELD 256        /* scan columns a query can refer to */
+#define QUERY_CHUNK (8 << 20)  /* plain CSV bytes per unit of work */
+#define MAXQKEY   (64 << 10)
+
+typedef struct {
+    int64_t count;           /* 0: empty slot */
+    uint64_t hash;
+    size_t keyOff, keyLen;   /* into the table's arena */
+    int64_t acc[MAXQCOLS];
+    int64_t nvals[MAXQCOLS]; /* values that parsed, per aggregate */
+} AggEntry;
+
+typedef struct {
+    AggEntry *slots;
+    size_t mask, n;
+    char *arena;
+    size_t arenaUsed, arenaCap;
+    int failed;              /* out of memory */
+} AggTable;
+
+typedef struct {
+    const char *data;
+    size_t len;
+    int header;              /* first line is the CSV header */
+} QueryUnit;
+
+static int qNGroup, qNAgg, qMaxCol, qCompressed;
+static int qGroupCols[MAXQCOLS], qAggFunc[MAXQCOLS], qAggCols[MAXQCOLS];
+static QueryUnit *qUnits = NULL;
+static size_t qNUnits = 0, qNext = 0;
+static AggTable qTables[MAXTHRDS];
+
+static uint64_t bytes_hash(const char *p, size_t n) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < n; i++) {
+        h ^= (unsigned char)p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static void agg_free(AggTable *t) {
+    free(t->slots);
+    free(t->arena);
+    memset(t, 0, sizeof(*t));
+}
+
+/* Find or add the group with this key; NULL when out of memory */
+static AggEntry *agg_lookup(AggTable *t, const char *key, size_t len, uint64_t h) {
+    if (2 * (t->n + 1) > t->mask + 1) {
+        size_t ncap = t->slots ? 2 * (t->mask + 1) : 1024;
+        AggEntry *slots = calloc(ncap, sizeof(AggEntry));
+        if (!slots) return NULL;
+        for (size_t i = 0; t->slots && i <= t->mask; i++) {
+            if (!t->slots[i].count) continue;
+            size_t j = t->slots[i].hash & (ncap - 1);
+            while (slots[j].count) j = (j + 1) & (ncap - 1);
+            slots[j] = t->slots[i];
+        }
+        free(t->slots);
+        t->slots = slots;
+        t->mask = ncap - 1;
+    }
+
+    size_t i = h & t->mask;
+    while (t->slots[i].count) {
+        AggEntry *e = &t->slots[i];
+        if (e->hash == h && e->keyLen == len && memcmp(t->arena + e->keyOff, key, len) == 0)
+            return e;
+        i = (i + 1) & t->mask;
+    }
+
+    if (t->arenaUsed + len > t->arenaCap) {
+        size_t ncap = t->arenaCap ? t->arenaCap : 65536;
+        while (ncap < t->arenaUsed + len) ncap *= 2;
+        char *arena = realloc(t->arena, ncap);
+        if (!arena) return NULL;
+        t->arena = arena;
+        t->arenaCap = ncap;
+    }
+    AggEntry *e = &t->slots[i];
+    memcpy(t->arena + t->arenaUsed, key, len);
+    e->hash = h;
+    e->keyOff = t->arenaUsed;
+    e->keyLen = len;
+    for (int a = 0; a < qNAgg; a++) {
+        e->acc[a] = qAggFunc[a] == AGG_MIN ? INT64_MAX : qAggFunc[a] == AGG_MAX ? INT64_MIN : 0;
+        e->nvals[a] = 0;
+    }
+    t->arenaUsed += len;
+    t->n++;
+    return e;
+}
+
+/* Skip a quoted field starting after its opening quote; returns the closing quote */
+static const char *skip_quoted(const char *p, const char *end) {
+    for (;;) {
+        const char *q = memchr(p, '"', end - p);
+        if (!q) return end;
+        if (q + 1 < end && q[1] == '"') {
+            p = q + 2;
+            continue;
+        }
+        return q;
+    }
+}
+
+/* Split one CSV line into the first qMaxCol + 1 fields (quotes stripped);
+ * the rest of the line is skipped without being parsed. Returns the start
+ * of the next line. */
+static const char *parse_fields(const char *p, const char *end, const char **fields,
+                                size_t *lens) {
+    for (int col = 0; col <= qMaxCol; col++) {
+        fields[col] = "";
+        lens[col] = 0;
+    }
+    for (int col = 0; p < end; col++) {
+        const char *start = p;
+        size_t len;
+
+        if (*p == '"') {
+            start = ++p;
+            p = skip_quoted(p, end);
+            len = p - start;
+            if (p < end) p++;
+        } else {
+            p = find2(p, end, ',', '\n');
+            len = p - start;
+        }
+        if (col <= qMaxCol) {
+            fields[col] = start;
+            lens[col] = len;
+        }
+        if (p >= end) return end;
+        if (*p == '\n') return p + 1;
+        p++;
+
+        if (col == qMaxCol) {
+            /* Projection: jump to the end of the line, minding quoted newlines */
+            for (;;) {
+                const char *q = find2(p, end, '\n', '"');
+                if (q >= end) return end;
+                if (*q == '\n') return q + 1;
+                p = skip_quoted(q + 1, end);
+                if (p < end) p++;
+            }
+        }
+    }
+    return end;
+}
+
+/* Parse a whole field as a decimal integer; 0 if it is anything else */
+static int parse_int(const char *p, size_t len, int64_t *v) {
+    int neg = len && *p == '-';
+    size_t i = neg;
+    int64_t x = 0;
+
+    if (i >= len) return 0;
+    for (; i < len && p[i] >= '0' && p[i] <= '9'; i++) x = x * 10 + (p[i] - '0');
+    if (i < len) return 0;
+    *v = neg ? -x : x;
+    return 1;
+}
+
+static void aggregate_text(AggTable *t, const char *p, const char *end) {
+    const char *fields[MAXQFIELD];
+    size_t lens[MAXQFIELD];
+    char key[MAXQKEY];
+
+    while (p < end && !t->failed) {
+        p = parse_fields(p, end, fields, lens);
+
+        /* Key: each group-by value prefixed with its length */
+        size_t klen = 0;
+        for (int g = 0; g < qNGroup; g++) {
+            uint32_t n = (uint32_t)lens[qGroupCols[g]];
+            if (klen + sizeof(n) + n > sizeof(key)) n = sizeof(key) - klen - sizeof(n);
+            memcpy(key + klen, &n, sizeof(n));
+            memcpy(key + klen + sizeof(n), fields[qGroupCols[g]], n);
+            klen += sizeof(n) + n;
+        }
+        AggEntry *e = agg_lookup(t, key, klen, bytes_hash(key, klen));
+        if (!e) {
+            t->failed = 1;
+            return;
+        }
+        e->count++;
+        for (int a = 0; a < qNAgg; a++) {
+            int64_t v;
+            if (qAggFunc[a] == AGG_COUNT ||
+                !parse_int(fields[qAggCols[a]], lens[qAggCols[a]], &v))
+                continue;
+            e->nvals[a]++;
+            if (qAggFunc[a] == AGG_SUM || qAggFunc[a] == AGG_AVG) e->acc[a] += v;
+            else if (qAggFunc[a] == AGG_MIN && v < e->acc[a]) e->acc[a] = v;
+            else if (qAggFunc[a] == AGG_MAX && v > e->acc[a]) e->acc[a] = v;
+        }
+    }
+}
+
+static void aggregate_merge(AggTable *into, const AggTable *from) {
+    for (size_t i = 0; from->slots && i <= from->mask && !into->failed; i++) {
+        const AggEntry *src = &from->slots[i];
+        if (!src->count) continue;
+        AggEntry *e = agg_lookup(into, from->arena + src->keyOff, src->keyLen, src->hash);
+        if (!e) {
+            into->failed = 1;
+            return;
+        }
+        e->count += src->count;
+        for (int a = 0; a < qNAgg; a++) {
+            e->nvals[a] += src->nvals[a];
+            if (qAggFunc[a] == AGG_SUM || qAggFunc[a] == AGG_AVG) e->acc[a] += src->acc[a];
+            else if (qAggFunc[a] == AGG_MIN && src->acc[a] < e->acc[a]) e->acc[a] = src->acc[a];
+            else if (qAggFunc[a] == AGG_MAX && src->acc[a] > e->acc[a]) e->acc[a] = src->acc[a];
+        }
+    }
+}
+
+/* Length of the top-level directory path is under; the root itself for
+ * files directly in it */
+static size_t top_dir_len(int root, const char *path, const struct stat *st) {
+    const char *end = path + rootLens[root];
+    while (*end == '/') end++;
+    const char *slash = strchr(end, '/');
+    if (slash) end = slash;
+    else if (*end && S_ISDIR(st->st_mode)) end += strlen(end);
+    else end = path + rootLens[root];
+    return end - path < MAXPATH ? (size_t)(end - path) : MAXPATH;
+}
+
+/* Merge the per-thread tables into tables[0]; -1 when out of memory */
+static int merge_tables(AggTable *tables) {
+    for (int i = 1; i < MAXTHRDS; i++) {
+        if (tables[i].failed) tables[0].failed = 1;
+        aggregate_merge(&tables[0], &tables[i]);
+        agg_free(&tables[i]);
+    }
+    if (!tables[0].failed) return 0;
+    agg_free(&tables[0]);
+    return -1;
+}
+
+/* Count a record in this thread's extension table. Regular files are keyed
+ * by their lowercased extension; other types by the type alone. */
+static void ext_record(ThreadBuffer *buf, int root, const char *path, const char *ext,
+                       const struct stat *st) {
+    AggTable *t = &qTables[buf - buffers];
+    char key[MAXPATH + 512];
+    size_t klen = 0;
+
+    if (t->failed) return;
+    if (EXTSTATS == EXT_BY_TOP) {
+        uint32_t n = (uint32_t)top_dir_len(root, path, st);
+        memcpy(key, &n, sizeof(n));
+        memcpy(key + sizeof(n), path, n);
+        klen = sizeof(n) + n;
+    }
+
+    mode_t type = st->st_mode & S_IFMT;
+    key[klen++] = type == S_IFREG ? 'f' : type == S_IFDIR ? 'd' : type == S_IFLNK ? 'l' :
+                  type == S_IFIFO ? 'p' : type == S_IFSOCK ? 's' : type == S_IFCHR ? 'c' :
+                  type == S_IFBLK ? 'b' : '?';
+    for (size_t i = 0; type == S_IFREG && ext[i] && i < 255; i++) {
+        char c = ext[i];
+        key[klen++] = c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+    }
+
+    AggEntry *e = agg_lookup(t, key, klen, bytes_hash(key, klen));
+    if (!e) {
+        t->failed = 1;
+        return;
+    }
+    e->count++;
+    e->acc[0] += st->st_size;
+    e->acc[1] += (int64_t)st->st_blocks * 512;
+}
+
+/* Set up the per-thread tables for ext_record */
+static void ext_reset(int mode) {
+    for (int i = 0; i < MAXTHRDS; i++) agg_free(&qTables[i]);
+    EXTSTATS = mode;
+    qNAgg = 2;
+    qAggFunc[0] = qAggFunc[1] = AGG_SUM;
+}
+
+/* Merge the per-thread tables into a list of
+ * (top-level directory or None, type, extension, count, bytes, disk bytes) */
+static PyObject *ext_collect(void) {
+    int mode = EXTSTATS;
+    EXTSTATS = EXT_NONE;
+    if (merge_tables(qTables) < 0) return PyErr_NoMemory();
+    AggTable *t = &qTables[0];
+
+    PyObject *rows = PyList_New(0);
+    for (size_t i = 0; rows && t->slots && i <= t->mask; i++) {
+        AggEntry *e = &t->slots[i];
+        if (!e->count) continue;
+        const char *k = t->arena + e->keyOff, *kend = k + e->keyLen;
+        PyObject *top = Py_None;
+        Py_INCREF(top);
+        if (mode == EXT_BY_TOP) {
+            uint32_t n;
+            memcpy(&n, k, sizeof(n));
+            Py_DECREF(top);
+            top = PyUnicode_DecodeFSDefaultAndSize(k + sizeof(n), n);
+            k += sizeof(n) + n;
+        }
+        PyObject *ext = top ? PyUnicode_DecodeFSDefaultAndSize(k + 1, kend - k - 1) : NULL;
+        PyObject *row = ext ? Py_BuildValue("(Os#OLLL)", top, k, (Py_ssize_t)1, ext,
+                                            (long long)e->count, (long long)e->acc[0],
+                                            (long long)e->acc[1]) : NULL;
+        Py_XDECREF(ext);
+        Py_XDECREF(top);
+        if (!row || PyList_Append(rows, row) < 0) Py_CLEAR(rows);
+        Py_XDECREF(row);
+    }
+    agg_free(t);
+    return rows;
+}
+
+/* Per-thread tables of the scan summary, keyed 'u' + uid, 'g' + gid or
+ * 't' + top-level directory path; same sums as the extension tables */
+static AggTable sumTables[MAXTHRDS];
+
+static void sum_add(AggTable *t, const char *key, size_t klen, const struct stat *st) {
+    AggEntry *e = agg_lookup(t, key, klen, bytes_hash(key, klen));
+    if (!e) {
+        t->failed = 1;
+        return;
+    }
+    e->count++;
+    e->acc[0] += st->st_size;
+    e->acc[1] += (int64_t)st->st_blocks * 512;
+}
+
+static void sum_record(ThreadBuffer *buf, int root, const char *path, const struct stat *st) {
+    AggTable *t = &sumTables[buf - buffers];
+    char key[MAXPATH + 1];
+    uint32_t id;
+
+    if (t->failed) return;
+    key[0] = 'u';
+    id = st->st_uid;
+    memcpy(key + 1, &id, sizeof(id));
+    sum_add(t, key, 1 + sizeof(id), st);
+    key[0] = 'g';
+    id = st->st_gid;
+    memcpy(key + 1, &id, sizeof(id));
+    sum_add(t, key, 1 + sizeof(id), st);
+    key[0] = 't';
+    size_t n = top_dir_len(root, path, st);
+    memcpy(key + 1, path, n);
+    sum_add(t, key, 1 + n, st);
+}
+
+static void sum_reset(void) {
+    for (int i = 0; i < MAXTHRDS; i++) agg_free(&sumTables[i]);
+    SUMMARY = 1;
+    qNAgg = 2;
+    qAggFunc[0] = qAggFunc[1] = AGG_SUM;
+}
+
+/* Merge the summary into a list of (kind, key, count, bytes, disk bytes):
+ * kind "user" or "group" with a numeric id, or "top" with a path */
+static PyObject *sum_collect(void) {
+    SUMMARY = 0;
+    if (merge_tables(sumTables) < 0) return PyErr_NoMemory();
+    AggTable *t = &sumTables[0];
+
+    PyObject *rows = PyList_New(0);
+    for (size_t i = 0; rows && t->slots && i <= t->mask; i++) {
+        AggEntry *e = &t->slots[i];
+        if (!e->count) continue;
+        const char *k = t->arena + e->keyOff;
+        PyObject *row;
+        if (k[0] == 't') {
+            PyObject *top = PyUnicode_DecodeFSDefaultAndSize(k + 1, e->keyLen - 1);
+            row = top ? Py_BuildValue("(sNLLL)", "top", top, (long long)e->count,
+                                      (long long)e->acc[0], (long long)e->acc[1]) : NULL;
+        } else {
+            uint32_t id;
+            memcpy(&id, k + 1, sizeof(id));
+            row = Py_BuildValue("(skLLL)", k[0] == 'u' ? "user" : "group", (unsigned long)id,
+                                (long long)e->count, (long long)e->acc[0], (long long)e->acc[1]);
+        }
+        if (!row || PyList_Append(rows, row) < 0) Py_CLEAR(rows);
+        Py_XDECREF(row);
+    }
+    agg_free(t);
+    return rows;
+}
+
+/* ext_totals: extension statistics of a tree, without writing records */
+static PyObject* ext_totals(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"top", "max_threads", "by_top_dir", "one_filesystem",
+                             "skip_names", "extensions", "summary", NULL};
+    PyObject *top, *skip_names = Py_None;
+    int max_threads = 8, by_top = 0, one_fs = 0, extensions = 1, summary = 0, is_seq;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|ippOpp", kwlist, &top, &max_threads,
+                                     &by_top, &one_fs, &skip_names, &extensions, &summary)) {
+        return NULL;
+    }
+    if (skip_names == Py_None) free_skipset();
+    else if (build_skipset(skip_names) < 0) return NULL;
+    if (build_hints(Py_None) < 0) return NULL;
+    if (max_threads < 1) max_threads = 1;
+    if (max_threads > MAXTHRDS) max_threads = MAXTHRDS;
+
+    PyObject *tops = fs_path_list(top, &is_seq);
+    if (!tops) return NULL;
+    if (PyList_GET_SIZE(tops) == 0) {
+        Py_DECREF(tops);
+        PyErr_SetString(PyExc_ValueError, "need at least one path");
+        return NULL;
+    }
+    DirTask **rootTasks = stat_roots(tops);
+    int nroots = (int)PyList_GET_SIZE(tops);
+    Py_DECREF(tops);
+    if (!rootTasks) return NULL;
+
+    ONEFS = one_fs;
+    MAXDEPTH = -1;
+    COUNTBELOW = 0;
+    INODEORDER = 0;
+    PREFETCH = 0;
+    ORDER = ORDER_LARGEST;
+    XATTRS = XATTR_NONE;
+    NSTIMES = 0;
+    NAMES = 0;
+    ROOTIDS = 0;
+    FULLPATHS = 0;
+
+    reset_buffers();
+    strlist_free(&mountPoints);
+    strlist_free(&errorList);
+    if (extensions) ext_reset(by_top ? EXT_BY_TOP : EXT_BY_EXT);
+    if (summary) sum_reset();
+
+    Py_BEGIN_ALLOW_THREADS
+    EXTMODE = 1;
+    scan_roots(rootTasks, nroots, max_threads);
+    EXTMODE = 0;
+    Py_END_ALLOW_THREADS
+
+    PyObject *rows = extensions ? ext_collect() : Py_BuildValue("[]");
+    PyObject *sums = summary ? sum_collect() : Py_BuildValue("[]");
+    PyObject *errors = strlist_to_py(&errorList);
+    PyObject *mounts = strlist_to_py(&mountPoints);
+    if (!rows || !sums || !errors || !mounts) {
+        Py_XDECREF(rows);
+        Py_XDECREF(sums);
+        Py_XDECREF(errors);
+        Py_XDECREF(mounts);
+        return NULL;
+    }
+    return Py_BuildValue("{s:N,s:N,s:N,s:N}", "rows", rows, "summary", sums, "errors", errors,
+                         "mountpoints", mounts);
+}
+
+/* Per-thread decompression state for compressed scans */
+typedef struct {
+#ifdef HAVE_ZSTD
+    ZSTD_DCtx *zstd;
+#endif
+#ifdef HAVE_LZ4
+    LZ4F_dctx *lz4;
+#endif
+    char *text;
+    size_t cap;
+} FrameDecoder;
+
+#if defined(HAVE_ZSTD) || defined(HAVE_LZ4)
+static int decoder_reserve(FrameDecoder *d, size_t size) {
+    if (size <= d->cap) return 0;
+    char *grown = realloc(d->text, size);
+    if (!grown) return -1;
+    d->text = grown;
+    d->cap = size;
+    return 0;
+}
+#endif
+
+static void decoder_free(FrameDecoder *d) {
+#ifdef HAVE_ZSTD
+    if (d->zstd) ZSTD_freeDCtx(d->zstd);
+#endif
+#ifdef HAVE_LZ4
+    if (d->lz4) LZ4F_freeDecompressionContext(d->lz4);
+#endif
+    free(d->text);
+    memset(d, 0, sizeof(*d));
+}
+
+#ifdef HAVE_LZ4
+/* Size of the LZ4 frame at p, walking its block headers; 0 if malformed */
+static size_t lz4_frame_size(const unsigned char *p, size_t n) {
+    if (n < 7) return 0;
+    unsigned flg = p[4];
+    size_t pos = 6 + ((flg & 0x08) ? 8 : 0) + ((flg & 0x01) ? 4 : 0) + 1;
+    while (pos + 4 <= n) {
+        uint32_t block = p[pos] | p[pos + 1] << 8 | p[pos + 2] << 16 | (uint32_t)p[pos + 3] << 24;
+        pos += 4;
+        if (block == 0) {
+            pos += (flg & 0x04) ? 4 : 0;  /* content checksum */
+            return pos <= n ? pos : 0;
+        }
+        pos += (block & 0x7fffffff) + ((flg & 0x10) ? 4 : 0);
+    }
+    return 0;
+}
+#endif
+
+/* Size of the compressed frame at p; 0 if it is malformed */
+static size_t frame_size(int mode, const char *p, size_t n) {
+#ifdef HAVE_ZSTD
+    if (mode == COMPRESS_ZSTD) {
+        size_t len = ZSTD_findFrameCompressedSize(p, n);
+        return ZSTD_isError(len) ? 0 : len;
+    }
+#endif
+#ifdef HAVE_LZ4
+    if (mode == COMPRESS_LZ4) return lz4_frame_size((const unsigned char *)p, n);
+#endif
+    (void)mode; (void)p; (void)n;
+    return 0;
+}
+
+/* Decompress one frame into d->text; returns its length or -1 */
+static ssize_t decode_unit(FrameDecoder *d, int mode, const QueryUnit *u) {
+#ifdef HAVE_ZSTD
+    if (mode == COMPRESS_ZSTD) {
+        if (!d->zstd && !(d->zstd = ZSTD_createDCtx())) return -1;
+        unsigned long long size = ZSTD_getFrameContentSize(u->data, u->len);
+        if (size != ZSTD_CONTENTSIZE_UNKNOWN && size != ZSTD_CONTENTSIZE_ERROR) {
+            if (decoder_reserve(d, size) < 0) return -1;
+            size_t n = ZSTD_decompressDCtx(d->zstd, d->text, d->cap, u->data, u->len);
+            return ZSTD_isError(n) ? -1 : (ssize_t)n;
+        }
+
+        /* Streamed frame (older scans): no size in the header */
+        ZSTD_inBuffer in = { u->data, u->len, 0 };
+        size_t used = 0;
+        ZSTD_DCtx_reset(d->zstd, ZSTD_reset_session_only);
+        for (;;) {
+            if (used == d->cap && decoder_reserve(d, d->cap ? d->cap * 2 : BUFFER_SIZE) < 0)
+                return -1;
+            ZSTD_outBuffer o = { d->text + used, d->cap - used, 0 };
+            size_t rc = ZSTD_decompressStream(d->zstd, &o, &in);
+            if (ZSTD_isError(rc)) return -1;
+            used += o.pos;
+            if (rc == 0 || (in.pos == in.size && o.pos < o.size)) return (ssize_t)used;
+        }
+    }
+#endif
+#ifdef HAVE_LZ4
+    if (mode == COMPRESS_LZ4) {
+        LZ4F_frameInfo_t info;
+        size_t consumed = u->len, used = 0;
+
+        if (!d->lz4 && LZ4F_isError(LZ4F_createDecompressionContext(&d->lz4, LZ4F_VERSION)))
+            return -1;
+        LZ4F_resetDecompressionContext(d->lz4);
+        if (LZ4F_isError(LZ4F_getFrameInfo(d->lz4, &info, u->data, &consumed))) return -1;
+        if (decoder_reserve(d, info.contentSize ? info.contentSize : BUFFER_SIZE) < 0) return -1;
+
+        const char *src = u->data + consumed, *end = u->data + u->len;
+        for (;;) {
+            size_t out = d->cap - used, in = end - src;
+            size_t rc = LZ4F_decompress(d->lz4, d->text + used, &out, src, &in, NULL);
+            if (LZ4F_isError(rc)) return -1;
+            used += out;
+            src += in;
+            if (rc == 0) return (ssize_t)used;
+            if (src == end && out == 0) return -1;  /* truncated */
+            if (used == d->cap && decoder_reserve(d, d->cap * 2) < 0) return -1;
+        }
+    }
+#endif
+    (void)d; (void)mode; (void)u;
+    return -1;
+}
+
+/* Per-unit callback of scan_worker: thread index and the unit's records */
+static int (*scanText)(int id, const char *p, const char *end);
+static int scanFailed[MAXTHRDS];  /* 1: callback failed (out of memory), 2: corrupt frame */
+
+static void *scan_worker(void *arg) {
+    int id = (int)((ThreadBuffer *)arg - buffers);
+    FrameDecoder dec = {0};
+
+    for (;;) {
+        size_t i = __atomic_fetch_add(&qNext, 1, __ATOMIC_RELAXED);
+        if (i >= qNUnits) break;
+        const QueryUnit *u = &qUnits[i];
+        const char *p = u->data, *end = u->data + u->len;
+
+        if (qCompressed) {
+            ssize_t n = decode_unit(&dec, qCompressed, u);
+            if (n < 0) {
+                scanFailed[id] = 2;
+                break;
+            }
+            p = dec.text;
+            end = dec.text + n;
+        }
+        if (u->header) {
+            const char *nl = memchr(p, '\n', end - p);
+            p = nl ? nl + 1 : end;
+        }
+        if (scanText(id, p, end) < 0) {
+            scanFailed[id] = 1;
+            break;
+        }
+    }
+
+    decoder_free(&dec);
+    return NULL;
+}
+
+/* Run fn over the records of every unit on max_threads threads (GIL
+ * released); returns the worst scanFailed code */
+static int scan_units(int (*fn)(int, const char *, const char *), int max_threads) {
+    int failed = 0;
+
+    scanText = fn;
+    qNext = 0;
+    NAMES = 0;
+    memset(scanFailed, 0, sizeof(scanFailed));
+    run_workers(scan_worker, max_threads);
+    for (int i = 0; i < max_threads; i++)
+        if (scanFailed[i] > failed) failed = scanFailed[i];
+    return failed;
+}
+
+static int aggregate_unit(int id, const char *p, const char *end) {
+    aggregate_text(&qTables[id], p, end);
+    return qTables[id].failed ? -1 : 0;
+}
+
+/* End of a plain-CSV unit that starts at a record and should stop near q:
+ * just past the first newline at or after q outside quotes. The quote state
+ * at q comes from counting the quotes since p, so a quoted name holding a
+ * newline is never split between units. */
+static const char *unit_cut(const char *p, const char *q, const char *end) {
+    int quoted = 0;
+    for (const char *s = p; s < q && (s = memchr(s, '"', q - s)); s++) quoted = !quoted;
+    for (; q < end; q++) {
+        if (*q == '"') quoted = !quoted;
+        else if (*q == '\n' && !quoted) return q + 1;
+    }
+    return end;
+}
+
+/* Add a unit of work; returns -1 when out of memory */
+static int add_unit(size_t *cap, const char *data, size_t len, int header) {
+    if (qNUnits == *cap) {
+        size_t ncap = *cap ? *cap * 2 : 256;
+        QueryUnit *grown = realloc(qUnits, ncap * sizeof(QueryUnit));
+        if (!grown) return -1;
+        qUnits = grown;
+        *cap = ncap;
+    }
+    qUnits[qNUnits].data = data;
+    qUnits[qNUnits].len = len;
+    qUnits[qNUnits].header = header;
+    qNUnits++;
+    return 0;
+}
+
+/* Index of a header column, case-insensitive; -1 if missing */
+static int find_column(PyObject *columns, PyObject *name) {
+    for (Py_ssize_t i = 0; i < PyList_GET_SIZE(columns); i++) {
+        PyObject *lower_a = PyObject_CallMethod(PyList_GET_ITEM(columns, i), "lower", NULL);
+        PyObject *lower_b = lower_a ? PyObject_CallMethod(name, "lower", NULL) : NULL;
+        int eq = lower_b ? PyObject_RichCompareBool(lower_a, lower_b, Py_EQ) : -1;
+        Py_XDECREF(lower_a);
+        Py_XDECREF(lower_b);
+        if (eq < 0) return -2;
+        if (eq) return (int)i;
+    }
+    return -1;
+}
+
+static PyObject *unquote(const char *p, size_t len) {
+    char *tmp = malloc(len + 1);
+    size_t n = 0;
+    if (!tmp) return PyErr_NoMemory();
+    for (size_t i = 0; i < len; i++) {
+        tmp[n++] = p[i];
+        if (p[i] == '"' && i + 1 < len && p[i + 1] == '"') i++;
+    }
+    PyObject *s = PyUnicode_DecodeFSDefaultAndSize(tmp, n);
+    free(tmp);
+    return s;
+}
+
+/* A scan file mapped into memory and cut into units of work (qUnits) */
+typedef struct {
+    const char *map;
+    size_t size;
+    PyObject *columns;  /* header names */
+} ScanFile;
+
+static void scan_close(ScanFile *sf) {
+    free(qUnits);
+    qUnits = NULL;
+    qNUnits = 0;
+    Py_CLEAR(sf->columns);
+    if (sf->map) munmap((void *)sf->map, sf->size);
+    sf->map = NULL;
+}
+
+/* Map a scan written by write_csv and read its header; -1 with an exception set */
+static int scan_open(const char *path, ScanFile *sf) {
+    memset(sf, 0, sizeof(*sf));
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    size_t size = st.st_size;
+    const char *map = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (size && map == MAP_FAILED) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        return -1;
+    }
+    if (map) madvise((void *)map, size, MADV_SEQUENTIAL);
+    sf->map = map;
+    sf->size = size;
+
+    /* Units of work; the header is the first line of the first unit, or
+     * plain text in front of the frames in scans from older versions */
+    static const unsigned char zmagic[4] = { 0x28, 0xb5, 0x2f, 0xfd };
+    static const unsigned char lz4magic[4] = { 0x04, 0x22, 0x4d, 0x18 };
+    const char *end = map + size, *data = map;
+    const char *nl = map ? memchr(map, '\n', size) : NULL;
+    size_t ucap = 0;
+    int oom = 0, plain_header = 0;
+    char *header = NULL;
+    FrameDecoder dec = {0};
+
+    qNUnits = 0;
+    if (nl && end - nl > 4 && memcmp(nl + 1, zmagic, 4) == 0) {
+        plain_header = 1;
+        data = nl + 1;
+    }
+    qCompressed = COMPRESS_NONE;
+    if (end - data >= 4 && memcmp(data, zmagic, 4) == 0) qCompressed = COMPRESS_ZSTD;
+    if (end - data >= 4 && memcmp(data, lz4magic, 4) == 0) qCompressed = COMPRESS_LZ4;
+    if (qCompressed) {
+        const char *codec = qCompressed == COMPRESS_ZSTD ? "zstd" : "lz4";
+#ifndef HAVE_ZSTD
+        if (qCompressed == COMPRESS_ZSTD) {
+            PyErr_Format(PyExc_ValueError, "%s is zstd-compressed; pwalk was built without zstd", path);
+            goto fail;
+        }
+#endif
+#ifndef HAVE_LZ4
+        if (qCompressed == COMPRESS_LZ4) {
+            PyErr_Format(PyExc_ValueError, "%s is lz4-compressed; pwalk was built without lz4", path);
+            goto fail;
+        }
+#endif
+        for (const char *p = data; p < end && !oom; ) {
+            size_t n = frame_size(qCompressed, p, end - p);
+            if (n == 0) {
+                PyErr_Format(PyExc_ValueError, "%s: corrupt %s frame at offset %zd", path, codec,
+                             (Py_ssize_t)(p - map));
+                goto fail;
+            }
+            oom = add_unit(&ucap, p, n, !plain_header && p == data) < 0;
+            p += n;
+        }
+    } else if (map) {
+        plain_header = 1;
+        for (const char *p = nl ? nl + 1 : end; p < end && !oom; ) {
+            const char *q = p + QUERY_CHUNK < end ? unit_cut(p, p + QUERY_CHUNK, end) : end;
+            oom = add_unit(&ucap, p, q - p, 0) < 0;
+            p = q;
+        }
+    }
+    if (oom) {
+        PyErr_NoMemory();
+        goto fail;
+    }
+
+    /* Header line */
+    size_t hlen = 0;
+    if (plain_header && nl) {
+        hlen = nl - map;
+        header = malloc(hlen + 1);
+        if (header) memcpy(header, map, hlen);
+    }
+    else if (qCompressed && qNUnits) {
+        ssize_t n = decode_unit(&dec, qCompressed, &qUnits[0]);
+        if (n < 0) {
+            PyErr_Format(PyExc_ValueError, "%s: cannot decompress the first frame", path);
+            goto fail;
+        }
+        char *hnl = memchr(dec.text, '\n', n);
+        hlen = hnl ? (size_t)(hnl - dec.text) : (size_t)n;
+        header = malloc(hlen + 1);
+        if (header) memcpy(header, dec.text, hlen);
+    }
+    decoder_free(&dec);
+    if (!header) {
+        PyErr_Format(PyExc_ValueError, "%s: no CSV header", path);
+        goto fail;
+    }
+    header[hlen] = '\0';
+
+    /* Column names from the header */
+    sf->columns = PyList_New(0);
+    if (!sf->columns) goto fail;
+    for (const char *p = header, *hend = header + hlen; p <= hend; ) {
+        const char *comma = memchr(p, ',', hend - p);
+        const char *a = p, *b = comma ? comma : hend;
+        if (b > a && *a == '"') a++;
+        if (b > a && b[-1] == '"') b--;
+        PyObject *name = unquote(a, b - a);
+        if (!name || PyList_Append(sf->columns, name) < 0) {
+            Py_XDECREF(name);
+            goto fail;
+        }
+        Py_DECREF(name);
+        if (!comma) break;
+        p = comma + 1;
+    }
+    free(header);
+    return 0;
+
+fail:
+    decoder_free(&dec);
+    free(header);
+    scan_close(sf);
+    return -1;
+}
+
+/* query_scan: group-by aggregates over a scan written by write_csv */
+static PyObject* query_scan(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"scan", "group_by", "aggregates", "max_threads", NULL};
+    PyObject *scan_obj, *group_by, *aggregates, *result = NULL;
+    int max_threads = 8, failed;
+    ScanFile sf;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O&OO|i", kwlist, PyUnicode_FSConverter,
+                                     &scan_obj, &group_by, &aggregates, &max_threads)) {
+        return NULL;
+    }
+    if (max_threads < 1) max_threads = 1;
+    if (max_threads > MAXTHRDS) max_threads = MAXTHRDS;
+
+    const char *path = PyBytes_AS_STRING(scan_obj);
+    if (scan_open(path, &sf) < 0) {
+        Py_DECREF(scan_obj);
+        return NULL;
+    }
+    PyObject *columns = sf.columns;
+
+    /* Resolve group-by columns and aggregates */
+    PyObject *gseq = PySequence_Fast(group_by, "group_by must be a sequence");
+    PyObject *aseq = gseq ? PySequence_Fast(aggregates, "aggregates must be a sequence") : NULL;
+    if (!aseq) {
+        Py_XDECREF(gseq);
+        goto done;
+    }
+    qNGroup = (int)PySequence_Fast_GET_SIZE(gseq);
+    qNAgg = (int)PySequence_Fast_GET_SIZE(aseq);
+    qMaxCol = 0;
+    int bad = qNGroup > MAXQCOLS || qNAgg > MAXQCOLS;
+    if (bad) PyErr_Format(PyExc_ValueError, "at most %d group-by columns and aggregates", MAXQCOLS);
+    for (int g = 0; !bad && g < qNGroup; g++) {
+        PyObject *name = PySequence_Fast_GET_ITEM(gseq, g);
+        qGroupCols[g] = find_column(columns, name);
+        if (qGroupCols[g] == -1) PyErr_Format(PyExc_ValueError, "no column %R in %s", name, path);
+        bad = qGroupCols[g] < 0;
+        if (!bad && qGroupCols[g] > qMaxCol) qMaxCol = qGroupCols[g];
+    }
+    for (int a = 0; !bad && a < qNAgg; a++) {
+        PyObject *name = Py_None;
+        if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(aseq, a), "iO", &qAggFunc[a], &name)) {
+            bad = 1;
+            break;
+        }
+        qAggCols[a] = 0;
+        if (qAggFunc[a] < AGG_COUNT || qAggFunc[a] > AGG_AVG) {
+            PyErr_Format(PyExc_ValueError, "invalid aggregate %d", qAggFunc[a]);
+            bad = 1;
+        } else if (qAggFunc[a] != AGG_COUNT) {
+            qAggCols[a] = find_column(columns, name);
+            if (qAggCols[a] == -1) PyErr_Format(PyExc_ValueError, "no column %R in %s", name, path);
+            bad = qAggCols[a] < 0;
+            if (!bad && qAggCols[a] > qMaxCol) qMaxCol = qAggCols[a];
+        }
+    }
+    Py_DECREF(gseq);
+    Py_DECREF(aseq);
+    if (!bad && qMaxCol >= MAXQFIELD) {
+        PyErr_Format(PyExc_ValueError, "%s: queries can use only the first %d columns", path,
+                     MAXQFIELD);
+        bad = 1;
+    }
+    if (bad) goto done;
+
+    for (int i = 0; i < MAXTHRDS; i++) agg_free(&qTables[i]);
+
+    Py_BEGIN_ALLOW_THREADS
+    failed = scan_units(aggregate_unit, max_threads);
+    for (int i = 1; i < max_threads; i++) {
+        aggregate_merge(&qTables[0], &qTables[i]);
+        agg_free(&qTables[i]);
+    }
+    if (qTables[0].failed && !failed) failed = 1;
+    Py_END_ALLOW_THREADS
+
+    if (failed == 2) {
+        PyErr_Format(PyExc_ValueError, "%s: cannot decompress a frame", path);
+        goto done;
+    }
+    if (failed) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    /* Rows: (group values..., count, aggregates...); None for empty min/max */
+    PyObject *rows = PyList_New(0);
+    AggTable *t = &qTables[0];
+    for (size_t i = 0; rows && t->slots && i <= t->mask; i++) {
+        AggEntry *e = &t->slots[i];
+        if (!e->count) continue;
+        PyObject *row = PyTuple_New(qNGroup + 1 + qNAgg);
+        const char *k = t->arena + e->keyOff;
+        for (int g = 0; row && g < qNGroup; g++) {
+            uint32_t n;
+            memcpy(&n, k, sizeof(n));
+            PyObject *v = unquote(k + sizeof(n), n);
+            if (!v) Py_CLEAR(row);
+            else PyTuple_SET_ITEM(row, g, v);
+            k += sizeof(n) + n;
+        }
+        if (row) PyTuple_SET_ITEM(row, qNGroup, PyLong_FromLongLong(e->count));
+        for (int a = 0; row && a < qNAgg; a++) {
+            PyObject *v;
+            if (qAggFunc[a] == AGG_COUNT) v = PyLong_FromLongLong(e->count);
+            else if (e->nvals[a] == 0 && qAggFunc[a] != AGG_SUM) {
+                v = Py_None;
+                Py_INCREF(v);
+            } else if (qAggFunc[a] == AGG_AVG) {
+                v = PyFloat_FromDouble((double)e->acc[a] / e->nvals[a]);
+            } else v = PyLong_FromLongLong(e->acc[a]);
+            PyTuple_SET_ITEM(row, qNGroup + 1 + a, v);
+        }
+        if (!row || PyList_Append(rows, row) < 0) Py_CLEAR(rows);
+        Py_XDECREF(row);
+    }
+    if (rows) {
+        result = Py_BuildValue("{s:O,s:N,s:n}", "columns", columns, "rows", rows,
+                               "units", (Py_ssize_t)qNUnits);
+    }
+
+done:
+    agg_free(&qTables[0]);
+    scan_close(&sf);
+    Py_DECREF(scan_obj);
+    return result;
+}
+
+/* ------------------------------------------------------------------ */
+/* load_tree: a scan as a compact tree. Nodes are numbered in preorder,
+ * so the subtree of node i is the interval [i, subtree_end[i]); children
+ * are a CSR list sorted by name, and per-node metadata is kept in columns
+ * that Python reads through the buffer protocol. */
+
+enum { TC_INODE, TC_PARENT, TC_DEPTH, TC_NAME, TC_UID, TC_GID, TC_SIZE, TC_DEV, TC_BLOCKS,
+       TC_MODE, TC_ATIME, TC_MTIME, TC_NCOLS };
+static const char *treeScanColumns[TC_NCOLS] = {
+    "inode", "parent-inode", "directory-depth", "filename", "UID", "GID", "st_size",
+    "st_dev", "st_blocks", "st_mode", "st_atime", "st_mtime" };
+static int treeCols[TC_NCOLS];
+#define MAXTREECOL 64          /* scan columns parsed per row */
 
-#ifdef HAVE_ZSTD
-#include <zstd.h>
-#endif
+typedef struct {
+    int64_t ino, pino, dev, size, blocks, atime, mtime;
+    uint32_t uid, gid, mode;
+    int32_t depth;
+    size_t nameOff;            /* into the name arena */
+    uint32_t nameLen;
+} TreeRow;
 
-#define MAXTHRDS 32
-#define MAXPATH 4096
-#define BUFFER_SIZE (512 * 1024)
+typedef struct {
+    TreeRow *rows;
+    size_t n, cap;
+    char *names;
+    size_t namesUsed, namesCap;
+} TreeRows;
+
+static TreeRows treeRows[MAXTHRDS];
 
-/* Thread-local CSV buffer */
 typedef struct {
-    char csv_buffer[BUFFER_SIZE];
-    size_t used;
-} ThreadBuffer;
+    PyObject_HEAD
+    Py_ssize_t n, nroots;
+    int32_t *parent, *end, *depth, *childOff, *children, *roots;
+    int64_t *inode, *dev, *size, *blocks, *atime, *mtime;
+    int64_t *sizeSum, *blocksSum;  /* prefix sums, n + 1 */
+    int32_t *uidNodes;             /* nodes sorted by (uid, node) */
+    int64_t *uidSizeSum, *uidBlocksSum;  /* prefix sums in uidNodes order, n + 1 */
+    uint32_t *uid, *gid, *mode;
+    int64_t *nameOff;              /* n + 1 */
+    char *names;
+    PyObject *root;                /* bytes naming the root in paths, or NULL */
+    void *map;                     /* index file the arrays point into, or NULL */
+    size_t mapSize;
+} TreeObject;
 
-/* Thread data */
-struct threadData {
-    char dname[MAXPATH];
-    ino_t pinode;
-    long depth;
-    long THRDid;
-    int flag;
-    struct stat pstat;
-    pthread_t thread_id;
-    pthread_attr_t tattr;
-    ThreadBuffer *buf;
+/* Columns exported by Tree.column(); length is n, n + 1 (extra 1) or the
+ * number of non-root nodes (extra -1) */
+typedef struct {
+    const char *name;
+    size_t field;
+    const char *format;
+    int extra;
+} TreeColumnDef;
+
+#define TREE_FIELD(f) offsetof(TreeObject, f)
+static const TreeColumnDef treeColumns[] = {
+    {"parent", TREE_FIELD(parent), "i", 0},
+    {"subtree_end", TREE_FIELD(end), "i", 0},
+    {"depth", TREE_FIELD(depth), "i", 0},
+    {"child_offsets", TREE_FIELD(childOff), "i", 1},
+    {"children", TREE_FIELD(children), "i", -1},
+    {"inode", TREE_FIELD(inode), "q", 0},
+    {"dev", TREE_FIELD(dev), "q", 0},
+    {"size", TREE_FIELD(size), "q", 0},
+    {"blocks", TREE_FIELD(blocks), "q", 0},
+    {"atime", TREE_FIELD(atime), "q", 0},
+    {"mtime", TREE_FIELD(mtime), "q", 0},
+    {"uid", TREE_FIELD(uid), "I", 0},
+    {"gid", TREE_FIELD(gid), "I", 0},
+    {"mode", TREE_FIELD(mode), "I", 0},
+    {NULL, 0, NULL, 0}
 };
 
-/* Global state */
-static int ThreadCNT = 0;  /* Active thread count */
-static int totalTHRDS = 0;
-static struct threadData tdslot[MAXTHRDS];
-static ThreadBuffer buffers[MAXTHRDS];
-static pthread_mutex_t mutexFD = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t mutexOutput = PTHREAD_MUTEX_INITIALIZER;
-static FILE *output_file = NULL;
-static int SNAPSHOT = 1;
+/* Arrays of an index file written by Tree.save(), in file order; length
+ * is n, n + 1 (extra 1), non-root nodes (-1), roots (2) or name bytes (3) */
+static const struct {
+    size_t field, itemsize;
+    int extra;
+} treeArrays[] = {
+    {TREE_FIELD(parent), 4, 0}, {TREE_FIELD(end), 4, 0}, {TREE_FIELD(depth), 4, 0},
+    {TREE_FIELD(childOff), 4, 1}, {TREE_FIELD(children), 4, -1}, {TREE_FIELD(roots), 4, 2},
+    {TREE_FIELD(inode), 8, 0}, {TREE_FIELD(dev), 8, 0}, {TREE_FIELD(size), 8, 0},
+    {TREE_FIELD(blocks), 8, 0}, {TREE_FIELD(atime), 8, 0}, {TREE_FIELD(mtime), 8, 0},
+    {TREE_FIELD(sizeSum), 8, 1}, {TREE_FIELD(blocksSum), 8, 1}, {TREE_FIELD(uid), 4, 0},
+    {TREE_FIELD(gid), 4, 0}, {TREE_FIELD(mode), 4, 0}, {TREE_FIELD(nameOff), 8, 1},
+    {TREE_FIELD(names), 1, 3}, {TREE_FIELD(uidNodes), 4, 0}, {TREE_FIELD(uidSizeSum), 8, 1},
+    {TREE_FIELD(uidBlocksSum), 8, 1},
+};
+#define TREE_NARRAYS (sizeof(treeArrays) / sizeof(treeArrays[0]))
 
-#ifdef HAVE_ZSTD
-static ZSTD_CStream *zstd_stream = NULL;
-#endif
+static const char treeMagic[8] = "PWTREE2\n";
 
-/* Flush buffer */
-static void flush_buffer(ThreadBuffer *buf) {
-    if (buf->used == 0) return;
+typedef struct {
+    char magic[8];
+    uint64_t n, nroots, nnames, rootLen;
+} TreeIndexHeader;
+
+static size_t tree_array_bytes(const TreeObject *t, int a, uint64_t nnames) {
+    uint64_t n = nnames;
+    switch (treeArrays[a].extra) {
+    case 0: n = t->n; break;
+    case 1: n = t->n + 1; break;
+    case -1: n = t->n - t->nroots; break;
+    case 2: n = t->nroots; break;
+    }
+    return n * treeArrays[a].itemsize;
+}
 
-    pthread_mutex_lock(&mutexOutput);
+#define ALIGN8(x) (((x) + 7) & ~(size_t)7)
 
-#ifdef HAVE_ZSTD
-    if (zstd_stream) {
-        char compressed[BUFFER_SIZE + 16384];
-        ZSTD_inBuffer input = { buf->csv_buffer, buf->used, 0 };
-        ZSTD_outBuffer output = { compressed, sizeof(compressed), 0 };
-
-        ZSTD_compressStream2(zstd_stream, &output, &input, ZSTD_e_continue);
-        fwrite(compressed, 1, output.pos, output_file);
-    } else
-#endif
-    {
-        fwrite(buf->csv_buffer, 1, buf->used, output_file);
+/* A read-only buffer over one column; keeps its tree alive */
+typedef struct {
+    PyObject_HEAD
+    PyObject *tree;
+    void *data;
+    Py_ssize_t len, itemsize;
+    const char *format;
+} TreeColumnObject;
+
+static int tree_column_getbuffer(TreeColumnObject *self, Py_buffer *view, int flags) {
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "tree columns are read-only");
+        view->obj = NULL;
+        return -1;
     }
+    view->buf = self->data;
+    view->obj = (PyObject *)self;
+    Py_INCREF(self);
+    view->len = self->len * self->itemsize;
+    view->readonly = 1;
+    view->itemsize = self->itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? (char *)self->format : NULL;
+    view->ndim = 1;
+    view->shape = (flags & PyBUF_ND) ? &self->len : NULL;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? &self->itemsize : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
 
-    buf->used = 0;
-    pthread_mutex_unlock(&mutexOutput);
+static void tree_column_dealloc(TreeColumnObject *self) {
+    Py_XDECREF(self->tree);
+    Py_TYPE(self)->tp_free((PyObject *)self);
 }
 
-/* CSV escape */
-static void csv_escape(const char *in, char *out) {
-    while (*in) {
-        if (*in == '"') {
-            *out++ = '"';
-            *out++ = '"';
-        } else {
-            *out++ = *in;
+static PyBufferProcs tree_column_as_buffer = {
+    (getbufferproc)tree_column_getbuffer, NULL
+};
+
+static PyTypeObject TreeColumnType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "_pwalk_core.TreeColumn",
+    .tp_basicsize = sizeof(TreeColumnObject),
+    .tp_dealloc = (destructor)tree_column_dealloc,
+    .tp_as_buffer = &tree_column_as_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Read-only buffer over a tree column",
+};
+
+/* Parse the records of one unit into this thread's rows */
+static int tree_unit(int id, const char *p, const char *end) {
+    TreeRows *t = &treeRows[id];
+    const char *fields[MAXTREECOL];
+    size_t lens[MAXTREECOL];
+
+    while (p < end) {
+        p = parse_fields(p, end, fields, lens);
+
+        int64_t v[TC_NCOLS] = {0};
+        if (!parse_int(fields[treeCols[TC_INODE]], lens[treeCols[TC_INODE]], &v[TC_INODE]))
+            continue;
+        for (int c = TC_PARENT; c < TC_NCOLS; c++) {
+            if (c != TC_NAME && c != TC_MODE) parse_int(fields[treeCols[c]], lens[treeCols[c]], &v[c]);
         }
-        in++;
+        const char *mode = fields[treeCols[TC_MODE]];
+        for (size_t i = 0; i < lens[treeCols[TC_MODE]] && mode[i] >= '0' && mode[i] <= '7'; i++)
+            v[TC_MODE] = v[TC_MODE] * 8 + (mode[i] - '0');
+
+        if (t->n == t->cap) {
+            size_t ncap = t->cap ? 2 * t->cap : 65536;
+            TreeRow *rows = realloc(t->rows, ncap * sizeof(TreeRow));
+            if (!rows) return -1;
+            t->rows = rows;
+            t->cap = ncap;
+        }
+        size_t nlen = lens[treeCols[TC_NAME]];
+        if (t->namesUsed + nlen > t->namesCap) {
+            size_t ncap = t->namesCap ? t->namesCap : (1 << 20);
+            while (ncap < t->namesUsed + nlen) ncap *= 2;
+            char *names = realloc(t->names, ncap);
+            if (!names) return -1;
+            t->names = names;
+            t->namesCap = ncap;
+        }
+
+        TreeRow *r = &t->rows[t->n++];
+        r->ino = v[TC_INODE];
+        r->pino = v[TC_PARENT];
+        r->depth = (int32_t)v[TC_DEPTH];
+        r->uid = (uint32_t)v[TC_UID];
+        r->gid = (uint32_t)v[TC_GID];
+        r->size = v[TC_SIZE];
+        r->dev = v[TC_DEV];
+        r->blocks = v[TC_BLOCKS];
+        r->mode = (uint32_t)v[TC_MODE];
+        r->atime = v[TC_ATIME];
+        r->mtime = v[TC_MTIME];
+        r->nameOff = t->namesUsed;
+
+        /* Filename without its "" escapes */
+        const char *name = fields[treeCols[TC_NAME]];
+        char *dst = t->names + t->namesUsed;
+        size_t k = 0;
+        for (size_t i = 0; i < nlen; i++) {
+            dst[k++] = name[i];
+            if (name[i] == '"' && i + 1 < nlen && name[i + 1] == '"') i++;
+        }
+        r->nameLen = (uint32_t)k;
+        t->namesUsed += k;
     }
-    *out = '\0';
+    return 0;
 }
 
-/* Write CSV record */
-static void write_record(ThreadBuffer *buf, const char *path, struct stat *st,
-                        ino_t parent_inode, int depth, long fcount, long dirsum) {
-    char line[MAXPATH * 2];
-    char esc_name[MAXPATH * 2], esc_ext[256];
+static void tree_rows_free(void) {
+    for (int i = 0; i < MAXTHRDS; i++) {
+        free(treeRows[i].rows);
+        free(treeRows[i].names);
+        memset(&treeRows[i], 0, sizeof(TreeRows));
+    }
+}
 
-    const char *filename = strrchr(path, '/');
-    filename = filename ? filename + 1 : path;
+/* Sort order of the rows: by parent (roots first), then by name */
+static const TreeRow *sortRows;
+static const char *sortNames;
+static const int32_t *sortParent;
 
-    const char *ext = strrchr(filename, '.');
-    ext = (ext && ext > filename) ? ext + 1 : "";
+static int name_cmp(const char *a, size_t alen, const char *b, size_t blen) {
+    int c = memcmp(a, b, alen < blen ? alen : blen);
+    if (c) return c;
+    return (alen > blen) - (alen < blen);
+}
 
-    csv_escape(filename, esc_name);
-    csv_escape(ext, esc_ext);
+static int tree_row_cmp(const void *pa, const void *pb) {
+    int32_t a = *(const int32_t *)pa, b = *(const int32_t *)pb;
+    if (sortParent[a] != sortParent[b]) return sortParent[a] < sortParent[b] ? -1 : 1;
+    int c = name_cmp(sortNames + sortRows[a].nameOff, sortRows[a].nameLen,
+                     sortNames + sortRows[b].nameOff, sortRows[b].nameLen);
+    return c ? c : (a > b) - (a < b);
+}
 
-    int len = snprintf(line, sizeof(line),
-        "%lu,%lu,%d,\"%s\",\"%s\",%u,%u,%ld,%lu,%ld,%lu,\"%o\",%ld,%ld,%ld,%ld,%ld\n",
-        (unsigned long)st->st_ino, (unsigned long)parent_inode, depth,
-        esc_name, esc_ext, st->st_uid, st->st_gid, (long)st->st_size,
-        (unsigned long)st->st_dev, (long)st->st_blocks,
-        (unsigned long)st->st_nlink, st->st_mode,
-        (long)st->st_atime, (long)st->st_mtime, (long)st->st_ctime,
-        fcount, dirsum);
+static uint64_t ino_hash(int64_t ino) {
+    return (uint64_t)ino * 0x9E3779B97F4A7C15ULL;
+}
 
-    if (buf->used + len >= BUFFER_SIZE) {
-        flush_buffer(buf);
+/* Number the subtree of row r in preorder, children in name order;
+ * returns the next free number */
+static int32_t tree_dfs(int32_t r, int32_t next, int32_t *pre, const int32_t *par,
+                        const int32_t *order, const int32_t *coff, int32_t *stack) {
+    size_t top = 0;
+
+    stack[top++] = r;
+    while (top) {
+        int32_t x = stack[--top];
+        pre[x] = next++;
+        for (int32_t c = coff[x + 2]; c-- > coff[x + 1]; ) {
+            if (pre[order[c]] < 0 && par[order[c]] == x) stack[top++] = order[c];
+        }
     }
-    memcpy(buf->csv_buffer + buf->used, line, len);
-    buf->used += len;
+    return next;
 }
 
-/* Traverse directory */
-static void* traverse(void *arg) {
-    struct threadData *cur = (struct threadData *)arg;
-    DIR *dirp;
-    struct dirent *d;
-    struct stat f;
-    char fullpath[MAXPATH];
-    struct threadData *new, local;
-    long localCnt = 0, localSz = 0;
-    int slot = 0;
+/* Build the tree from treeRows; runs without the GIL. Returns -1 when out
+ * of memory, -2 when the scan has too many rows */
+static int tree_build(TreeObject *t) {
+    size_t n = 0, nnames = 0;
+    for (int i = 0; i < MAXTHRDS; i++) {
+        n += treeRows[i].n;
+        nnames += treeRows[i].namesUsed;
+    }
+    if (n >= INT32_MAX) return -2;
 
-    dirp = opendir(cur->dname);
-    if (!dirp) {
-        /* Even if we can't open, still decrement counter */
-        goto cleanup;
+    TreeRow *rows = malloc((n ? n : 1) * sizeof(TreeRow));
+    char *names = malloc(nnames ? nnames : 1);
+    int32_t *par = malloc((n ? n : 1) * sizeof(int32_t));
+    int32_t *order = malloc((n ? n : 1) * sizeof(int32_t));
+    int32_t *pre = malloc((n ? n : 1) * sizeof(int32_t));
+    int32_t *coff = calloc(n + 2, sizeof(int32_t));
+    int32_t *stack = malloc((n ? n : 1) * sizeof(int32_t));
+    int ret = -1;
+    size_t mask = 1024;
+    while (mask < 2 * n) mask *= 2;
+    int32_t *slots = malloc(mask * sizeof(int32_t));
+    mask--;
+    if (!rows || !names || !par || !order || !pre || !coff || !stack || !slots) goto done;
+
+    /* Concatenate the rows of all threads */
+    size_t k = 0, nk = 0;
+    for (int i = 0; i < MAXTHRDS; i++) {
+        TreeRows *tr = &treeRows[i];
+        for (size_t j = 0; j < tr->n; j++) {
+            rows[k] = tr->rows[j];
+            rows[k++].nameOff += nk;
+        }
+        if (tr->namesUsed) memcpy(names + nk, tr->names, tr->namesUsed);
+        nk += tr->namesUsed;
     }
+    tree_rows_free();
 
-    while ((d = readdir(dirp)) != NULL) {
-        if (strcmp(".", d->d_name) == 0 || strcmp("..", d->d_name) == 0)
-            continue;
-        if (SNAPSHOT && strcmp(".snapshot", d->d_name) == 0)
-            continue;
+    /* Directories by inode; a parent on the row's own device is preferred
+     * (mount points have the device of the mounted filesystem) */
+    memset(slots, 0xff, (mask + 1) * sizeof(int32_t));
+    for (size_t r = 0; r < n; r++) {
+        if (!S_ISDIR(rows[r].mode)) continue;
+        size_t s = ino_hash(rows[r].ino) & mask;
+        while (slots[s] >= 0 && !(rows[slots[s]].ino == rows[r].ino && rows[slots[s]].dev == rows[r].dev))
+            s = (s + 1) & mask;
+        if (slots[s] < 0) slots[s] = (int32_t)r;
+    }
+    for (size_t r = 0; r < n; r++) {
+        int32_t best = -1;
+        for (size_t s = ino_hash(rows[r].pino) & mask; slots[s] >= 0; s = (s + 1) & mask) {
+            const TreeRow *d = &rows[slots[s]];
+            if (d->ino != rows[r].pino) continue;
+            if (d->dev == rows[r].dev) {
+                best = slots[s];
+                break;
+            }
+            if (best < 0) best = slots[s];
+        }
+        par[r] = best == (int32_t)r ? -1 : best;
+        order[r] = (int32_t)r;
+        pre[r] = -1;
+    }
 
-        snprintf(fullpath, MAXPATH, "%s/%s", cur->dname, d->d_name);
+    /* Children of row r are order[coff[r + 1] .. coff[r + 2]); roots come first */
+    sortRows = rows;
+    sortNames = names;
+    sortParent = par;
+    qsort(order, n, sizeof(int32_t), tree_row_cmp);
+    for (size_t r = 0; r < n; r++) coff[par[r] + 2]++;
+    for (size_t r = 1; r < n + 2; r++) coff[r] += coff[r - 1];
 
-        if (lstat(fullpath, &f) == -1)
-            continue;
+    /* Preorder numbering; rows left unvisited sit on a parent cycle and
+     * become roots of their own */
+    int32_t next = 0;
+    for (int32_t i = 0; i < coff[1]; i++)
+        next = tree_dfs(order[i], next, pre, par, order, coff, stack);
+    for (size_t r = 0; r < n && next < (int32_t)n; r++) {
+        if (pre[r] >= 0) continue;
+        par[r] = -1;
+        next = tree_dfs((int32_t)r, next, pre, par, order, coff, stack);
+    }
 
-        localCnt++;
+    /* Columns in preorder */
+    t->n = n;
+    t->parent = malloc((n + 1) * sizeof(int32_t));
+    t->end = malloc((n + 1) * sizeof(int32_t));
+    t->depth = malloc((n + 1) * sizeof(int32_t));
+    t->childOff = calloc(n + 2, sizeof(int32_t));
+    t->children = malloc((n + 1) * sizeof(int32_t));
+    t->roots = malloc((n + 1) * sizeof(int32_t));
+    t->inode = malloc((n + 1) * sizeof(int64_t));
+    t->dev = malloc((n + 1) * sizeof(int64_t));
+    t->size = malloc((n + 1) * sizeof(int64_t));
+    t->blocks = malloc((n + 1) * sizeof(int64_t));
+    t->atime = malloc((n + 1) * sizeof(int64_t));
+    t->mtime = malloc((n + 1) * sizeof(int64_t));
+    t->sizeSum = malloc((n + 1) * sizeof(int64_t));
+    t->blocksSum = malloc((n + 1) * sizeof(int64_t));
+    t->uid = malloc((n + 1) * sizeof(uint32_t));
+    t->gid = malloc((n + 1) * sizeof(uint32_t));
+    t->mode = malloc((n + 1) * sizeof(uint32_t));
+    t->nameOff = malloc((n + 1) * sizeof(int64_t));
+    t->names = malloc(nnames ? nnames : 1);
+    t->uidNodes = malloc((n + 1) * sizeof(int32_t));
+    t->uidSizeSum = malloc((n + 1) * sizeof(int64_t));
+    t->uidBlocksSum = malloc((n + 1) * sizeof(int64_t));
+    if (!t->parent || !t->end || !t->depth || !t->childOff || !t->children || !t->roots ||
+        !t->inode || !t->dev || !t->size || !t->blocks || !t->atime || !t->mtime ||
+        !t->sizeSum || !t->blocksSum || !t->uid || !t->gid || !t->mode || !t->nameOff ||
+        !t->names || !t->uidNodes || !t->uidSizeSum || !t->uidBlocksSum)
+        goto done;
 
-        if (S_ISDIR(f.st_mode)) {
-            pthread_mutex_lock(&mutexFD);
-            if (ThreadCNT < MAXTHRDS) {
-                slot = 0;
-                while (slot < MAXTHRDS && tdslot[slot].THRDid != -1) slot++;
-
-                if (slot < MAXTHRDS) {
-                    new = &tdslot[slot];
-                    new->THRDid = totalTHRDS++;
-                    new->flag = 0;
-                    new->buf = &buffers[slot];
-                    ThreadCNT++;  /* Increment BEFORE creating thread */
-                } else {
-                    new = &local;
-                    new->THRDid = cur->THRDid;
-                    new->flag = cur->flag + 1;
-                    new->buf = cur->buf;
-                }
-            } else {
-                new = &local;
-                new->THRDid = cur->THRDid;
-                new->flag = cur->flag + 1;
-                new->buf = cur->buf;
-            }
-            pthread_mutex_unlock(&mutexFD);
-
-            strcpy(new->dname, fullpath);
-            new->depth = cur->depth + 1;
-            new->pinode = cur->pstat.st_ino;
-            memcpy(&new->pstat, &f, sizeof(struct stat));
-
-            if (new->THRDid != cur->THRDid) {
-                pthread_create(&tdslot[slot].thread_id, &tdslot[slot].tattr,
-                              traverse, (void*)new);
-            } else {
-                traverse((void*)new);
-            }
+    for (size_t r = 0; r < n; r++) {
+        int32_t i = pre[r];
+        t->parent[i] = par[r] >= 0 ? pre[par[r]] : -1;
+        t->depth[i] = rows[r].depth;
+        t->inode[i] = rows[r].ino;
+        t->dev[i] = rows[r].dev;
+        t->size[i] = rows[r].size;
+        t->blocks[i] = rows[r].blocks;
+        t->atime[i] = rows[r].atime;
+        t->mtime[i] = rows[r].mtime;
+        t->uid[i] = rows[r].uid;
+        t->gid[i] = rows[r].gid;
+        t->mode[i] = rows[r].mode;
+        t->nameOff[i] = rows[r].nameLen;   /* lengths for now */
+    }
+    t->sizeSum[0] = t->blocksSum[0] = 0;
+    int64_t off = 0;
+    for (size_t i = 0; i < n; i++) {
+        t->sizeSum[i + 1] = t->sizeSum[i] + t->size[i];
+        t->blocksSum[i + 1] = t->blocksSum[i] + t->blocks[i];
+        int64_t len = t->nameOff[i];
+        t->nameOff[i] = off;
+        off += len;
+    }
+    t->nameOff[n] = off;
+    for (size_t r = 0; r < n; r++)
+        memcpy(t->names + t->nameOff[pre[r]], names + rows[r].nameOff, rows[r].nameLen);
+
+    /* Subtree intervals: children follow their parent in preorder, so sizes
+     * roll up in one backward pass */
+    for (size_t i = 0; i < n; i++) t->end[i] = 1;
+    for (size_t i = n; i-- > 0; ) {
+        if (t->parent[i] >= 0) t->end[t->parent[i]] += t->end[i];
+    }
+    for (size_t i = 0; i < n; i++) t->end[i] += (int32_t)i;
+
+    /* CSR children (ascending, which is also name order) and the roots */
+    t->nroots = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (t->parent[i] >= 0) t->childOff[t->parent[i] + 1]++;
+        else t->roots[t->nroots++] = (int32_t)i;
+    }
+    for (size_t i = 0; i < n; i++) t->childOff[i + 1] += t->childOff[i];
+    for (size_t i = 0; i < n; i++) stack[i] = t->childOff[i];
+    for (size_t i = 0; i < n; i++) {
+        if (t->parent[i] >= 0) t->children[stack[t->parent[i]]++] = (int32_t)i;
+    }
+
+    /* Nodes of every uid in preorder, with prefix sums: the nodes of a uid
+     * in a subtree are the ones between two binary searches */
+    uint64_t *byUid = malloc((n ? n : 1) * sizeof(uint64_t));
+    if (!byUid) goto done;
+    for (size_t i = 0; i < n; i++) byUid[i] = (uint64_t)t->uid[i] << 32 | i;
+    qsort(byUid, n, sizeof(uint64_t), cmp_u64);
+    t->uidSizeSum[0] = t->uidBlocksSum[0] = 0;
+    for (size_t k = 0; k < n; k++) {
+        int32_t i = (int32_t)(byUid[k] & 0xffffffff);
+        t->uidNodes[k] = i;
+        t->uidSizeSum[k + 1] = t->uidSizeSum[k] + t->size[i];
+        t->uidBlocksSum[k + 1] = t->uidBlocksSum[k] + t->blocks[i];
+    }
+    free(byUid);
+    ret = 0;
+
+done:
+    free(rows);
+    free(names);
+    free(par);
+    free(order);
+    free(pre);
+    free(coff);
+    free(stack);
+    free(slots);
+    return ret;
+}
+
+static void tree_dealloc(TreeObject *self) {
+    if (self->map) {
+        munmap(self->map, self->mapSize);
+        Py_XDECREF(self->root);
+        Py_TYPE(self)->tp_free((PyObject *)self);
+        return;
+    }
+    free(self->parent);
+    free(self->end);
+    free(self->depth);
+    free(self->childOff);
+    free(self->children);
+    free(self->roots);
+    free(self->inode);
+    free(self->dev);
+    free(self->size);
+    free(self->blocks);
+    free(self->atime);
+    free(self->mtime);
+    free(self->sizeSum);
+    free(self->blocksSum);
+    free(self->uidNodes);
+    free(self->uidSizeSum);
+    free(self->uidBlocksSum);
+    free(self->uid);
+    free(self->gid);
+    free(self->mode);
+    free(self->nameOff);
+    free(self->names);
+    Py_XDECREF(self->root);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static Py_ssize_t tree_length(TreeObject *self) {
+    return self->n;
+}
+
+/* Parse a node index argument; -1 with IndexError set when out of range */
+static Py_ssize_t tree_node(TreeObject *self, PyObject *arg) {
+    Py_ssize_t i = PyNumber_AsSsize_t(arg, PyExc_IndexError);
+    if (i == -1 && PyErr_Occurred()) return -1;
+    if (i < 0 || i >= self->n) {
+        PyErr_SetString(PyExc_IndexError, "tree node out of range");
+        return -1;
+    }
+    return i;
+}
+
+static PyObject *tree_name(TreeObject *self, PyObject *arg) {
+    Py_ssize_t i = tree_node(self, arg);
+    if (i < 0) return NULL;
+    if (self->parent[i] < 0 && self->root)
+        return PyUnicode_DecodeFSDefaultAndSize(PyBytes_AS_STRING(self->root), PyBytes_GET_SIZE(self->root));
+    return PyUnicode_DecodeFSDefaultAndSize(self->names + self->nameOff[i],
+                                            self->nameOff[i + 1] - self->nameOff[i]);
+}
+
+static PyObject *tree_path(TreeObject *self, PyObject *arg) {
+    Py_ssize_t i = tree_node(self, arg);
+    if (i < 0) return NULL;
+
+    /* Length first, then the names from the end backwards */
+    Py_ssize_t len = -1, root = i;
+    for (Py_ssize_t j = i; j >= 0; j = self->parent[j]) {
+        root = j;
+        len += 1 + self->nameOff[j + 1] - self->nameOff[j];
+    }
+    const char *rname = self->names + self->nameOff[root];
+    Py_ssize_t rlen = self->nameOff[root + 1] - self->nameOff[root];
+    if (self->root) {
+        rname = PyBytes_AS_STRING(self->root);
+        len += PyBytes_GET_SIZE(self->root) - rlen;
+        rlen = PyBytes_GET_SIZE(self->root);
+    }
+    char *buf = malloc(len + 1);
+    if (!buf) return PyErr_NoMemory();
+    Py_ssize_t pos = len;
+    for (Py_ssize_t j = i; j != root; j = self->parent[j]) {
+        Py_ssize_t n = self->nameOff[j + 1] - self->nameOff[j];
+        pos -= n;
+        memcpy(buf + pos, self->names + self->nameOff[j], n);
+        buf[--pos] = '/';
+    }
+    memcpy(buf, rname, rlen);
+    if (rlen && rname[rlen - 1] == '/' && i != root) {
+        /* root "/" */
+        memmove(buf + rlen, buf + rlen + 1, len - rlen - 1);
+        len--;
+    }
+    PyObject *result = PyUnicode_DecodeFSDefaultAndSize(buf, len);
+    free(buf);
+    return result;
+}
+
+/* Index of the child of node i called name, or -1 */
+static Py_ssize_t tree_child(TreeObject *self, const int32_t *nodes, Py_ssize_t count,
+                             const char *name, size_t len) {
+    Py_ssize_t lo = 0, hi = count;
+    while (lo < hi) {
+        Py_ssize_t mid = (lo + hi) / 2, c = nodes[mid];
+        int cmp = name_cmp(self->names + self->nameOff[c], self->nameOff[c + 1] - self->nameOff[c],
+                           name, len);
+        if (cmp == 0) return c;
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return -1;
+}
+
+static PyObject *tree_lookup(TreeObject *self, PyObject *arg) {
+    PyObject *bytes;
+    if (!PyUnicode_FSConverter(arg, &bytes)) return NULL;
+    const char *p = PyBytes_AS_STRING(bytes), *end = p + PyBytes_GET_SIZE(bytes);
+    Py_ssize_t node = -1;
+
+    while (end > p + 1 && end[-1] == '/') end--;
+    if (self->root) {
+        /* Paths start with the root given to load_tree */
+        Py_ssize_t rlen = PyBytes_GET_SIZE(self->root);
+        const char *r = PyBytes_AS_STRING(self->root);
+        if (end - p >= rlen && memcmp(p, r, rlen) == 0 && (end - p == rlen || p[rlen] == '/' ||
+                                                          r[rlen - 1] == '/')) {
+            node = self->nroots ? self->roots[0] : -1;
+            p += rlen;
         } else {
-            localSz += f.st_size;
-            write_record(cur->buf, fullpath, &f, cur->pstat.st_ino, cur->depth, -1, 0);
+            p = end;
+        }
+    } else {
+        /* Paths start with the name of a root */
+        const char *slash = memchr(p, '/', end - p);
+        const char *cut = slash ? slash : end;
+        for (Py_ssize_t k = 0; k < self->nroots && node < 0; k++) {
+            Py_ssize_t c = self->roots[k];
+            if (name_cmp(self->names + self->nameOff[c], self->nameOff[c + 1] - self->nameOff[c],
+                         p, cut - p) == 0)
+                node = c;
+        }
+        p = cut;
+    }
+    while (node >= 0 && p < end) {
+        if (*p == '/') {
+            p++;
+            continue;
+        }
+        const char *slash = memchr(p, '/', end - p);
+        const char *cut = slash ? slash : end;
+        node = tree_child(self, self->children + self->childOff[node],
+                          self->childOff[node + 1] - self->childOff[node], p, cut - p);
+        p = cut;
+    }
+    if (node < 0) PyErr_SetObject(PyExc_KeyError, arg);
+    Py_DECREF(bytes);
+    return node < 0 ? NULL : PyLong_FromSsize_t(node);
+}
+
+static PyObject *tree_children(TreeObject *self, PyObject *arg) {
+    Py_ssize_t i = tree_node(self, arg);
+    if (i < 0) return NULL;
+    PyObject *list = PyList_New(self->childOff[i + 1] - self->childOff[i]);
+    for (Py_ssize_t k = 0; list && k < PyList_GET_SIZE(list); k++) {
+        PyObject *v = PyLong_FromLong(self->children[self->childOff[i] + k]);
+        if (!v) {
+            Py_CLEAR(list);
+            break;
         }
+        PyList_SET_ITEM(list, k, v);
     }
+    return list;
+}
+
+static PyObject *tree_parent(TreeObject *self, PyObject *arg) {
+    Py_ssize_t i = tree_node(self, arg);
+    if (i < 0) return NULL;
+    if (self->parent[i] < 0) Py_RETURN_NONE;
+    return PyLong_FromLong(self->parent[i]);
+}
 
-    if (dirp) closedir(dirp);
-    write_record(cur->buf, cur->dname, &cur->pstat, cur->pinode, cur->depth, localCnt, localSz);
+static PyObject *tree_subtree(TreeObject *self, PyObject *arg) {
+    Py_ssize_t i = tree_node(self, arg);
+    if (i < 0) return NULL;
+    return Py_BuildValue("(nn)", i, (Py_ssize_t)self->end[i]);
+}
+
+static PyObject *tree_subtree_count(TreeObject *self, PyObject *arg) {
+    Py_ssize_t i = tree_node(self, arg);
+    if (i < 0) return NULL;
+    return PyLong_FromSsize_t(self->end[i] - i);
+}
 
-cleanup:
-    if (cur->flag == 0) {
-        /* This is a thread (not recursion) */
-        flush_buffer(cur->buf);
-        pthread_mutex_lock(&mutexFD);
-        ThreadCNT--;
-        cur->THRDid = -1;
-        pthread_mutex_unlock(&mutexFD);
-        pthread_exit(NULL);
+static const TreeColumnDef *tree_column_def(PyObject *name) {
+    const char *s = PyUnicode_AsUTF8(name);
+    if (!s) return NULL;
+    for (const TreeColumnDef *d = treeColumns; d->name; d++) {
+        if (strcmp(d->name, s) == 0) return d;
     }
+    PyErr_Format(PyExc_KeyError, "no tree column %R", name);
     return NULL;
 }
 
-/* Python API */
-static PyObject* csv_write(PyObject *self, PyObject *args) {
-    const char *top, *output;
-    int max_threads = 8, ignore_snaps = 1, compress = 0;
+static PyObject *tree_subtree_sum(TreeObject *self, PyObject *args) {
+    PyObject *node, *name = NULL;
+    if (!PyArg_ParseTuple(args, "O|U", &node, &name)) return NULL;
+    Py_ssize_t i = tree_node(self, node);
+    if (i < 0) return NULL;
 
-    if (!PyArg_ParseTuple(args, "ss|iii", &top, &output, &max_threads, &ignore_snaps, &compress)) {
+    /* size and blocks from their prefix sums; other columns are summed */
+    const char *s = name ? PyUnicode_AsUTF8(name) : "size";
+    if (!s) return NULL;
+    if (strcmp(s, "size") == 0) return PyLong_FromLongLong(self->sizeSum[self->end[i]] - self->sizeSum[i]);
+    if (strcmp(s, "blocks") == 0) return PyLong_FromLongLong(self->blocksSum[self->end[i]] - self->blocksSum[i]);
+    const TreeColumnDef *d = tree_column_def(name);
+    if (!d) return NULL;
+    if (d->extra) {
+        PyErr_Format(PyExc_ValueError, "%s is not a per-node column", d->name);
         return NULL;
     }
+    const void *data = *(void **)((char *)self + d->field);
+    int64_t sum = 0;
+    for (Py_ssize_t j = i; j < self->end[i]; j++) {
+        if (*d->format == 'q') sum += ((const int64_t *)data)[j];
+        else if (*d->format == 'I') sum += ((const uint32_t *)data)[j];
+        else sum += ((const int32_t *)data)[j];
+    }
+    return PyLong_FromLongLong(sum);
+}
 
-    SNAPSHOT = ignore_snaps;
+static PyObject *tree_column(TreeObject *self, PyObject *name) {
+    const TreeColumnDef *d = tree_column_def(name);
+    if (!d) return NULL;
+    TreeColumnObject *col = PyObject_New(TreeColumnObject, &TreeColumnType);
+    if (!col) return NULL;
+    Py_INCREF(self);
+    col->tree = (PyObject *)self;
+    col->data = *(void **)((char *)self + d->field);
+    col->format = d->format;
+    col->itemsize = *d->format == 'q' ? 8 : 4;
+    col->len = d->extra == 1 ? self->n + 1 : d->extra == -1 ? self->n - self->nroots : self->n;
+    PyObject *view = PyMemoryView_FromObject((PyObject *)col);
+    Py_DECREF(col);
+    return view;
+}
 
-    /* Open output */
-    output_file = fopen(output, "wb");
-    if (!output_file) {
-        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, output);
+/* Position in uidNodes of the first node at or after node i owned by uid,
+ * or of the first node of the next uid */
+static Py_ssize_t tree_uid_rank(const TreeObject *t, uint32_t uid, Py_ssize_t i) {
+    Py_ssize_t lo = 0, hi = t->n;
+    while (lo < hi) {
+        Py_ssize_t mid = lo + (hi - lo) / 2;
+        int32_t node = t->uidNodes[mid];
+        if (t->uid[node] < uid || (t->uid[node] == uid && node < i)) lo = mid + 1;
+        else hi = mid;
     }
+    return lo;
+}
 
-#ifdef HAVE_ZSTD
-    if (compress) {
-        zstd_stream = ZSTD_createCStream();
-        ZSTD_initCStream(zstd_stream, 1);
+/* (files, size, blocks) of the subtree, optionally only those owned by uid */
+static PyObject *tree_usage(TreeObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"node", "uid", NULL};
+    PyObject *node;
+    long long uid = -1;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|L", kwlist, &node, &uid)) return NULL;
+    Py_ssize_t i = tree_node(self, node);
+    if (i < 0) return NULL;
+
+    Py_ssize_t end = self->end[i], count = end - i;
+    int64_t size = self->sizeSum[end] - self->sizeSum[i];
+    int64_t blocks = self->blocksSum[end] - self->blocksSum[i];
+    if (uid >= 0) {
+        Py_ssize_t lo = tree_uid_rank(self, (uint32_t)uid, i);
+        Py_ssize_t hi = tree_uid_rank(self, (uint32_t)uid, end);
+        count = hi - lo;
+        size = self->uidSizeSum[hi] - self->uidSizeSum[lo];
+        blocks = self->uidBlocksSum[hi] - self->uidBlocksSum[lo];
     }
-#endif
+    return Py_BuildValue("(nLL)", count, (long long)size, (long long)blocks);
+}
 
-    /* Write header */
-    const char *header = "inode,parent-inode,directory-depth,\"filename\",\"fileExtension\","
-                        "UID,GID,st_size,st_dev,st_blocks,st_nlink,\"st_mode\","
-                        "st_atime,st_mtime,st_ctime,pw_fcount,pw_dirsum\n";
-    fwrite(header, 1, strlen(header), output_file);
+/* Write the tree as an index file that load_tree() maps without parsing */
+static PyObject *tree_save(TreeObject *self, PyObject *arg) {
+    PyObject *path_obj;
+    if (!PyUnicode_FSConverter(arg, &path_obj)) return NULL;
+    const char *path = PyBytes_AS_STRING(path_obj);
 
-    /* Initialize - IMPORTANT: ThreadCNT starts at 0, will be 1 when first thread starts */
-    ThreadCNT = 0;
-    totalTHRDS = 0;
+    TreeIndexHeader h = {{0}, self->n, self->nroots, self->nameOff[self->n],
+                         self->root ? PyBytes_GET_SIZE(self->root) : 0};
+    memcpy(h.magic, treeMagic, sizeof(h.magic));
+    static const char zeros[8] = {0};
+    int ok;
 
-    for (int i = 0; i < MAXTHRDS; i++) {
-        buffers[i].used = 0;
-        tdslot[i].THRDid = -1;
-        pthread_attr_init(&tdslot[i].tattr);
-        pthread_attr_setdetachstate(&tdslot[i].tattr, PTHREAD_CREATE_DETACHED);
+    Py_BEGIN_ALLOW_THREADS
+    FILE *f = fopen(path, "wb");
+    ok = f && fwrite(&h, sizeof(h), 1, f) == 1;
+    if (ok && h.rootLen) {
+        ok = fwrite(PyBytes_AS_STRING(self->root), 1, h.rootLen, f) == h.rootLen &&
+             fwrite(zeros, 1, ALIGN8(h.rootLen) - h.rootLen, f) == ALIGN8(h.rootLen) - h.rootLen;
+    }
+    for (size_t a = 0; ok && a < TREE_NARRAYS; a++) {
+        size_t bytes = tree_array_bytes(self, a, h.nnames);
+        const void *data = *(void **)((char *)self + treeArrays[a].field);
+        ok = fwrite(data, 1, bytes, f) == bytes &&
+             fwrite(zeros, 1, ALIGN8(bytes) - bytes, f) == ALIGN8(bytes) - bytes;
+    }
+    if (f && fclose(f) != 0) ok = 0;
+    Py_END_ALLOW_THREADS
+
+    if (!ok) PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+    Py_DECREF(path_obj);
+    if (!ok) return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject *tree_get_roots(TreeObject *self, void *closure) {
+    PyObject *list = PyList_New(self->nroots);
+    for (Py_ssize_t k = 0; list && k < self->nroots; k++)
+        PyList_SET_ITEM(list, k, PyLong_FromLong(self->roots[k]));
+    return list;
+}
+
+static PyObject *tree_get_columns(TreeObject *self, void *closure) {
+    PyObject *names = PyTuple_New(sizeof(treeColumns) / sizeof(treeColumns[0]) - 1);
+    for (Py_ssize_t k = 0; names && treeColumns[k].name; k++)
+        PyTuple_SET_ITEM(names, k, PyUnicode_FromString(treeColumns[k].name));
+    return names;
+}
+
+static PyMethodDef tree_methods[] = {
+    {"lookup", (PyCFunction)tree_lookup, METH_O, "Node index of a path; KeyError if missing"},
+    {"path", (PyCFunction)tree_path, METH_O, "Path of a node"},
+    {"name", (PyCFunction)tree_name, METH_O, "Filename of a node"},
+    {"parent", (PyCFunction)tree_parent, METH_O, "Parent of a node, None for a root"},
+    {"children", (PyCFunction)tree_children, METH_O, "Children of a node, in name order"},
+    {"subtree", (PyCFunction)tree_subtree, METH_O, "Nodes of the subtree: (start, end)"},
+    {"subtree_count", (PyCFunction)tree_subtree_count, METH_O, "Number of nodes in the subtree"},
+    {"subtree_sum", (PyCFunction)tree_subtree_sum, METH_VARARGS,
+     "Sum of a column over the subtree (default: size)"},
+    {"column", (PyCFunction)tree_column, METH_O, "Read-only memoryview of a column"},
+    {"usage", (PyCFunction)tree_usage, METH_VARARGS | METH_KEYWORDS,
+     "(files, size, blocks) of the subtree, optionally of one uid"},
+    {"save", (PyCFunction)tree_save, METH_O, "Write the tree as an index file"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef tree_getset[] = {
+    {"roots", (getter)tree_get_roots, NULL, "Root nodes", NULL},
+    {"columns", (getter)tree_get_columns, NULL, "Names accepted by column()", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PySequenceMethods tree_as_sequence = {
+    .sq_length = (lenfunc)tree_length,
+};
+
+static PyTypeObject TreeType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "_pwalk_core.Tree",
+    .tp_basicsize = sizeof(TreeObject),
+    .tp_dealloc = (destructor)tree_dealloc,
+    .tp_as_sequence = &tree_as_sequence,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Scan loaded as a tree; nodes are numbered in preorder",
+    .tp_methods = tree_methods,
+    .tp_getset = tree_getset,
+};
+
+/* Map an index file written by Tree.save(); NULL with an exception set */
+static TreeObject *tree_map(const char *path, int fd, size_t size) {
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        return NULL;
+    }
+    TreeObject *t = (TreeObject *)TreeType.tp_alloc(&TreeType, 0);
+    if (!t) {
+        munmap(map, size);
+        return NULL;
+    }
+    t->map = map;
+    t->mapSize = size;
+
+    TreeIndexHeader h;
+    memcpy(&h, map, sizeof(h));
+    size_t off = sizeof(h) + ALIGN8(h.rootLen);
+    int bad = h.n >= INT32_MAX || h.nroots > h.n || off > size;
+    t->n = (Py_ssize_t)h.n;
+    t->nroots = (Py_ssize_t)h.nroots;
+    for (size_t a = 0; !bad && a < TREE_NARRAYS; a++) {
+        size_t bytes = tree_array_bytes(t, a, h.nnames);
+        bad = bytes > size - off;
+        *(void **)((char *)t + treeArrays[a].field) = (char *)map + off;
+        off += ALIGN8(bytes);
+        if (off > size) off = size;
+    }
+    if (bad || (uint64_t)t->nameOff[t->n] != h.nnames) {
+        PyErr_Format(PyExc_ValueError, "%s: truncated tree index", path);
+        Py_DECREF(t);
+        return NULL;
+    }
+    if (h.rootLen) {
+        t->root = PyBytes_FromStringAndSize((char *)map + sizeof(h), h.rootLen);
+        if (!t->root) {
+            Py_DECREF(t);
+            return NULL;
+        }
+    }
+    return t;
+}
+
+/* load_tree: build a Tree from a scan written by write_csv */
+static PyObject* load_tree(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"scan", "root", "max_threads", NULL};
+    PyObject *scan_obj, *root = NULL;
+    int max_threads = 8, failed;
+    ScanFile sf = {0};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O&|O&i", kwlist, PyUnicode_FSConverter,
+                                     &scan_obj, PyUnicode_FSConverter, &root, &max_threads)) {
+        return NULL;
     }
+    if (max_threads < 1) max_threads = 1;
+    if (max_threads > MAXTHRDS) max_threads = MAXTHRDS;
 
-    struct stat root;
-    if (lstat(top, &root) == -1) {
-        fclose(output_file);
-        return PyErr_SetFromErrnoWithFilename(PyExc_OSError, top);
+    const char *path = PyBytes_AS_STRING(scan_obj);
+    TreeObject *tree = NULL;
+
+    /* Index files are mapped as they are */
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    char magic[sizeof(treeMagic)];
+    int version = -1;  /* of an index file: 0 older, 1 current */
+    if (fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(TreeIndexHeader) &&
+        pread(fd, magic, sizeof(magic), 0) == sizeof(magic) && memcmp(magic, treeMagic, 6) == 0)
+        version = memcmp(magic, treeMagic, sizeof(magic)) == 0;
+    if (version == 1) {
+        tree = tree_map(path, fd, st.st_size);
+        close(fd);
+        if (tree && root) Py_XSETREF(tree->root, root);
+        else Py_XDECREF(root);
+        Py_DECREF(scan_obj);
+        return (PyObject *)tree;
+    }
+    if (fd >= 0) close(fd);
+    if (version == 0) {
+        PyErr_Format(PyExc_ValueError, "%s: tree index of an older version; save it again", path);
+        goto done;
     }
 
-    strcpy(tdslot[0].dname, top);
-    tdslot[0].THRDid = totalTHRDS++;
-    tdslot[0].flag = 0;
-    tdslot[0].depth = -1;
-    tdslot[0].pinode = 0;
-    tdslot[0].buf = &buffers[0];
-    memcpy(&tdslot[0].pstat, &root, sizeof(struct stat));
+    if (scan_open(path, &sf) < 0) goto done;
 
-    /* Increment ThreadCNT BEFORE creating thread */
-    ThreadCNT = 1;
+    qMaxCol = 0;
+    for (int c = 0; c < TC_NCOLS; c++) {
+        PyObject *name = PyUnicode_FromString(treeScanColumns[c]);
+        treeCols[c] = name ? find_column(sf.columns, name) : -2;
+        if (treeCols[c] == -1) PyErr_Format(PyExc_ValueError, "no column %R in %s", name, path);
+        Py_XDECREF(name);
+        if (treeCols[c] < 0) goto done;
+        if (treeCols[c] > qMaxCol) qMaxCol = treeCols[c];
+    }
+    if (qMaxCol >= MAXTREECOL) {
+        PyErr_Format(PyExc_ValueError, "%s: unexpected column layout", path);
+        goto done;
+    }
 
-    /* Wait variables declared before Py_BEGIN_ALLOW_THREADS */
-    int iterations = 0;
-    int max_iterations = 3600;  /* 1 hour timeout */
-    int active = 1;
+    tree = (TreeObject *)TreeType.tp_alloc(&TreeType, 0);
+    if (!tree) goto done;
 
-    /* Start traversal with GIL released */
     Py_BEGIN_ALLOW_THREADS
+    tree_rows_free();
+    failed = scan_units(tree_unit, max_threads);
+    if (!failed) {
+        int rc = tree_build(tree);
+        failed = rc == -2 ? 3 : rc < 0 ? 1 : 0;
+    }
+    tree_rows_free();
+    Py_END_ALLOW_THREADS
+
+    if (failed == 2) PyErr_Format(PyExc_ValueError, "%s: cannot decompress a frame", path);
+    else if (failed == 3) PyErr_Format(PyExc_ValueError, "%s: too many rows for a tree", path);
+    else if (failed) PyErr_NoMemory();
+    else if (root && tree->nroots > 1)
+        PyErr_Format(PyExc_ValueError, "%s has %zd roots; root= needs a single-root scan", path,
+                     tree->nroots);
+    if (PyErr_Occurred()) {
+        Py_CLEAR(tree);
+        goto done;
+    }
+    tree->root = root;
+    root = NULL;
+
+done:
+    scan_close(&sf);
+    Py_XDECREF(root);
+    Py_DECREF(scan_obj);
+    return (PyObject *)tree;
+}
+
+/* PathIndex: a path index written by write_csv(index=True), memory-mapped */
+typedef struct {
+    PyObject_HEAD
+    void *map;
+    size_t mapSize;
+    PathIndexHeader h;
+    const uint64_t *bloom, *bits, *ranks, *left, *keys, *devs, *locs;
+    int scanFd;             /* the scan, for record() */
+    FrameDecoder dec;       /* compressed scan: the frame read last */
+    uint64_t frameOff;
+    ssize_t frameLen;       /* -1: no frame decoded */
+} PathIndexObject;
 
-    pthread_create(&tdslot[0].thread_id, &tdslot[0].tattr, traverse, (void*)&tdslot[0]);
+static void pidx_dealloc(PathIndexObject *self) {
+    if (self->map) munmap(self->map, self->mapSize);
+    if (self->scanFd >= 0) close(self->scanFd);
+    decoder_free(&self->dec);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
 
-    /* Wait for completion */
-    while (iterations < max_iterations) {
-        usleep(100000);  /* 100ms */
+static Py_ssize_t pidx_length(PathIndexObject *self) {
+    return (Py_ssize_t)self->h.nkeys;
+}
 
-        pthread_mutex_lock(&mutexFD);
-        active = ThreadCNT;
-        pthread_mutex_unlock(&mutexFD);
+/* End of the record starting at p: its newline outside quotes, or NULL */
+static const char *record_end(const char *p, const char *end) {
+    int quoted = 0;
+    for (; p < end; p++) {
+        if (*p == '"') quoted = !quoted;
+        else if (*p == '\n' && !quoted) return p;
+    }
+    return NULL;
+}
 
-        if (active == 0) break;
+/* The scan's record at a location (see INDEX_FRAME_SHIFT) as a str */
+static PyObject *pidx_read(PathIndexObject *self, uint64_t loc) {
+    if (self->h.compress) {
+        uint64_t frame = loc >> INDEX_FRAME_SHIFT;
+        size_t off = loc & ((1ULL << INDEX_FRAME_SHIFT) - 1);
+        if (self->frameLen < 0 || self->frameOff != frame) {
+            char *raw = malloc(FRAME_BOUND);
+            if (!raw) return PyErr_NoMemory();
+            ssize_t got, len = -1;
+            Py_BEGIN_ALLOW_THREADS
+            got = pread(self->scanFd, raw, FRAME_BOUND, (off_t)frame);
+            QueryUnit u = {raw, got > 0 ? frame_size(self->h.compress, raw, got) : 0, 0};
+            if (u.len) len = decode_unit(&self->dec, self->h.compress, &u);
+            Py_END_ALLOW_THREADS
+            free(raw);
+            if (got < 0) return PyErr_SetFromErrno(PyExc_OSError);
+            self->frameLen = len;
+            self->frameOff = frame;
+        }
+        if (self->frameLen < 0 || off >= (size_t)self->frameLen) {
+            PyErr_SetString(PyExc_ValueError, "scan does not match its index");
+            return NULL;
+        }
+        const char *p = self->dec.text + off, *end = self->dec.text + self->frameLen;
+        const char *nl = record_end(p, end);
+        return PyUnicode_DecodeUTF8(p, (nl ? nl : end) - p, "surrogateescape");
+    }
 
-        iterations++;
+    /* Plain scan: read on until the end of the record */
+    char *buf = NULL;
+    for (size_t cap = 4096;; cap *= 2) {
+        char *grown = realloc(buf, cap);
+        if (!grown) {
+            free(buf);
+            return PyErr_NoMemory();
+        }
+        buf = grown;
+        ssize_t got = pread(self->scanFd, buf, cap, (off_t)loc);
+        if (got < 0) {
+            free(buf);
+            return PyErr_SetFromErrno(PyExc_OSError);
+        }
+        const char *nl = record_end(buf, buf + got);
+        if (nl || (size_t)got < cap) {
+            PyObject *rec = PyUnicode_DecodeUTF8(buf, (nl ? nl : buf + got) - buf, "surrogateescape");
+            free(buf);
+            return rec;
+        }
     }
+}
 
-    Py_END_ALLOW_THREADS
+/* Location of the record of an inode on a device, or -1 */
+static int64_t pidx_locate(PathIndexObject *self, uint64_t ino, uint64_t dev) {
+    uint64_t key = index_key(dev, ino);
+    int64_t slot = mph_slot(&self->h, self->bits, self->ranks, self->left, key);
+    if (slot < 0) return -1;
+    /* Inodes sharing a key were left over and hold consecutive slots */
+    uint64_t s = (uint64_t)slot, first = self->h.nkeys - self->h.nleft;
+    do {
+        if (self->keys[s] == ino && self->devs[s] == dev) return (int64_t)self->locs[s];
+    } while (s >= first && ++s < self->h.nkeys && self->left[s - first] == key);
+    return -1;
+}
 
-    if (iterations >= max_iterations) {
-        fprintf(stderr, "WARNING: Timeout waiting for threads (active=%d)\n", active);
+/* (inode, dev=None) arguments; the device defaults to the top directory's */
+static int pidx_args(PathIndexObject *self, PyObject *args, PyObject *kwargs,
+                     unsigned long long *ino, unsigned long long *dev) {
+    static char *kwlist[] = {"inode", "dev", NULL};
+    PyObject *dev_obj = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "K|O", kwlist, ino, &dev_obj)) return -1;
+    *dev = self->h.dev;
+    if (dev_obj != Py_None) {
+        *dev = PyLong_AsUnsignedLongLong(dev_obj);
+        if (*dev == (unsigned long long)-1 && PyErr_Occurred()) return -1;
     }
+    return 0;
+}
 
-    /* Finalize zstd stream */
-#ifdef HAVE_ZSTD
-    if (compress && zstd_stream) {
-        char final_output[BUFFER_SIZE];
-        ZSTD_outBuffer output_buf = { final_output, sizeof(final_output), 0 };
-        ZSTD_inBuffer empty_input = { NULL, 0, 0 };
+static PyObject *pidx_contains(PathIndexObject *self, PyObject *arg) {
+    PyObject *path;
+    if (!PyUnicode_FSConverter(arg, &path)) return NULL;
+    int found = bloom_test(self->bloom, self->h.nblocks, path_key(PyBytes_AS_STRING(path)));
+    Py_DECREF(path);
+    return PyBool_FromLong(found);
+}
+
+static PyObject *pidx_locate_py(PathIndexObject *self, PyObject *args, PyObject *kwargs) {
+    unsigned long long ino, dev;
+    if (pidx_args(self, args, kwargs, &ino, &dev) < 0) return NULL;
+    int64_t loc = pidx_locate(self, ino, dev);
+    if (loc < 0) Py_RETURN_NONE;
+    return PyLong_FromLongLong(loc);
+}
+
+static PyObject *pidx_record(PathIndexObject *self, PyObject *args, PyObject *kwargs) {
+    unsigned long long ino, dev;
+    if (pidx_args(self, args, kwargs, &ino, &dev) < 0) return NULL;
+    int64_t loc = pidx_locate(self, ino, dev);
+    if (loc < 0) Py_RETURN_NONE;
+    return pidx_read(self, (uint64_t)loc);
+}
+
+static PyObject *pidx_get_header(PathIndexObject *self, void *closure) {
+    return pidx_read(self, 0);
+}
+
+static PyObject *pidx_get_paths(PathIndexObject *self, void *closure) {
+    return PyLong_FromUnsignedLongLong(self->h.npaths);
+}
+
+static PyObject *pidx_get_dev(PathIndexObject *self, void *closure) {
+    return PyLong_FromUnsignedLongLong(self->h.dev);
+}
+
+static PyMethodDef pidx_methods[] = {
+    {"contains", (PyCFunction)pidx_contains, METH_O,
+     "Whether a path may be in the scan (Bloom filter: no false negatives)"},
+    {"locate", (PyCFunction)pidx_locate_py, METH_VARARGS | METH_KEYWORDS,
+     "Location of an inode's record in the scan, None if absent"},
+    {"record", (PyCFunction)pidx_record, METH_VARARGS | METH_KEYWORDS,
+     "An inode's CSV record, None if absent"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef pidx_getset[] = {
+    {"header", (getter)pidx_get_header, NULL, "CSV header of the scan", NULL},
+    {"paths", (getter)pidx_get_paths, NULL, "Number of paths in the Bloom filter", NULL},
+    {"dev", (getter)pidx_get_dev, NULL, "st_dev of the top directory: the default device", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
 
-        ZSTD_compressStream2(zstd_stream, &output_buf, &empty_input, ZSTD_e_end);
-        fwrite(final_output, 1, output_buf.pos, output_file);
+static PySequenceMethods pidx_as_sequence = {
+    .sq_length = (lenfunc)pidx_length,
+};
+
+static PyTypeObject PathIndexType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "_pwalk_core.PathIndex",
+    .tp_basicsize = sizeof(PathIndexObject),
+    .tp_dealloc = (destructor)pidx_dealloc,
+    .tp_as_sequence = &pidx_as_sequence,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Path index of a scan: path membership and inode to record",
+    .tp_methods = pidx_methods,
+    .tp_getset = pidx_getset,
+};
+
+/* load_index: map a path index and open the scan it was written with */
+static PyObject *load_index(PyObject *self, PyObject *args) {
+    PyObject *index_obj, *scan_obj;
+    if (!PyArg_ParseTuple(args, "O&O&", PyUnicode_FSConverter, &index_obj, PyUnicode_FSConverter,
+                          &scan_obj)) {
+        return NULL;
+    }
+    const char *path = PyBytes_AS_STRING(index_obj);
+    PathIndexObject *idx = (PathIndexObject *)PathIndexType.tp_alloc(&PathIndexType, 0);
+    struct stat st;
+    int fd = -1;
+    if (!idx) goto done;
+    idx->scanFd = -1;
+    idx->frameLen = -1;
 
-        ZSTD_freeCStream(zstd_stream);
-        zstd_stream = NULL;
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        goto fail;
+    }
+    if ((size_t)st.st_size < sizeof(PathIndexHeader) ||
+        pread(fd, &idx->h, sizeof(idx->h), 0) != sizeof(idx->h) ||
+        memcmp(idx->h.magic, pidxMagic, sizeof(pidxMagic)) != 0) {
+        PyErr_Format(PyExc_ValueError, "%s is not a path index", path);
+        goto fail;
     }
-#endif
 
-    fclose(output_file);
+    /* Check the array sizes against the file before mapping it */
+    PathIndexHeader *h = &idx->h;
+    uint64_t words = (st.st_size - sizeof(*h)) / 8, nwords = 0, need;
+    int bad = h->nlevels > MPH_LEVELS || h->nleft > h->nkeys || h->nblocks == 0 ||
+              h->nblocks > words || h->nkeys > words || h->compress > COMPRESS_LZ4;
+    for (uint64_t l = 0; !bad && l < h->nlevels; l++) {
+        bad = h->levelWords[l] == 0 || h->levelWords[l] > words;
+        nwords += h->levelWords[l];
+    }
+    need = h->nblocks * 8 + nwords + nwords / 8 + 1 + h->nleft + 3 * h->nkeys;
+    if (bad || nwords > words || need * 8 + sizeof(*h) != (uint64_t)st.st_size) {
+        PyErr_Format(PyExc_ValueError, "%s: truncated path index", path);
+        goto fail;
+    }
+
+    idx->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (idx->map == MAP_FAILED) {
+        idx->map = NULL;
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        goto fail;
+    }
+    idx->mapSize = st.st_size;
+    idx->bloom = (const uint64_t *)((char *)idx->map + sizeof(*h));
+    idx->bits = idx->bloom + h->nblocks * 8;
+    idx->ranks = idx->bits + nwords;
+    idx->left = idx->ranks + nwords / 8 + 1;
+    idx->keys = idx->left + h->nleft;
+    idx->devs = idx->keys + h->nkeys;
+    idx->locs = idx->devs + h->nkeys;
 
-    return Py_BuildValue("{s:s,s:i}", "output", output, "compressed", compress);
+    idx->scanFd = open(PyBytes_AS_STRING(scan_obj), O_RDONLY);
+    if (idx->scanFd < 0) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, PyBytes_AS_STRING(scan_obj));
+        goto fail;
+    }
+    goto done;
+
+fail:
+    Py_CLEAR(idx);
+done:
+    if (fd >= 0) close(fd);
+    Py_DECREF(index_obj);
+    Py_DECREF(scan_obj);
+    return (PyObject *)idx;
 }
 
 static PyMethodDef Methods[] = {
-    {"write_csv", csv_write, METH_VARARGS, "Write CSV with optional zstd"},
+    {"write_csv", (PyCFunction)csv_write, METH_VARARGS | METH_KEYWORDS, "Write CSV with optional zstd"},
+    {"stat_csv", (PyCFunction)stat_write, METH_VARARGS | METH_KEYWORDS,
+     "lstat a list of paths in parallel, writing report() CSV records"},
+    {"du_totals", (PyCFunction)du_totals, METH_VARARGS | METH_KEYWORDS,
+     "Recursive disk usage per directory"},
+    {"estimate_totals", (PyCFunction)estimate_totals, METH_VARARGS | METH_KEYWORDS,
+     "Approximate totals from the top levels plus random probes"},
+    {"ext_totals", (PyCFunction)ext_totals, METH_VARARGS | METH_KEYWORDS,
+     "Count and bytes per file type and extension"},
+    {"cold_totals", (PyCFunction)cold_totals, METH_VARARGS | METH_KEYWORDS,
+     "Largest subtrees not used since a cutoff"},
+    {"find_paths", (PyCFunction)find_paths, METH_VARARGS | METH_KEYWORDS,
+     "Write the paths matching find-style predicates"},
+    {"query_scan", (PyCFunction)query_scan, METH_VARARGS | METH_KEYWORDS,
+     "Group-by aggregates over a scan file"},
+    {"load_tree", (PyCFunction)load_tree, METH_VARARGS | METH_KEYWORDS,
+     "Load a scan file as a Tree"},
+    {"load_index", (PyCFunction)load_index, METH_VARARGS,
+     "Map a path index written by write_csv(index=True)"},
     {NULL, NULL, 0, NULL}
 };
 
@@ -338,11 +5714,25 @@ static struct PyModuleDef module = {
 };
 
 PyMODINIT_FUNC PyInit__pwalk_core(void) {
+    if (PyType_Ready(&TreeType) < 0 || PyType_Ready(&TreeColumnType) < 0 ||
+        PyType_Ready(&PathIndexType) < 0) return NULL;
     PyObject *m = PyModule_Create(&module);
+    for (int i = 0; i < INODE_SHARDS; i++) pthread_mutex_init(&seenInodes[i].lock, NULL);
+    simd_init();
+    PyModule_AddStringConstant(m, "SIMD", simdNames[SIMDLEVEL]);
+    Py_INCREF(&TreeType);
+    PyModule_AddObject(m, "Tree", (PyObject *)&TreeType);
+    Py_INCREF(&PathIndexType);
+    PyModule_AddObject(m, "PathIndex", (PyObject *)&PathIndexType);
 #ifdef HAVE_ZSTD
     PyModule_AddIntConstant(m, "HAS_ZSTD", 1);
 #else
     PyModule_AddIntConstant(m, "HAS_ZSTD", 0);
+#endif
+#ifdef HAVE_LZ4
+    PyModule_AddIntConstant(m, "HAS_LZ4", 1);
+#else
+    PyModule_AddIntConstant(m, "HAS_LZ4", 0);
 #endif
     return m;
 }
@@ -0,0 +1,49 @@
+"""
+Integration tests for cold()
+"""
+
+import os
+import time
+
+from pwalk import cold
+
+
+def _age(root, days):
+    """Backdate every file and directory under root by days."""
+    past = time.time() - days * 86400
+    for dirpath, dirnames, filenames in os.walk(root, topdown=False):
+        for name in filenames:
+            os.utime(os.path.join(dirpath, name), (past, past))
+        os.utime(dirpath, (past, past))
+
+
+def test_cold_maximal_subtrees(simple_tree):
+    """Test that only the outermost cold subtrees are reported, with sizes."""
+    _age(simple_tree / "dir1", 400)
+    _age(simple_tree / "dir2", 400)
+    (simple_tree / "dir2" / "subdir" / "file3.log").touch()   # used today
+    os.utime(simple_tree / "dir2", (time.time() - 400 * 86400,) * 2)
+
+    rows, errors = cold(str(simple_tree), days=365, apparent_size=True)
+    assert errors == []
+    assert [path for path, size, last_used in rows] == [str(simple_tree / "dir1")]
+    path, size, last_used = rows[0]
+    assert size == sum(f.stat().st_size for f in (simple_tree / "dir1").iterdir()) + \
+        (simple_tree / "dir1").stat().st_size
+    assert last_used < time.time() - 399 * 86400
+
+    _age(simple_tree, 400)
+    rows, _ = cold(str(simple_tree), days=365)
+    assert [r[0] for r in rows] == [str(simple_tree)]
+    assert cold(str(simple_tree), days=365, min_size='1P')[0] == []
+
+
+def test_cold_mtime_only(simple_tree):
+    """Test that a recent read keeps a subtree warm unless atime is ignored."""
+    _age(simple_tree / "dir1", 400)
+    past = time.time() - 400 * 86400
+    os.utime(simple_tree / "dir1" / "file1.txt", (time.time(), past))
+
+    assert cold(str(simple_tree), days=365)[0] == []
+    rows, _ = cold(str(simple_tree), days=365, mtime_only=True)
+    assert [r[0] for r in rows] == [str(simple_tree / "dir1")]
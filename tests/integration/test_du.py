@@ -0,0 +1,61 @@
+"""
+Integration tests for du() disk usage totals
+"""
+
+import os
+
+import pytest
+
+from pwalk import du
+from pwalk.du import format_size
+
+
+def _apparent_total(path):
+    """Sum of st_size below path, hard links counted once."""
+    seen = set()
+    total = os.lstat(path).st_size
+    for dirpath, dirnames, filenames in os.walk(path):
+        for name in dirnames + filenames:
+            st = os.lstat(os.path.join(dirpath, name))
+            if (st.st_dev, st.st_ino) in seen:
+                continue
+            seen.add((st.st_dev, st.st_ino))
+            total += st.st_size
+    return total
+
+
+def test_du_apparent_totals(simple_tree):
+    """Test recursive totals against an os.walk() sum."""
+    totals, errors = du(str(simple_tree), apparent_size=True)
+    sizes = dict(totals)
+
+    assert errors == []
+    assert sizes[str(simple_tree)] == _apparent_total(str(simple_tree))
+    assert sizes[str(simple_tree / "dir2")] == _apparent_total(str(simple_tree / "dir2"))
+    assert totals[0][0] == str(simple_tree)
+    assert [size for _, size in totals] == sorted((size for _, size in totals), reverse=True)
+
+
+def test_du_max_depth_and_hardlinks(simple_tree):
+    """Test max_depth output and hard-link de-duplication."""
+    os.link(simple_tree / "file0.txt", simple_tree / "dir1" / "link0.txt")
+
+    totals, _ = du(str(simple_tree), max_depth=1, apparent_size=True)
+    paths = {path for path, _ in totals}
+    assert paths == {str(simple_tree), str(simple_tree / "dir1"), str(simple_tree / "dir2")}
+    assert dict(totals)[str(simple_tree)] == _apparent_total(str(simple_tree))
+
+    linked, _ = du(str(simple_tree), max_depth=0, apparent_size=True, count_links=True)
+    assert linked[0][1] == dict(totals)[str(simple_tree)] + os.path.getsize(simple_tree / "file0.txt")
+
+    with pytest.raises(ValueError):
+        du(str(simple_tree), max_depth=-1)
+
+
+def test_format_size():
+    """Test GNU du style size formatting."""
+    assert format_size(1) == '1'
+    assert format_size(4096) == '4'
+    assert format_size(512, human=True) == '512'
+    assert format_size(1536, human=True) == '1.5K'
+    assert format_size(250 * 1024 * 1024, human=True) == '250M'
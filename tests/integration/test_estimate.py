@@ -0,0 +1,73 @@
+"""
+Integration tests for estimate() sampling
+"""
+
+import os
+import statistics
+
+import pytest
+
+from pwalk import estimate
+
+
+def _truth(top):
+    files = dirs = size = 0
+    for dirpath, dirnames, filenames in os.walk(top):
+        dirs += len(dirnames)
+        files += len(filenames)
+        size += sum(os.lstat(os.path.join(dirpath, n)).st_size for n in dirnames + filenames)
+    return files, dirs + 1, size + os.lstat(top).st_size
+
+
+def test_estimate_exact_when_fully_read(simple_tree):
+    """Test that reading every level gives the exact totals."""
+    est = estimate(str(simple_tree), full_depth=10, seed=1)
+    files, dirs, size = _truth(simple_tree)
+    assert est['strata'] == 0
+    assert (est['files']['estimate'], est['dirs']['estimate'], est['bytes']['estimate']) == \
+        (files, dirs, size)
+    assert est['files']['stddev'] == 0 and est['files']['low'] == est['files']['high'] == files
+
+
+def test_estimate_sampled(deep_tree):
+    """Test probes on a chain, where every probe sees the whole subtree."""
+    est = estimate(str(deep_tree), full_depth=1, probes=4, seed=7)
+    files, dirs, size = _truth(deep_tree)
+    assert est['strata'] == 1
+    assert est['files']['estimate'] == files and est['dirs']['estimate'] == dirs
+    assert est['bytes']['estimate'] == size
+    assert est['files']['rse'] == 0
+
+    # Same seed, same answer
+    assert estimate(str(deep_tree), full_depth=0, seed=3) == estimate(str(deep_tree), full_depth=0,
+                                                                       seed=3)
+    with pytest.raises(ValueError):
+        estimate(str(deep_tree), probes=1)
+
+
+def test_estimate_branching_unbiased(temp_dir):
+    """Test probes on an uneven tree: unbiased on average, with a variance that matches."""
+    top = temp_dir / "branching"
+    top.mkdir()
+    for i in range(6):
+        d = top / f"d{i}"
+        d.mkdir()
+        for f in range(i * 3):
+            (d / f"f{f}").write_text('x' * (100 * i))
+        for j in range(i % 3):
+            (d / f"s{j}").mkdir()
+            for f in range(5 * (j + 1)):
+                (d / f"s{j}" / f"g{f}").write_text('')
+    files, dirs, size = _truth(top)
+    assert (files, dirs) == (85, 13)
+
+    runs = [estimate(str(top), full_depth=0, probes=8, seed=seed) for seed in range(200)]
+    values = [run['files']['estimate'] for run in runs]
+    assert all(run['strata'] == 1 and run['files']['stddev'] > 0 for run in runs)
+    assert len(set(values)) > 10
+
+    spread = statistics.stdev(values)
+    assert abs(statistics.mean(values) - files) < 3 * spread / len(values) ** 0.5
+    reported = statistics.mean(run['files']['stddev'] for run in runs)
+    assert 0.7 < reported / spread < 1.4
+    assert abs(statistics.mean(run['bytes']['estimate'] for run in runs) - size) < 0.1 * size
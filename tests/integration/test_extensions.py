@@ -0,0 +1,40 @@
+"""
+Integration tests for extensions() and report(ext_stats=...)
+"""
+
+import os
+from collections import Counter
+
+from pwalk import extensions, report
+
+
+def test_extensions(simple_tree):
+    """Test counts and bytes per extension against os.walk."""
+    rows, errors = extensions(str(simple_tree))
+    assert errors == []
+
+    counts, sizes = Counter(), Counter()
+    for dirpath, dirnames, filenames in os.walk(simple_tree):
+        for name in filenames:
+            ext = name.rsplit('.', 1)[1].lower() if '.' in name[1:] else ''
+            counts['f', ext] += 1
+            sizes['f', ext] += os.lstat(os.path.join(dirpath, name)).st_size
+        counts['d', ''] += len(dirnames)
+    counts['d', ''] += 1  # the top itself
+    assert {(t, e): n for t, e, n, size, disk in rows} == counts
+    assert all(size == sizes[t, e] for t, e, n, size, disk in rows if t == 'f')
+    assert [r[3] for r in rows] == sorted((r[3] for r in rows), reverse=True)
+
+
+def test_extensions_by_top_dir(simple_tree, temp_dir):
+    """Test grouping by top-level directory, also during a report()."""
+    (simple_tree / "dir2" / "subdir" / "IMAGE.TIF").write_bytes(b'x' * 100)
+    rows, _ = extensions(str(simple_tree), by_top_dir=True)
+    by_key = {(top, t, ext): (n, size) for top, t, ext, n, size, disk in rows}
+    assert by_key[str(simple_tree / "dir2"), 'f', 'tif'] == (1, 100)
+    assert by_key[str(simple_tree), 'f', 'txt'][0] == 1      # file0.txt
+    assert by_key[str(simple_tree / "dir1"), 'f', 'txt'][0] == 1
+
+    result = report(str(simple_tree), output=str(temp_dir / "scan.csv"), compress='none',
+                    ext_stats='top')
+    assert sorted(result.ext_stats) == sorted(rows)
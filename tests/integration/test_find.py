@@ -0,0 +1,73 @@
+"""
+Integration tests for find() predicates
+"""
+
+import os
+import time
+
+import pytest
+
+from pwalk import find
+from pwalk.find import parse_expression
+
+
+def test_find_name_and_type(simple_tree):
+    """Test glob and type predicates against an os.walk() listing."""
+    paths, errors = find(str(simple_tree), name='*.txt', type='f')
+
+    expected = [os.path.join(d, f) for d, _, files in os.walk(simple_tree)
+                for f in files if f.endswith('.txt')]
+    assert errors == []
+    assert sorted(paths) == sorted(expected)
+
+    dirs, _ = find(str(simple_tree), type='d', max_depth=1)
+    assert sorted(dirs) == sorted([str(simple_tree), str(simple_tree / "dir1"),
+                                   str(simple_tree / "dir2")])
+
+
+def test_find_size_mtime_perm(simple_tree, temp_dir):
+    """Test numeric predicates and writing matches to a file."""
+    big = simple_tree / "dir1" / "big.bin"
+    big.write_bytes(b'x' * 5000)
+    old = simple_tree / "file0.txt"
+    os.utime(old, (time.time() - 10 * 86400, time.time() - 10 * 86400))
+    os.chmod(big, 0o640)
+
+    assert find(str(simple_tree), size='+4k').output == [str(big)]
+    assert find(str(simple_tree), mtime='+7').output == [str(old)]
+    assert find(str(simple_tree), perm='640', type='f').output == [str(big)]
+    assert find(str(simple_tree), iname='BIG.*', newer=str(old)).output == [str(big)]
+
+    output = temp_dir / "matches.txt"
+    result = find(str(simple_tree), output=str(output), size='+4k')
+    assert result.stats['count'] == 1
+    assert output.read_text() == str(big) + "\n"
+
+    with pytest.raises(TypeError):
+        find(str(simple_tree), owner='root')
+
+
+def test_parse_expression():
+    """Test GNU find command line parsing."""
+    paths, options = parse_expression(['/a', '/b', '-name', '*.c', '-size', '-1k',
+                                       '-maxdepth', '2', '-xdev', '-print'])
+    assert paths == ['/a', '/b']
+    assert options == {'name': '*.c', 'size': '-1k', 'max_depth': 2, 'one_filesystem': True}
+
+    with pytest.raises(ValueError):
+        parse_expression(['/a', '-exec', 'rm'])
+
+
+def test_find_future_mtime_and_xdev(simple_tree):
+    """Ages round down like find; -xdev still prints the mountpoint."""
+    future = simple_tree / "dir1" / "file1.txt"
+    os.utime(future, (time.time() + 3600, time.time() + 3600))
+
+    assert find(str(simple_tree), mtime='-0').output == [str(future)]
+    assert str(future) not in find(str(simple_tree), mtime='0').output
+    assert str(future) not in find(str(simple_tree), mtime='+0').output
+
+    if not os.path.isdir('/dev/shm') or os.lstat('/dev/shm').st_dev == os.lstat('/dev').st_dev:
+        pytest.skip("/dev/shm is not a separate filesystem here")
+    found = find('/dev', name='shm', max_depth=1, one_filesystem=True)
+    assert found.output == ['/dev/shm']
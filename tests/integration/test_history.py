@@ -0,0 +1,82 @@
+"""
+Integration tests for scan summaries, the history file and trend()
+"""
+
+import json
+import os
+import struct
+from collections import Counter
+
+from pwalk import record_history, report, trend
+from pwalk.history import append_history, read_history
+
+
+def test_report_summary(simple_tree, temp_dir):
+    """Test per-user, per-group and per-top-dir totals against os.walk."""
+    result = report(str(simple_tree), output=str(temp_dir / "scan.csv"), compress='none',
+                    summary=True)
+    sizes = Counter()
+    for dirpath, dirnames, filenames in os.walk(simple_tree):
+        rel = os.path.relpath(dirpath, simple_tree)
+        for name in [''] + dirnames + filenames:
+            path = os.path.join(dirpath, name) if name else dirpath
+            st = os.lstat(path)
+            if rel != '.':
+                top = os.path.join(str(simple_tree), rel.split(os.sep)[0])
+            elif name and name in dirnames:
+                top = path
+            else:
+                top = str(simple_tree)
+            if name or rel == '.':
+                for key in (('user', st.st_uid), ('group', st.st_gid), ('top', top)):
+                    sizes[key] += st.st_size
+    assert {(kind, key): size for kind, key, n, size, disk in result.summary} == sizes
+
+
+def test_history_trend(simple_tree, temp_dir):
+    """Test appending scans, surviving a torn append, and growth rates."""
+    history = str(temp_dir / "scans.hist")
+    rows, errors = record_history(str(simple_tree), history)
+    assert errors == []
+    dir1 = str(simple_tree / "dir1")
+    base = dict(((k, key), size) for k, key, n, size, disk in rows)[('top', dir1)]
+
+    first = read_history(history)[0].time
+    for day in (10, 20):
+        grown = [(k, key, n, size + day * 1000 if key == dir1 else size, disk)
+                 for k, key, n, size, disk in rows]
+        append_history(history, grown, [str(simple_tree)], when=first + day * 86400)
+    with open(history, 'ab') as f:
+        f.write(b'PWHS\xff\xff\xff\x00torn')
+    append_history(history, rows + [('top', '/gone', 1, 5, 8)], [str(simple_tree)],
+                   when=first - 86400)
+
+    snapshots = read_history(history)
+    assert len(snapshots) == 4
+    assert [s.time for s in snapshots] == sorted(s.time for s in snapshots)
+
+    by_dir = {key: row for key, *row in trend(history, by='top', days=20.5)}
+    n, size, disk, change, rate, files_rate = by_dir[dir1]
+    assert size == base + 20000 and change == 20000
+    assert abs(rate - 1000) < 1e-6
+    assert list(by_dir)[0] == dir1
+    assert '/gone' not in by_dir
+    assert '/gone' in {key for key, *row in trend(history, by='top')}
+
+
+def test_history_long_tops_and_old_segments(temp_dir):
+    """Test path lists over 64 KiB and appending to segments of the older format."""
+    history = str(temp_dir / "scans.hist")
+    tops_json = b'["/old"]'
+    body = (struct.pack('<dH', 1000.0, len(tops_json)) + tops_json + struct.pack('<I', 1) +
+            struct.pack('<BH', 2, 4) + b'/old' + struct.pack('<IIqqq', 1, 0, 3, 300, 512))
+    with open(history, 'wb') as f:
+        f.write(b'PWHS' + struct.pack('<I', len(body)) + body)
+
+    tops = [f"/projects/{i:04d}/" + 'x' * 200 for i in range(400)]
+    append_history(history, [('top', '/old', 4, 400, 1024), ('user', 1000, 1, 2, 3)], tops,
+                   when=2000.0)
+    old, new = read_history(history)
+    assert old.tops == ['/old'] and old.totals == {('top', '/old'): (3, 300, 512)}
+    assert new.tops == tops and len(json.dumps(tops)) > 65535
+    assert new.totals == {('top', '/old'): (4, 400, 1024), ('user', 1000): (1, 2, 3)}
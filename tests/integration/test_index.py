@@ -0,0 +1,102 @@
+"""
+Integration tests for report(index=True) and open_index()
+"""
+
+import os
+import shutil
+import sys
+import tempfile
+
+import pytest
+
+import _pwalk_core
+from pwalk import open_index, report
+from pwalk.cli import main
+
+
+@pytest.mark.parametrize("compress", ['none', 'zstd', 'lz4'])
+def test_index_lookups(simple_tree, temp_dir, compress):
+    """Every scanned path and inode is found; the record is the scan's."""
+    if compress == 'zstd' and not _pwalk_core.HAS_ZSTD:
+        pytest.skip("built without zstd")
+    if compress == 'lz4' and not _pwalk_core.HAS_LZ4:
+        pytest.skip("built without lz4")
+    os.link(simple_tree / "file0.txt", simple_tree / "dir1" / "link.txt")
+
+    result = report(str(simple_tree), output=str(temp_dir / "scan.csv"), compress=compress,
+                    index=True)
+    assert result.errors == []
+    assert os.path.exists(result.output + '.pidx')
+    idx = open_index(result.output)
+
+    paths = [str(simple_tree)]
+    for dirpath, dirnames, filenames in os.walk(simple_tree):
+        paths += [os.path.join(dirpath, n) for n in dirnames + filenames]
+    assert len(idx) == len(paths) - 1  # the hard link shares an inode
+    for path in paths:
+        st = os.lstat(path)
+        assert path in idx and path + '/' in idx
+        assert st.st_ino in idx and st in idx and (st.st_ino, st.st_dev) in idx
+        row = idx.lookup(st.st_ino, st.st_dev)
+        assert row['inode'] == st.st_ino and row['st_size'] == st.st_size
+        assert row['filename'] in (os.path.basename(path), 'file0.txt', 'link.txt')
+        assert idx.lookup(st.st_ino, st.st_dev + 1) is None
+
+    assert max(st.st_ino for st in map(os.lstat, paths)) + 1 not in idx
+    assert idx.lookup(0) is None
+    missing = sum(f"{simple_tree}/missing{i}" in idx for i in range(2000))
+    assert missing < 100  # about 1% false positives
+
+
+def test_lookup_cli(simple_tree, temp_dir, capsys):
+    """pwalk lookup prints records of inodes and the paths present."""
+    scan, _ = report(str(simple_tree), output=str(temp_dir / "scan.csv"), compress='none',
+                     index=True)
+    ino = os.lstat(simple_tree / "file0.txt").st_ino
+
+    argv = sys.argv
+    try:
+        sys.argv = ['pwalk', 'lookup', scan, str(ino), str(simple_tree / "file0.txt")]
+        assert main() == 0
+        sys.argv = ['pwalk', 'lookup', scan, str(simple_tree / "no such file")]
+        missing = main()
+    finally:
+        sys.argv = argv
+    out = capsys.readouterr().out.splitlines()
+    assert out[0].startswith(f"{ino},") and '"file0.txt"' in out[0]
+    assert out[1] == str(simple_tree / "file0.txt")
+    assert missing == 1 or len(out) == 3
+
+
+def test_index_two_devices(simple_tree, temp_dir):
+    """Inodes are keyed with their device: each (dev, inode) finds its own record."""
+    shm = "/dev/shm"
+    if not os.path.isdir(shm) or os.lstat(shm).st_dev == os.lstat(simple_tree).st_dev or \
+            not os.access(shm, os.W_OK):
+        pytest.skip("needs a writable /dev/shm on its own filesystem")
+    other = tempfile.mkdtemp(dir=shm)
+    try:
+        for i in range(20):
+            with open(os.path.join(other, f"f{i}"), 'w') as f:
+                f.write('x' * i)
+        scan, _ = report([str(simple_tree), other], output=str(temp_dir / "scan.csv"),
+                         compress='none', index=True)
+        idx = open_index(scan)
+        assert idx.dev == os.lstat(simple_tree).st_dev
+
+        stats = [os.lstat(os.path.join(d, n)) for top in (str(simple_tree), other)
+                 for d, dirs, files in os.walk(top) for n in ['.'] + dirs + files]
+        assert len(idx) == len({(st.st_dev, st.st_ino) for st in stats})
+        for st in stats:
+            row = idx.lookup(st.st_ino, st.st_dev)
+            assert (row['inode'], row['st_dev'], row['st_size']) == (st.st_ino, st.st_dev, st.st_size)
+            for dev in {s.st_dev for s in stats} - {st.st_dev}:
+                assert ((st.st_ino, dev) in idx) == any(
+                    s.st_ino == st.st_ino and s.st_dev == dev for s in stats)
+
+        # The default device is the first top directory's, whichever rows land first
+        scan, _ = report([other, str(simple_tree)], output=str(temp_dir / "rev.csv"),
+                         compress='none', index=True, max_threads=4)
+        assert open_index(scan).dev == os.lstat(other).st_dev
+    finally:
+        shutil.rmtree(other)
@@ -0,0 +1,139 @@
+"""
+Integration tests for query() aggregates over scan files
+"""
+
+import csv
+import json
+import os
+import subprocess
+import sys
+from collections import defaultdict
+
+import pytest
+
+import _pwalk_core
+from pwalk import query, report
+
+
+def _expected(scan):
+    """sum(st_size) and count per UID, computed with the csv module."""
+    totals = defaultdict(lambda: [0, 0])
+    with open(scan) as f:
+        for row in csv.DictReader(f):
+            totals[int(row['UID'])][0] += int(row['st_size'])
+            totals[int(row['UID'])][1] += 1
+    return {uid: tuple(v) for uid, v in totals.items()}
+
+
+def test_query_plain_csv(deep_tree, temp_dir):
+    """Test group-by aggregates against the csv module."""
+    scan, _ = report(str(deep_tree), output=str(temp_dir / "scan.csv"), compress='none')
+
+    columns, rows = query(scan, group_by=['uid'], aggregates=[('sum', 'st_size'), ('count', None)])
+    assert columns == ['UID', 'sum(st_size)', 'count']
+    assert {uid: (size, n) for uid, size, n in rows} == _expected(scan)
+
+    columns, rows = query(scan, group_by=['fileExtension'],
+                          aggregates=[('max', 'st_size'), ('min', 'st_size'), ('avg', 'st_size')])
+    by_ext = {row[0]: row[1:] for row in rows}
+    assert by_ext['txt'][0] >= by_ext['txt'][2] >= by_ext['txt'][1]
+
+    with pytest.raises(ValueError, match="no column"):
+        query(scan, group_by=['owner'])
+
+
+def test_query_zstd_frames(deep_tree, temp_dir):
+    """Test that compressed scans give the same answer as plain ones."""
+    if not _pwalk_core.HAS_ZSTD:
+        pytest.skip("zstd not available")
+
+    plain, _ = report(str(deep_tree), output=str(temp_dir / "scan.csv"), compress='none')
+    packed, _ = report(str(deep_tree), output=str(temp_dir / "scan.csv"), compress='zstd',
+                       max_threads=4)
+    assert packed.endswith('.zst')
+
+    aggregates = [('sum', 'st_size'), ('count', None)]
+    assert (sorted(query(packed, group_by=['uid', 'gid'], aggregates=aggregates)[1]) ==
+            sorted(query(plain, group_by=['uid', 'gid'], aggregates=aggregates)[1]))
+
+
+def test_query_lz4_frames(deep_tree, temp_dir):
+    """Test lz4 output and reading it back."""
+    if not _pwalk_core.HAS_LZ4:
+        pytest.skip("lz4 not available")
+
+    plain, _ = report(str(deep_tree), output=str(temp_dir / "scan.csv"), compress='none')
+    packed, _ = report(str(deep_tree), output=str(temp_dir / "scan.csv"), compress='lz4',
+                       max_threads=4)
+    assert packed.endswith('.csv.lz4')
+    with open(packed, 'rb') as f:
+        assert f.read(4) == b'\x04\x22\x4d\x18'
+
+    aggregates = [('sum', 'st_size'), ('count', None)]
+    assert (sorted(query(packed, group_by=['uid'], aggregates=aggregates)[1]) ==
+            sorted(query(plain, group_by=['uid'], aggregates=aggregates)[1]))
+
+
+def test_simd_levels_agree(simple_tree, temp_dir):
+    """Test that every SIMD level escapes and parses names identically."""
+    names = ['a"b,c', '"' * 70, 'x' * 63 + '"' + 'y' * 40, 'comma,' * 20, 'q' * 129]
+    for name in names:
+        (simple_tree / "dir1" / name).write_text("x")
+    script = (
+        "import json, sys, _pwalk_core; from pwalk import query, report\n"
+        "scan, _ = report(sys.argv[1], output=sys.argv[2], compress='none')\n"
+        "rows = query(scan, group_by=['filename'], aggregates=[('count', None)])[1]\n"
+        "print(json.dumps([_pwalk_core.SIMD, sorted(rows)]))"
+    )
+    results = {}
+    for level in ('scalar', 'sse2', 'avx2', 'avx512'):
+        env = dict(os.environ, PWALK_SIMD=level)
+        scan = temp_dir / f"{level}.csv"
+        out = subprocess.run([sys.executable, '-c', script, str(simple_tree), str(scan)],
+                             env=env, capture_output=True, text=True, check=True).stdout
+        used, rows = json.loads(out)
+        with open(scan, newline='') as f:
+            found = sorted(row['filename'] for row in csv.DictReader(f))
+        results[used] = (rows, found)
+    assert 'scalar' in results
+    assert len({json.dumps(r) for r in results.values()}) == 1
+
+    rows, found = results['scalar']
+    assert {os.path.basename(p) for p in found} >= set(names)
+    assert sorted(r[0] for r in rows) == found
+
+
+def test_query_wide_header_and_junk_values(temp_dir):
+    """Test columns past the first 16, junk values, and avg over parsed values."""
+    scan = temp_dir / "wide.csv"
+    header = [f"c{i}" for i in range(300)]
+    rows = [('a', '10'), ('a', 'abc'), ('a', '-'), ('a', '20'), ('b', '7x'), ('b', '')]
+    with open(scan, 'w', newline='') as f:
+        out = csv.writer(f, lineterminator="\n")
+        out.writerow(header)
+        for key, value in rows:
+            out.writerow(['0'] * 58 + [value, key] + ['0'] * 240)
+
+    _, result = query(str(scan), group_by=['c59'],
+                      aggregates=[('count', None), ('sum', 'c58'), ('min', 'c58'),
+                                  ('avg', 'c58')])
+    assert sorted(result) == [('a', 4, 30, 10, 15.0), ('b', 2, 0, None, None)]
+
+    with pytest.raises(ValueError, match="columns"):
+        query(str(scan), group_by=['c299'])
+
+
+def test_query_unit_cut_outside_quotes(temp_dir):
+    """Test that a quoted newline at a unit boundary does not split a record."""
+    scan = temp_dir / "cut.csv"
+    pad = 2097150  # "p,1\n" rows: the 8 MiB cut falls inside the next name
+    with open(scan, 'w', newline='') as f:
+        f.write("name,size\n")
+        f.write("p,1\n" * pad)
+        f.write('"' + 'x' * 100 + '\n' + 'y' * 100 + '",5\n')
+        f.write("z,2\n")
+
+    _, rows = query(str(scan), group_by=['name'], aggregates=[('count', None), ('sum', 'size')],
+                    max_threads=2)
+    assert sorted(rows) == sorted([('p', pad, pad), ('x' * 100 + '\n' + 'y' * 100, 1, 5),
+                                   ('z', 1, 2)])
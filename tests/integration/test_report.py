@@ -7,7 +7,7 @@ import os
 import csv
 from pathlib import Path
 
-from pwalk import report
+from pwalk import du, report, stat_many
 
 
 def test_report_csv_basic(simple_tree, temp_dir):
@@ -94,5 +94,437 @@ def test_report_with_compression(temp_dir):
     result_path, errors = report(str(root), output=str(output), compress='zstd')
 
     assert Path(result_path).exists()
-    # Compressed file should exist
-    assert result_path == str(output)
+    # Compressed file gets the .zst suffix and is valid zstd from the first byte
+    assert result_path == str(output) + '.zst'
+    with open(result_path, 'rb') as f:
+        assert f.read(4) == b'\x28\xb5\x2f\xfd'
+
+
+def test_report_one_filesystem(simple_tree, temp_dir):
+    """Test that one-filesystem mode scans a single-device tree completely."""
+    full_path, _ = report(str(simple_tree), output=str(temp_dir / "full.csv"), compress='none')
+    with open(full_path) as f:
+        full_rows = f.readlines()
+
+    result = report(
+        str(simple_tree),
+        output=str(temp_dir / "onefs.csv"),
+        compress='none',
+        one_filesystem=True
+    )
+    output, errors = result
+
+    assert result.mountpoints == []
+    with open(output) as f:
+        assert len(f.readlines()) == len(full_rows)
+
+
+def test_report_one_filesystem_mountpoint(temp_dir):
+    """A skipped mountpoint still gets its own row, but is not read."""
+    if not os.path.isdir('/dev/shm') or os.lstat('/dev/shm').st_dev == os.lstat('/dev').st_dev:
+        pytest.skip("/dev/shm is not a separate filesystem here")
+
+    result = report('/dev', output=str(temp_dir / "dev.csv"), compress='none',
+                    one_filesystem=True, max_depth=1)
+    assert '/dev/shm' in result.mountpoints
+    with open(result.output) as f:
+        rows = list(csv.DictReader(f))
+    shm = [r for r in rows if r['filename'] == 'shm']
+    assert len(shm) == 1
+    assert int(shm[0]['inode']) == os.lstat('/dev/shm').st_ino
+    assert int(shm[0]['pw_fcount']) == 0
+    assert result.depth_counts[1] == len(rows) - 1
+
+
+def _report_names(path):
+    with open(path) as f:
+        reader = csv.reader(f)
+        next(reader)
+        return [row[3] for row in reader]
+
+
+def test_report_skips_snapshots_by_default(tree_with_snapshots, temp_dir):
+    """Test that .snapshot directories are not scanned by default."""
+    output, _ = report(str(tree_with_snapshots), output=str(temp_dir / "snap.csv"), compress='none')
+    names = _report_names(output)
+
+    assert 'file.txt' in names
+    assert '.snapshot' not in names
+    assert 'snapshot_file.txt' not in names
+
+
+def test_report_custom_skip_names(tree_with_snapshots, temp_dir):
+    """Test configurable skip-name set."""
+    (tree_with_snapshots / "data" / ".zfs").mkdir()
+    (tree_with_snapshots / "data" / ".zfs" / "zfs_file.txt").write_text("zfs snapshot")
+
+    output, _ = report(str(tree_with_snapshots), output=str(temp_dir / "skip.csv"),
+                       compress='none', skip_names=['.zfs', 'data'])
+    names = _report_names(output)
+    assert 'data' not in names and 'file.txt' not in names
+    assert '.snapshot' in names
+
+    output, _ = report(str(tree_with_snapshots), output=str(temp_dir / "noskip.csv"),
+                       compress='none', skip_names=())
+    names = _report_names(output)
+    assert 'snapshot_file.txt' in names
+    assert 'zfs_file.txt' in names
+
+
+def test_report_skip_names_directories_only(tree_with_snapshots, temp_dir):
+    """Skip names match directories only; a single str is one name."""
+    (tree_with_snapshots / "data" / "scratch").write_text("a file, not a directory")
+    (tree_with_snapshots / "scratch").mkdir()
+    (tree_with_snapshots / "scratch" / "tmp_file.txt").write_text("skipped")
+
+    output, _ = report(str(tree_with_snapshots), output=str(temp_dir / "skip.csv"),
+                       compress='none', skip_names='scratch')
+    names = _report_names(output)
+    assert names.count('scratch') == 1  # the file, not the directory
+    assert 'tmp_file.txt' not in names
+    assert 'snapshot_file.txt' in names  # replaces the default set
+
+
+def test_report_max_depth(deep_tree, temp_dir):
+    """Test max_depth cut-off and per-depth statistics."""
+    full = report(str(deep_tree), output=str(temp_dir / "full.csv"), compress='none')
+    # Each level holds one file and one directory; the last level is empty
+    assert full.depth_counts == [1] + [2] * 10
+
+    result = report(str(deep_tree), output=str(temp_dir / "cut.csv"),
+                    compress='none', max_depth=3)
+    names = _report_names(result.output)
+    assert result.depth_counts == [1, 2, 2, 2]
+    assert 'level_2' in names
+    assert 'file_level_3.txt' not in names
+
+    counted = report(str(deep_tree), output=str(temp_dir / "count.csv"),
+                     compress='none', max_depth=3, count_below=True)
+    assert counted.depth_counts == full.depth_counts
+    assert sorted(_report_names(counted.output)) == sorted(names)
+
+
+def test_report_count_below_deep_chain(temp_dir):
+    """Test counting below the cut-off through a deep chain, and its read errors."""
+    top = temp_dir / "chain"
+    path = str(top)
+    os.mkdir(path)
+    for i in range(900):
+        path = os.path.join(path, 'd')
+        os.mkdir(path)
+    (top / "unreadable").mkdir()
+    os.chmod(top / "unreadable", 0)
+
+    result = report(str(top), output=str(temp_dir / "chain.csv"), compress='none',
+                    max_depth=1, count_below=True, max_threads=2)
+    os.chmod(top / "unreadable", 0o755)
+    assert sum(result.depth_counts) == 1 + 900 + 1
+    if os.geteuid() != 0:
+        assert any('unreadable' in e for e in result.errors)
+
+
+def test_report_max_depth_zero(simple_tree, temp_dir):
+    """Test that max_depth=0 only records the root."""
+    result = report(str(simple_tree), output=str(temp_dir / "root.csv"),
+                    compress='none', max_depth=0)
+    assert result.depth_counts == [1]
+    assert len(_report_names(result.output)) == 1
+
+
+def test_report_xattr_columns(simple_tree, temp_dir):
+    """Test optional ACL/xattr columns."""
+    target = simple_tree / "file0.txt"
+    try:
+        os.setxattr(target, b"user.pwalk_test", b"1")
+    except OSError:
+        pytest.skip("user xattrs not supported on this filesystem")
+
+    output, _ = report(str(simple_tree), output=str(temp_dir / "xattr.csv"),
+                       compress='none', xattrs='all')
+    with open(output) as f:
+        rows = list(csv.DictReader(f))
+
+    assert 'has_acl' in rows[0] and 'xattrs' in rows[0]
+    by_name = {row['filename']: row for row in rows}
+    assert by_name['file0.txt']['xattrs'] == 'user.pwalk_test'
+    assert by_name['file0.txt']['has_acl'] == '0'
+    assert by_name['file1.txt']['xattrs'] == ''
+
+    with pytest.raises(ValueError, match="Invalid xattrs"):
+        report(str(simple_tree), xattrs='bogus')
+
+
+def test_report_ns_timestamps(simple_tree, temp_dir):
+    """Test nanosecond timestamp and birth time columns."""
+    target = simple_tree / "file0.txt"
+    os.utime(target, ns=(1_600_000_000_123_456_789, 1_700_000_000_987_654_321))
+
+    output, _ = report(str(simple_tree), output=str(temp_dir / "ns.csv"),
+                       compress='none', ns_timestamps=True, xattrs='acl')
+    with open(output) as f:
+        rows = list(csv.DictReader(f))
+
+    row = next(r for r in rows if r['filename'] == 'file0.txt')
+    assert row['st_atime_ns'] == '1600000000123456789'
+    assert row['st_mtime_ns'] == '1700000000987654321'
+    assert int(row['st_mtime']) == 1700000000
+    assert row['st_btime_ns'] == '' or int(row['st_btime_ns']) > 0
+    assert row['has_acl'] == '0'
+    assert int(row['st_size']) == target.stat().st_size
+
+
+def test_report_inode_order(large_flat_tree, temp_dir):
+    """Test that inode-ordered stat reports the same entries, sorted by inode."""
+    plain, _ = report(str(large_flat_tree), output=str(temp_dir / "plain.csv"), compress='none')
+    ordered, _ = report(str(large_flat_tree), output=str(temp_dir / "ordered.csv"),
+                        compress='none', inode_order=True)
+
+    # Compare inode and name only: reading the directory may update its atime
+    with open(plain) as f:
+        plain_rows = sorted(line.split(',')[:4] for line in f)
+    with open(ordered) as f:
+        ordered_lines = f.readlines()
+    assert sorted(line.split(',')[:4] for line in ordered_lines) == plain_rows
+
+    file_inodes = [int(line.split(',')[0]) for line in ordered_lines[1:-1]]
+    assert file_inodes == sorted(file_inodes)
+
+
+def test_subtree_sizes(filesystem_tree, temp_dir):
+    """Test subtree rollup of a previous scan."""
+    from pwalk.report import subtree_sizes
+
+    output, _ = report(str(filesystem_tree), output=str(temp_dir / "prev.csv"), compress='none')
+    sizes = subtree_sizes(output)
+
+    with open(output) as f:
+        rows = f.readlines()[1:]
+    assert sizes[filesystem_tree.stat().st_ino] == len(rows) - 1
+    leaf = filesystem_tree / "dir_3_0" / "dir_2_0" / "dir_1_0"
+    assert sizes[leaf.stat().st_ino] == 5
+
+
+def test_report_size_hints_schedule_first(temp_dir):
+    """Test that the subtree with the largest hint is scanned first."""
+    root = temp_dir / "hinted"
+    for name in ("aaa", "bbb", "ccc"):
+        (root / name).mkdir(parents=True)
+        (root / name / f"{name}.txt").write_text(name)
+
+    hinted = (root / "bbb").stat().st_ino
+    output, _ = report(str(root), output=str(temp_dir / "hinted.csv"), compress='none',
+                       max_threads=1, size_hints={hinted: 10**9})
+    names = _report_names(output)
+    assert names.index('bbb.txt') < names.index('aaa.txt')
+    assert names.index('bbb.txt') < names.index('ccc.txt')
+
+
+def _directory_order(path):
+    with open(path) as f:
+        reader = csv.reader(f)
+        next(reader)
+        return [row[3] for row in reader if int(row[15]) >= 0]
+
+
+@pytest.mark.parametrize("order", ['largest', 'bfs', 'dfs', 'hybrid'])
+def test_report_orders_complete(filesystem_tree, temp_dir, order):
+    """Test that every traversal order reports the whole tree."""
+    baseline, _ = report(str(filesystem_tree), output=str(temp_dir / "base.csv"), compress='none')
+    output, _ = report(str(filesystem_tree), output=str(temp_dir / f"{order}.csv"),
+                       compress='none', order=order, frontier_limit=1)
+    assert sorted(_report_names(output)) == sorted(_report_names(baseline))
+
+
+def test_report_prefetch(filesystem_tree, temp_dir):
+    """Test that directory readahead warms directories without changing the scan."""
+    baseline, _ = report(str(filesystem_tree), output=str(temp_dir / "base.csv"), compress='none')
+    result = report(str(filesystem_tree), output=str(temp_dir / "prefetch.csv"),
+                    compress='none', max_threads=2, prefetch=4)
+    assert sorted(_report_names(result.output)) == sorted(_report_names(baseline))
+    assert 0 <= result.stats['prefetched'] <= len(_directory_order(baseline))
+    assert du(str(filesystem_tree), prefetch=4)[0] == du(str(filesystem_tree))[0]
+
+    # A frontier of hundreds of directories leaves the prefetchers work to do
+    wide = temp_dir / "wide"
+    for d in range(300):
+        (wide / f"d{d}").mkdir(parents=True)
+        for f in range(20):
+            (wide / f"d{d}" / f"f{f}").write_text('')
+    result = report(str(wide), output=str(temp_dir / "wide.csv"), compress='none',
+                    max_threads=1, prefetch=8)
+    assert 0 < result.stats['prefetched'] <= 300
+
+    # While the one worker lists "big", first in largest-first order, the
+    # prefetchers warm each of the 8 empty directories queued behind it
+    # exactly once; the top directory and "big" may also be warmed in the
+    # moment between being queued and being popped
+    known = temp_dir / "known"
+    (known / "big").mkdir(parents=True)
+    for f in range(10000):
+        (known / "big" / f"f{f}").write_text('')
+    for d in range(8):
+        (known / f"d{d}").mkdir()
+    result = report(str(known), output=str(temp_dir / "known.csv"), compress='none',
+                    max_threads=1, prefetch=16)
+    assert 8 <= result.stats['prefetched'] <= 10
+
+
+def test_report_bfs_dfs_order(filesystem_tree, temp_dir):
+    """Test BFS and DFS directory order with a single worker."""
+    bfs, _ = report(str(filesystem_tree), output=str(temp_dir / "bfs.csv"),
+                    compress='none', max_threads=1, order='bfs')
+    dirs = _directory_order(bfs)
+    # All top-level directories are scanned before any of their children
+    assert all(name.startswith('dir_3_') for name in dirs[1:4])
+
+    dfs = report(str(filesystem_tree), output=str(temp_dir / "dfs.csv"),
+                 compress='none', max_threads=1, order='dfs')
+    dirs = _directory_order(dfs.output)
+    assert [name[:5] for name in dirs[1:4]] == ['dir_3', 'dir_2', 'dir_1']
+    assert dfs.stats['frontier_peak'] > 0
+
+    with pytest.raises(ValueError, match="Invalid order"):
+        report(str(filesystem_tree), order='random')
+
+
+def test_report_names(filesystem_tree, temp_dir):
+    """Test user and group name columns."""
+    import grp
+    import pwd
+
+    output, _ = report(str(filesystem_tree), output=str(temp_dir / "names.csv"),
+                       compress='none', names=True, max_threads=4)
+    with open(output) as f:
+        rows = list(csv.DictReader(f))
+
+    baseline, _ = report(str(filesystem_tree), output=str(temp_dir / "plain.csv"), compress='none')
+    assert len(rows) == len(_report_names(baseline))
+
+    for row in rows:
+        uid, gid = int(row['UID']), int(row['GID'])
+        try:
+            assert row['user'] == pwd.getpwuid(uid).pw_name
+        except KeyError:
+            assert row['user'] == str(uid)
+        try:
+            assert row['group'] == grp.getgrgid(gid).gr_name
+        except KeyError:
+            assert row['group'] == str(gid)
+
+
+def test_report_multiple_roots(simple_tree, deep_tree, temp_dir):
+    """Test scanning several roots into one output with root ids."""
+    result = report([str(simple_tree), str(deep_tree)], output=str(temp_dir / "multi.csv"),
+                    compress='none')
+    with open(result.output) as f:
+        rows = list(csv.DictReader(f))
+
+    by_root = {}
+    for row in rows:
+        by_root.setdefault(row['root_id'], []).append(row['filename'])
+    assert 'file3.log' in by_root['0'] and 'file3.log' not in by_root['1']
+    assert 'file_level_9.txt' in by_root['1']
+    assert len(rows) == (len(_report_names(report(str(simple_tree), output=str(temp_dir / "a.csv"),
+                                                   compress='none').output)) +
+                         len(_report_names(report(str(deep_tree), output=str(temp_dir / "b.csv"),
+                                                  compress='none').output)))
+
+
+def test_report_multiple_roots_depth_counts(simple_tree, deep_tree, temp_dir):
+    """Depth counts add up over roots; level 0 counts each root."""
+    a = report(str(simple_tree), output=str(temp_dir / "a.csv"), compress='none')
+    b = report(str(deep_tree), output=str(temp_dir / "b.csv"), compress='none')
+    c = report(str(deep_tree / "level_0" / "level_1"), output=str(temp_dir / "c.csv"), compress='none')
+    both = report([str(simple_tree), str(deep_tree), str(deep_tree / "level_0" / "level_1")],
+                  output=[str(temp_dir / n) for n in ("x.csv", "y.csv", "z.csv")],
+                  compress='none')
+
+    assert both.depth_counts[0] == 3
+    merged = [0] * max(len(a.depth_counts), len(b.depth_counts), len(c.depth_counts))
+    for counts in (a.depth_counts, b.depth_counts, c.depth_counts):
+        for level, n in enumerate(counts):
+            merged[level] += n
+    assert both.depth_counts == merged
+
+
+def test_report_per_root_outputs(simple_tree, deep_tree, temp_dir):
+    """Test one output file per root."""
+    outputs = [str(temp_dir / "simple.csv"), str(temp_dir / "deep.csv")]
+    result = report([str(simple_tree), str(deep_tree)], output=outputs, compress='none')
+
+    assert result.output == outputs
+    simple_names = _report_names(outputs[0])
+    deep_names = _report_names(outputs[1])
+    assert 'file3.log' in simple_names and 'file3.log' not in deep_names
+    assert 'file_level_9.txt' in deep_names and 'file_level_9.txt' not in simple_names
+
+    with pytest.raises(ValueError):
+        report([str(simple_tree)], output=outputs, compress='none')
+
+
+def test_stat_many(simple_tree, temp_dir):
+    """Test stat of an explicit path list."""
+    paths = [str(simple_tree / "file0.txt"), str(simple_tree / "dir1"),
+             str(simple_tree / "missing.txt")]
+    result = stat_many(paths, output=str(temp_dir / "stat.csv"), max_threads=2)
+
+    with open(result.output) as f:
+        rows = {row['filename']: row for row in csv.DictReader(f)}
+    assert set(rows) == set(paths[:2])
+    assert int(rows[paths[0]]['st_size']) == os.path.getsize(paths[0])
+    assert rows[paths[0]]['pw_fcount'] == '-1'
+    assert result.stats['count'] == 2
+    assert len(result.errors) == 1 and result.errors[0].startswith(paths[2])
+
+
+def _xxh64(data):
+    """Reference XXH64 (seed 0) straight from the specification."""
+    m = (1 << 64) - 1
+    p1, p2, p3, p4, p5 = (11400714785074694791, 14029467366897019727, 1609587929392839161,
+                          9650029242287828579, 2870177450012600261)
+    rotl = lambda x, r: ((x << r) | (x >> (64 - r))) & m
+    rnd = lambda acc, v: rotl((acc + v * p2) & m, 31) * p1 & m
+    word = lambda i, size: int.from_bytes(data[i:i + size], 'little')
+    n, i = len(data), 0
+    if n >= 32:
+        v = [(p1 + p2) & m, p2, 0, -p1 & m]
+        while n - i >= 32:
+            v = [rnd(v[k], word(i + 8 * k, 8)) for k in range(4)]
+            i += 32
+        h = (rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18)) & m
+        for k in range(4):
+            h = ((h ^ rnd(0, v[k])) * p1 + p4) & m
+    else:
+        h = p5
+    h = (h + n) & m
+    while n - i >= 8:
+        h = (rotl(h ^ rnd(0, word(i, 8)), 27) * p1 + p4) & m
+        i += 8
+    if n - i >= 4:
+        h = (rotl(h ^ (word(i, 4) * p1 & m), 23) * p2 + p3) & m
+        i += 4
+    for b in data[i:]:
+        h = rotl(h ^ (b * p5 & m), 11) * p1 & m
+    for shift, mult in ((33, p2), (29, p3)):
+        h = (h ^ (h >> shift)) * mult & m
+    return h ^ (h >> 32)
+
+
+def test_report_checksum(simple_tree, temp_dir):
+    """Test the xxh64 column against the specification and known vectors."""
+    sizes = {'empty': 0, 'abc': 3, 'b31': 31, 'b32': 32, 'b45': 45, 'big': (1 << 20) + 77}
+    for name, size in sizes.items():
+        (simple_tree / name).write_bytes(b'abc' if name == 'abc' else os.urandom(size))
+    output = report(str(simple_tree), output=str(temp_dir / "sums.csv"), compress='none',
+                    checksum=True, checksum_threads=2, checksum_bandwidth=1 << 30).output
+
+    paths = {p.name: p for p in simple_tree.rglob('*')}
+    with open(output) as f:
+        rows = list(csv.DictReader(f))
+    assert len(rows) == len(paths) + 1
+    sums = {row['filename']: row['xxh64'] for row in rows}
+    assert sums['empty'] == 'ef46db3751d8e999'
+    assert sums['abc'] == '44bc2cf5ad770999'
+    for name, path in paths.items():
+        expected = '%016x' % _xxh64(path.read_bytes()) if path.is_file() else ''
+        assert sums[name] == expected
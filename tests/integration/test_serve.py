@@ -0,0 +1,77 @@
+"""
+Integration tests for the pwalk serve usage daemon
+"""
+
+import os
+import socket
+import threading
+import time
+
+import pytest
+
+from pwalk import report
+from pwalk.serve import UsageServer, ask, latest_scan
+
+
+def test_serve_usage_and_hot_swap(simple_tree, temp_dir):
+    """Test usage queries over the socket and swapping in a newer scan."""
+    scans = temp_dir / "scans"
+    scans.mkdir()
+    report(str(simple_tree), output=str(scans / "week1.csv"), compress='none')
+
+    sock = str(temp_dir / "pwalk.sock")
+    server = UsageServer(str(scans), sock, root=str(simple_tree), interval=3600)
+    thread = threading.Thread(target=server.serve_forever, daemon=True)
+    thread.start()
+    try:
+        reply = ask({'op': 'usage', 'path': str(simple_tree / "dir1")}, sock)
+        assert reply['files'] == 3
+        assert reply['size'] == sum(os.lstat(simple_tree / "dir1" / n).st_size
+                                    for n in ('', 'file1.txt', 'file2.dat'))
+        assert ask({'op': 'usage', 'path': str(simple_tree), 'uid': os.getuid()},
+                   sock)['files'] == 8
+        assert ask({'op': 'usage', 'path': str(simple_tree), 'uid': os.getuid() + 1},
+                   sock)['files'] == 0
+        assert 'error' in ask({'op': 'usage', 'path': str(simple_tree / "nope")}, sock)
+
+        children = ask({'op': 'children', 'path': str(simple_tree)}, sock)['children']
+        assert sorted(name for name, files, size in children) == ['dir1', 'dir2', 'file0.txt']
+
+        # A newer scan is swapped in without restarting
+        (simple_tree / "dir1" / "new.bin").write_bytes(b'x' * 5000)
+        time.sleep(0.01)
+        report(str(simple_tree), output=str(scans / "week2.csv"), compress='none')
+        os.utime(scans / "week2.csv", (time.time() + 10, time.time() + 10))
+        assert server.reload()
+        assert os.path.exists(str(scans / "week2.csv") + '.idx')
+        reply = ask({'op': 'usage', 'path': str(simple_tree / "dir1")}, sock)
+        assert reply['files'] == 4 and reply['size'] >= 5000
+        assert ask({'op': 'info'}, sock)['scan'].endswith('week2.csv')
+    finally:
+        server.shutdown()
+        server.server_close()
+
+
+def test_serve_socket_and_partial_scans(simple_tree, temp_dir):
+    """Test that a live socket is kept, a stale one replaced, and partial scans skipped."""
+    scans = temp_dir / "scans"
+    scans.mkdir()
+    report(str(simple_tree), output=str(scans / "week1.csv"), compress='none')
+    (scans / "week2.csv.4242.part").write_text("inode,parent-inode\n")
+    os.utime(scans / "week2.csv.4242.part", (time.time() + 10, time.time() + 10))
+    assert latest_scan(str(scans)).endswith("week1.csv")
+
+    sock = str(temp_dir / "pwalk.sock")
+    stale = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    stale.bind(sock)
+    stale.close()
+    server = UsageServer(str(scans), sock, interval=3600)
+    thread = threading.Thread(target=server.serve_forever, daemon=True)
+    thread.start()
+    try:
+        with pytest.raises(OSError, match="already listening"):
+            UsageServer(str(scans), sock, interval=3600)
+        assert ask({'op': 'info'}, sock)['scan'].endswith('week1.csv')
+    finally:
+        server.shutdown()
+        server.server_close()
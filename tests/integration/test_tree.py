@@ -0,0 +1,83 @@
+"""
+Integration tests for load_tree()
+"""
+
+import os
+
+import pytest
+
+import _pwalk_core
+from pwalk import load_tree, report
+
+
+def test_load_tree(simple_tree, temp_dir):
+    """Test lookups, subtree intervals and sums against the filesystem."""
+    scan, _ = report(str(simple_tree), output=str(temp_dir / "scan.csv"), compress='none')
+    tree = load_tree(scan, root=str(simple_tree))
+
+    paths = [str(simple_tree)]
+    for dirpath, dirnames, filenames in os.walk(simple_tree):
+        paths += [os.path.join(dirpath, n) for n in dirnames + filenames]
+    assert len(tree) == len(paths)
+    assert tree.roots == [0]
+    assert tree.parent(0) is None
+
+    for path in paths:
+        i = tree.lookup(path)
+        assert tree.path(i) == path
+        start, end = tree.subtree(i)
+        assert start == i and tree.subtree_count(i) == end - i
+        below = [p for p in paths if p == path or p.startswith(path + '/')]
+        assert end - i == len(below)
+        assert tree.subtree_sum(i) == sum(os.lstat(p).st_size for p in below)
+
+    dir2 = tree.lookup(str(simple_tree / "dir2"))
+    assert [tree.name(c) for c in tree.children(dir2)] == ['subdir']
+    assert tree.lookup(str(simple_tree) + '/dir1/') == tree.lookup(str(simple_tree / "dir1"))
+    with pytest.raises(KeyError):
+        tree.lookup(str(simple_tree / "missing"))
+
+
+def test_tree_columns(deep_tree, temp_dir):
+    """Test the buffer protocol columns on a compressed scan."""
+    compress = 'zstd' if _pwalk_core.HAS_ZSTD else 'none'
+    scan, _ = report(str(deep_tree), output=str(temp_dir / "scan.csv"), compress=compress,
+                     max_threads=4)
+    tree = load_tree(scan)
+
+    n = len(tree)
+    assert n == 21
+    size = tree.column('size')
+    assert size.format == 'q' and size.readonly and len(size) == n
+    assert tree.column('child_offsets').tolist()[-1] == len(tree.column('children')) == n - 1
+    assert sum(size.tolist()) == tree.subtree_sum(0)
+    assert tree.subtree_sum(0, 'blocks') == sum(tree.column('blocks').tolist())
+
+    parent = tree.column('parent').tolist()
+    end = tree.column('subtree_end').tolist()
+    for i in range(1, n):
+        assert parent[i] < i < end[i] <= end[parent[i]]
+    assert tree.path(tree.lookup('deep_tree/level_0/level_1')) == 'deep_tree/level_0/level_1'
+
+    with pytest.raises(KeyError):
+        tree.column('owner')
+
+
+def test_tree_usage_by_uid(deep_tree, temp_dir):
+    """Test per-uid usage of every subtree against a scan of the columns, also when saved."""
+    if os.geteuid() == 0:
+        for k, (dirpath, dirnames, filenames) in enumerate(os.walk(deep_tree)):
+            for i, name in enumerate(dirnames + filenames):
+                os.lchown(os.path.join(dirpath, name), 1000 + (i + k) % 3, -1)
+    scan, _ = report(str(deep_tree), output=str(temp_dir / "scan.csv"), compress='none')
+    built = load_tree(scan)
+    built.save(str(temp_dir / "scan.idx"))
+
+    for tree in (built, load_tree(str(temp_dir / "scan.idx"))):
+        uid, size = tree.column('uid').tolist(), tree.column('size').tolist()
+        blocks, end = tree.column('blocks').tolist(), tree.column('subtree_end').tolist()
+        for i in range(len(tree)):
+            for u in set(uid) | {max(uid) + 1}:
+                mine = [j for j in range(i, end[i]) if uid[j] == u]
+                assert tree.usage(i, uid=u) == (len(mine), sum(size[j] for j in mine),
+                                                sum(blocks[j] for j in mine))